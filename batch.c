@@ -0,0 +1,340 @@
+/* Converting a whole set of models in one process, on a pool of threads.
+
+Jobs are handed out in order to whichever thread is free.  Each job's memory use is estimated from the size of its input files and a job is held back while the total for those already running would go over the limit, so a directory of huge models can't exhaust memory. */
+
+//directories, stat(), getline() and threads are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include "batch.h"
+#include "checkedMem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define INIT_JOBS 64
+
+/* The state shared by the threads of a running batch */
+typedef struct
+{
+	BATCH *batch;
+	CONVERTFUNC convert;
+	size_t maxMemory;
+
+	pthread_mutex_t lock;
+	//signalled whenever a job finishes and its memory is released
+	pthread_cond_t finished;
+
+	//the next job to hand out
+	int next;
+	//number of jobs done so far
+	int done;
+	//estimated memory used by the jobs currently running
+	size_t inFlight;
+} BATCHPOOL;
+
+/* Size of a file in bytes, -1 if it doesn't exist or is not a regular file */
+static long long fileSize( const char *path )
+{
+	struct stat st;
+	if( stat(path, &st) != 0 || !S_ISREG(st.st_mode) ) return -1;
+
+	return (long long)st.st_size;
+}
+
+/* A newly allocated "<dir>/<name><ext>", with only the first <nameLength> chars of name used */
+static char *joinPath( const char *dir, const char *name, size_t nameLength, const char *ext )
+{
+	size_t dirLength = dir != NULL ? strlen(dir) : 0;
+	char *path = checked_malloc(dirLength + 1 + nameLength + strlen(ext) + 1);
+	char *p = path;
+	if( dirLength != 0 )
+	{
+		memcpy(p, dir, dirLength);
+		p += dirLength;
+		if( dir[dirLength - 1] != '/' ) *p++ = '/';
+	}
+	memcpy(p, name, nameLength);
+	strcpy(p + nameLength, ext);
+
+	return path;
+}
+
+/* The output path for a job without one given, <outDir>/<name of the .3do><outExt> */
+static char *outputPath( const char *input, const char *outDir, const char *outExt )
+{
+	const char *name = strrchr(input, '/');
+	name = name != NULL ? name + 1 : input;
+	const char *dot = strrchr(name, '.');
+	size_t nameLength = dot != NULL ? (size_t)(dot - name) : strlen(name);
+
+	return joinPath(outDir, name, nameLength, outExt);
+}
+
+/* Add a job to the batch, taking ownership of the strings */
+static void addJob( BATCH *batch, char **inputs, char *output )
+{
+	if( batch->numJobs == batch->size )
+	{
+		batch->size *= 2;
+		batch->jobs = checked_realloc(batch->jobs, sizeof(BATCHJOB) * batch->size);
+	}
+	BATCHJOB *job = &batch->jobs[batch->numJobs++];
+	job->inputs[0] = inputs[0];
+	job->inputs[1] = batch->numInputs > 1 ? inputs[1] : NULL;
+	job->output = output;
+	job->status = -1;
+
+	//a missing input just means the job will fail
+	job->bytes = 0;
+	for(int i=0; i < batch->numInputs; i++)
+	{
+		long long size = fileSize(inputs[i]);
+		if( size > 0 ) job->bytes += (size_t)size;
+	}
+}
+
+static int compareNames( const void *a, const void *b )
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Every .3do in a directory (in name order, so batches are repeatable) */
+static int listDirectory( BATCH *batch, char *dirName, char *outDir, char *outExt )
+{
+	DIR *dir = opendir(dirName);
+	if( dir == NULL )
+	{
+		fprintf(stderr, "Could not open directory %s\n", dirName);
+		return -1;
+	}
+
+	int numNames = 0;
+	int size = INIT_JOBS;
+	char **names = checked_malloc(sizeof(char *) * size);
+	struct dirent *entry;
+	while( (entry = readdir(dir)) != NULL )
+	{
+		size_t length = strlen(entry->d_name);
+		if( length <= 4 || strcmp(entry->d_name + length - 4, ".3do") != 0 ) continue;
+		if( numNames == size )
+		{
+			size *= 2;
+			names = checked_realloc(names, sizeof(char *) * size);
+		}
+		names[numNames++] = joinPath(NULL, entry->d_name, length - 4, "");
+	}
+	closedir(dir);
+	qsort(names, numNames, sizeof(char *), compareNames);
+
+	for(int i=0; i < numNames; i++)
+	{
+		char *inputs[2];
+		inputs[0] = joinPath(dirName, names[i], strlen(names[i]), ".3do");
+		if( batch->numInputs > 1 )
+		{
+			//the edited .obj sits alongside the .3do
+			inputs[1] = joinPath(dirName, names[i], strlen(names[i]), ".obj");
+			if( fileSize(inputs[1]) < 0 )
+			{
+				fprintf(stderr, "Skipping %s, there is no %s\n", inputs[0], inputs[1]);
+				checked_free(inputs[0]);
+				checked_free(inputs[1]);
+				checked_free(names[i]);
+				continue;
+			}
+		}
+		addJob(batch, inputs, outputPath(inputs[0], outDir, outExt));
+		checked_free(names[i]);
+	}
+	checked_free(names);
+
+	return 0;
+}
+
+/* Every job listed in a manifest file */
+static int listManifest( BATCH *batch, char *manifest, char *outDir, char *outExt )
+{
+	FILE *ifp = fopen(manifest, "r");
+	if( ifp == NULL )
+	{
+		fprintf(stderr, "Could not open manifest %s\n", manifest);
+		return -1;
+	}
+
+	char *line = NULL;
+	size_t lineSize = 0;
+	int lineNumber = 0;
+	while( getline(&line, &lineSize, ifp) != -1 )
+	{
+		lineNumber++;
+
+		//split the line into whitespace separated fields
+		char *fields[3];
+		int numFields = 0;
+		for(char *f = strtok(line, " \t\r\n"); f != NULL; f = strtok(NULL, " \t\r\n"))
+		{
+			if( numFields < 3 ) fields[numFields] = f;
+			numFields++;
+		}
+		if( numFields == 0 || fields[0][0] == '#' ) continue;
+		if( numFields < batch->numInputs || numFields > batch->numInputs + 1 )
+		{
+			fprintf(stderr, "Skipping line %d of %s, expected %d input file(s) and an optional output\n", lineNumber, manifest, batch->numInputs);
+			continue;
+		}
+
+		char *inputs[2];
+		for(int i=0; i < batch->numInputs; i++)
+		{
+			inputs[i] = joinPath(NULL, fields[i], strlen(fields[i]), "");
+		}
+		char *output;
+		if( numFields > batch->numInputs ) output = joinPath(NULL, fields[numFields - 1], strlen(fields[numFields - 1]), "");
+		else output = outputPath(inputs[0], outDir, outExt);
+		addJob(batch, inputs, output);
+	}
+	free(line);
+	fclose(ifp);
+
+	return 0;
+}
+
+BATCH *listBatch( char *source, char *outDir, int numInputs, char *outExt )
+{
+	BATCH *batch = checked_malloc(sizeof(BATCH));
+	batch->numJobs = 0;
+	batch->size = INIT_JOBS;
+	batch->numInputs = numInputs;
+	batch->jobs = checked_malloc(sizeof(BATCHJOB) * batch->size);
+
+	struct stat st;
+	int status;
+	if( stat(source, &st) == 0 && S_ISDIR(st.st_mode) ) status = listDirectory(batch, source, outDir, outExt);
+	else status = listManifest(batch, source, outDir, outExt);
+
+	if( status != 0 )
+	{
+		freeBATCH(batch);
+		return NULL;
+	}
+
+	return batch;
+}
+
+/* Seconds on a clock which only moves forward */
+static double now( void )
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* A pool thread, converting jobs until there are none left */
+static void *batchWorker( void *arg )
+{
+	BATCHPOOL *pool = arg;
+	BATCH *batch = pool->batch;
+
+	pthread_mutex_lock(&pool->lock);
+	while( pool->next < batch->numJobs )
+	{
+		BATCHJOB *job = &batch->jobs[pool->next];
+		size_t cost = job->bytes * BATCH_MEMORY_FACTOR;
+
+		//hold back until enough memory is released, unless nothing else is running (a job over the limit on its own still has to go through)
+		if( pool->inFlight != 0 && pool->inFlight + cost > pool->maxMemory )
+		{
+			pthread_cond_wait(&pool->finished, &pool->lock);
+			continue;
+		}
+		pool->next++;
+		pool->inFlight += cost;
+		pthread_mutex_unlock(&pool->lock);
+
+		job->status = pool->convert(job);
+
+		pthread_mutex_lock(&pool->lock);
+		pool->inFlight -= cost;
+		pool->done++;
+		printf("[%d/%d] %s %s\n", pool->done, batch->numJobs, job->status == 0 ? "converted" : "FAILED", job->inputs[0]);
+		pthread_cond_broadcast(&pool->finished);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+int runBatch( BATCH *batch, CONVERTFUNC convert, int numThreads, size_t maxMemory )
+{
+	if( numThreads <= 0 ) numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if( numThreads > batch->numJobs ) numThreads = batch->numJobs;
+	if( numThreads < 1 ) numThreads = 1;
+
+	BATCHPOOL pool;
+	pool.batch = batch;
+	pool.convert = convert;
+	pool.maxMemory = maxMemory;
+	pool.next = 0;
+	pool.done = 0;
+	pool.inFlight = 0;
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.finished, NULL);
+
+	double start = now();
+
+	//this thread works through jobs along with the rest of the pool
+	pthread_t *threads = checked_malloc(sizeof(pthread_t) * numThreads);
+	int numStarted = 0;
+	for(int i=1; i < numThreads; i++)
+	{
+		if( pthread_create(&threads[numStarted], NULL, batchWorker, &pool) == 0 ) numStarted++;
+	}
+	batchWorker(&pool);
+	for(int i=0; i < numStarted; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	checked_free(threads);
+
+	double seconds = now() - start;
+	pthread_mutex_destroy(&pool.lock);
+	pthread_cond_destroy(&pool.finished);
+
+	//SUMMARY
+	int numFailed = 0;
+	double totalBytes = 0;
+	for(int i=0; i < batch->numJobs; i++)
+	{
+		if( batch->jobs[i].status != 0 ) numFailed++;
+		totalBytes += batch->jobs[i].bytes;
+	}
+	printf("Converted %d of %d models, %d failed\n", batch->numJobs - numFailed, batch->numJobs, numFailed);
+	printf("Read %.1f MB in %.2f s (%.1f MB/s) on %d threads\n", totalBytes / 1e6, seconds, seconds > 0 ? totalBytes / 1e6 / seconds : 0.0, numStarted + 1);
+	for(int i=0; i < batch->numJobs; i++)
+	{
+		if( batch->jobs[i].status != 0 ) printf("FAILED: %s\n", batch->jobs[i].inputs[0]);
+	}
+
+	return numFailed;
+}
+
+void freeBATCH( BATCH *batch )
+{
+	if( batch == NULL ) return;
+
+	for(int i=0; i < batch->numJobs; i++)
+	{
+		checked_free(batch->jobs[i].inputs[0]);
+		checked_free(batch->jobs[i].inputs[1]);
+		checked_free(batch->jobs[i].output);
+	}
+	checked_free(batch->jobs);
+	checked_free(batch);
+}
@@ -0,0 +1,43 @@
+#include <stddef.h>
+
+/* One model to convert as part of a batch */
+typedef struct
+{
+	//the input files, a .3do (then the .obj for obj3do)
+	char *inputs[2];
+	//the file to write
+	char *output;
+	//total size of the inputs, used to estimate the memory converting them takes
+	size_t bytes;
+	//0 once converted, -1 if it failed
+	int status;
+} BATCHJOB;
+
+/* Every model to convert */
+typedef struct
+{
+	BATCHJOB *jobs;
+	int numJobs;
+	//number of jobs we have allocated space for
+	int size;
+	//number of inputs each job has
+	int numInputs;
+} BATCH;
+
+/* Convert a single job, returning 0 on success or -1 on failure.  Called from several threads at once so it must not rely on any global state. */
+typedef int (*CONVERTFUNC)( BATCHJOB *job );
+
+//default limit on the memory in use by conversions running at the same time
+#define BATCH_MEMORY ((size_t)1 << 30)
+//rough memory used converting a model, as a multiple of the size of its input files
+#define BATCH_MEMORY_FACTOR 4
+
+/* Build the list of jobs from <source>, which is either a directory or a manifest file.
+
+From a directory every .3do file becomes a job (for 2 inputs, only those with a matching .obj alongside).  A manifest has one job per line: the input files, optionally followed by the output file.  Lines starting with # are skipped.  Unless given, outputs go in <outDir> named after the .3do with the extension <outExt>.  Returns NULL on failure. */
+BATCH *listBatch( char *source, char *outDir, int numInputs, char *outExt );
+
+/* Convert every job in the batch on a pool of <numThreads> threads (0 for one per processor), holding back jobs while the estimated memory in use would exceed <maxMemory> bytes.  Prints a line as each job finishes then a summary, returning the number of jobs that failed. */
+int runBatch( BATCH *batch, CONVERTFUNC convert, int numThreads, size_t maxMemory );
+
+void freeBATCH( BATCH *batch );
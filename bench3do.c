@@ -0,0 +1,190 @@
+/* Benchmark of each stage of the conversions, run by 'make bench'.
+
+Synthetic models (see genModel.h) of increasing size are written out, then every stage is timed on them in turn: reading the .3do, writing the .obj (both ways), reading the .obj back, merging it into the model and writing the .3do.  Each stage is run a few times and the fastest kept.  The results are printed as CSV, one line per stage and model size, with the throughput in MB/s of the file each stage reads or writes and in faces/s. */
+
+//clock_gettime() is POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include "modl.h"
+#include "genModel.h"
+#include "meshFilter.h"
+#include "read3do.h"
+#include "write3do.h"
+#include "textOut.h"
+#include "writeObj.h"
+#include "streamObj.h"
+#include "objStructs.h"
+#include "readObj.h"
+#include "update3do.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+//the files each size of model is written to, removed afterwards
+#define BENCH_3DO "bench.tmp.3do"
+#define BENCH_OBJ "bench.tmp.obj"
+#define BENCH_MTL "bench.tmp.mtl"
+#define BENCH_OUT "bench.tmp.out.3do"
+
+/* A size of model to time */
+typedef struct
+{
+	char *name;
+	int numMeshes;
+	int numVertices;
+	int numFaces;
+} BENCHSIZE;
+
+static BENCHSIZE sizes[] = {
+	{ "small", 8, 500, 800 },
+	{ "medium", 16, 2000, 3200 },
+	{ "large", 32, 4000, 6400 },
+};
+#define NUM_SIZES ((int)(sizeof(sizes) / sizeof(sizes[0])))
+
+/* Seconds on a clock which only moves forward */
+static double now( void )
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long long fileSize( const char *path )
+{
+	struct stat st;
+	if( stat(path, &st) != 0 ) return -1;
+
+	return (long long)st.st_size;
+}
+
+/* Print one result, <bytes> being the size of the file the stage reads or writes */
+static void report( char *stage, BENCHSIZE *size, long long bytes, double seconds )
+{
+	long long faces = (long long)size->numMeshes * size->numFaces;
+	printf("%s,%s,%d,%lld,%lld,%lld,%.6f,%.2f,%.0f\n", stage, size->name, size->numMeshes, (long long)size->numMeshes * size->numVertices, faces, bytes, seconds, bytes / 1e6 / seconds, faces / seconds);
+	fflush(stdout);
+}
+
+/* Exit if a stage fails, the numbers would mean nothing */
+static void check( int ok, char *stage )
+{
+	if( ok ) return;
+
+	fprintf(stderr, "Stage %s failed\n", stage);
+	exit(EXIT_FAILURE);
+}
+
+static void benchSize( BENCHSIZE *size, int reps )
+{
+	GENPARAMS params;
+	defaultGENPARAMS(&params);
+	params.numMeshes = size->numMeshes;
+	params.numVertices = size->numVertices;
+	params.numFaces = size->numFaces;
+
+	//the fastest of <reps> runs of each stage
+	double best[7];
+	for(int i=0; i < 7; i++) best[i] = 1e30;
+
+	for(int r=0; r < reps; r++)
+	{
+		double t;
+
+		//write3do, of the generated model
+		MODL *m = generateMODL(&params);
+		t = now();
+		check(write3do(m, BENCH_3DO) == 0, "write3do");
+		t = now() - t;
+		if( t < best[0] ) best[0] = t;
+		freeMODL(m);
+
+		//read3do
+		t = now();
+		m = read3doMapped(BENCH_3DO);
+		t = now() - t;
+		check(m != NULL, "read3do");
+		if( t < best[1] ) best[1] = t;
+
+		//printObj (with printMtl), which scales the model it is given
+		t = now();
+		check(printObj(m, BENCH_OBJ) == 0 && printMtl(m, BENCH_MTL, ".png") == 0, "printObj");
+		t = now() - t;
+		if( t < best[2] ) best[2] = t;
+		freeMODL(m);
+
+		//streamObj, the same output straight from the file
+		t = now();
+		check(streamObj(BENCH_3DO, BENCH_OBJ, BENCH_MTL, ".png", NULL) == 0, "streamObj");
+		t = now() - t;
+		if( t < best[3] ) best[3] = t;
+
+		//readObj
+		t = now();
+		OBJ *o = readObj(BENCH_OBJ);
+		t = now() - t;
+		check(o != NULL, "readObj");
+		if( t < best[4] ) best[4] = t;
+
+		//update3do, into a freshly read model
+		m = read3doMapped(BENCH_3DO);
+		check(m != NULL, "read3do");
+		t = now();
+		update3do(m, o);
+		t = now() - t;
+		if( t < best[5] ) best[5] = t;
+		freeOBJ(o);
+
+		//write3do, of the merged model
+		t = now();
+		check(write3do(m, BENCH_OUT) == 0, "write3do");
+		t = now() - t;
+		if( t < best[6] ) best[6] = t;
+		freeMODL(m);
+	}
+
+	long long modelBytes = fileSize(BENCH_3DO);
+	long long objBytes = fileSize(BENCH_OBJ);
+	report("write3do", size, modelBytes, best[0]);
+	report("read3do", size, modelBytes, best[1]);
+	report("printObj", size, objBytes, best[2]);
+	report("streamObj", size, objBytes, best[3]);
+	report("readObj", size, objBytes, best[4]);
+	report("update3do", size, objBytes, best[5]);
+	report("write3do_merged", size, fileSize(BENCH_OUT), best[6]);
+
+	remove(BENCH_3DO);
+	remove(BENCH_OBJ);
+	remove(BENCH_MTL);
+	remove(BENCH_OUT);
+}
+
+int main( int argc, char *argv[] )
+{
+	int reps = 3;
+	int numSizes = NUM_SIZES;
+	for(int i=1; i < argc; i++)
+	{
+		if( strcmp(argv[i], "--reps") == 0 && i+1 < argc ) reps = atoi(argv[++i]);
+		//just the smallest model, as a quick check
+		else if( strcmp(argv[i], "--quick") == 0 ) numSizes = 1;
+		else
+		{
+			printf("Usage '%s [--reps N] [--quick]', times each stage of the conversions on synthetic models and prints CSV\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if( reps < 1 ) reps = 1;
+
+	printf("stage,model,meshes,vertices,faces,bytes,seconds,mb_per_s,faces_per_s\n");
+	for(int i=0; i < numSizes; i++)
+	{
+		benchSize(&sizes[i], reps);
+	}
+
+	exit(EXIT_SUCCESS);
+}
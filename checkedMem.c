@@ -1,11 +1,344 @@
+/* The checked allocation functions and the allocators beneath them (see checkedMem.h). */
+
+//threads are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
 #include "checkedMem.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Where a checked function was called from */
+typedef struct
+{
+	const char *file;
+	int line;
+	const char *func;
+} CALLSITE;
+
+/* One way of getting memory, each returns NULL on failure for the checked functions to deal with */
+typedef struct
+{
+	const char *name;
+	//<zero> asks for the memory cleared, as calloc()
+	void *(*alloc)(size_t size, int zero, const CALLSITE *site);
+	//<ptr> is never NULL
+	void *(*resize)(void *ptr, size_t size, const CALLSITE *site);
+	void (*release)(void *ptr);
+} ALLOCATOR;
+
+/* Kept in front of each block by the bump and tracking allocators, the union keeps what follows aligned for any type */
+typedef union
+{
+	struct
+	{
+		size_t size;
+		//bump: whether the block has its own malloc(), tracking: the call site slot
+		size_t tag;
+	} info;
+	long double align;
+} BLOCKHEADER;
+
+#define HEADER(ptr) ((BLOCKHEADER *)(ptr) - 1)
+
+
+/* SYSTEM, straight through to the C library */
+static void *systemAlloc(size_t size, int zero, const CALLSITE *site)
+{
+	return zero ? calloc(1, size) : malloc(size);
+}
+
+static void *systemResize(void *ptr, size_t size, const CALLSITE *site)
+{
+	return realloc(ptr, size);
+}
+
+static void systemRelease(void *ptr)
+{
+	free(ptr);
+}
+
+
+/* BUMP, each thread carves blocks off the front of its own chunk.  Blocks are never given back, except big ones which get a malloc() of their own. */
+#define BUMP_CHUNK_SIZE (1024 * 1024)
+//anything bigger than this isn't worth wasting the end of a chunk on
+#define BUMP_MAX_PIECE (BUMP_CHUNK_SIZE / 8)
+
+typedef struct
+{
+	char *next;
+	size_t left;
+} BUMPCHUNK;
+
+static pthread_key_t bumpKey;
+static pthread_once_t bumpKeyOnce = PTHREAD_ONCE_INIT;
+
+static void createBumpKey(void)
+{
+	pthread_key_create(&bumpKey, NULL);
+}
+
+static void *bumpAlloc(size_t size, int zero, const CALLSITE *site)
+{
+	if(size > BUMP_MAX_PIECE)
+	{
+		if(size > (size_t)-1 - sizeof(BLOCKHEADER)) return NULL;
+		BLOCKHEADER *header = zero ? calloc(1, sizeof(BLOCKHEADER) + size) : malloc(sizeof(BLOCKHEADER) + size);
+		if(header == NULL) return NULL;
+		header->info.size = size;
+		header->info.tag = 1;
+		return header + 1;
+	}
+
+	size_t rounded = sizeof(BLOCKHEADER) + (size + sizeof(BLOCKHEADER) - 1) / sizeof(BLOCKHEADER) * sizeof(BLOCKHEADER);
+
+	pthread_once(&bumpKeyOnce, createBumpKey);
+	BUMPCHUNK *chunk = pthread_getspecific(bumpKey);
+	if(chunk == NULL || chunk->left < rounded)
+	{
+		//the chunk keeps track of itself at its start, whatever was left of the old one is wasted
+		chunk = malloc(BUMP_CHUNK_SIZE);
+		if(chunk == NULL) return NULL;
+		chunk->next = (char *)chunk + sizeof(BLOCKHEADER);
+		chunk->left = BUMP_CHUNK_SIZE - sizeof(BLOCKHEADER);
+		pthread_setspecific(bumpKey, chunk);
+	}
+
+	BLOCKHEADER *header = (BLOCKHEADER *)chunk->next;
+	chunk->next += rounded;
+	chunk->left -= rounded;
+	header->info.size = size;
+	header->info.tag = 0;
+	if(zero) memset(header + 1, 0, size);
+	return header + 1;
+}
+
+static void bumpRelease(void *ptr)
+{
+	if(HEADER(ptr)->info.tag) free(HEADER(ptr));
+}
+
+static void *bumpResize(void *ptr, size_t size, const CALLSITE *site)
+{
+	size_t oldSize = HEADER(ptr)->info.size;
+	if(size <= oldSize) return ptr;
+
+	void *mem = bumpAlloc(size, 0, site);
+	if(mem == NULL) return NULL;
+	memcpy(mem, ptr, oldSize);
+	bumpRelease(ptr);
+	return mem;
+}
+
+
+/* TRACKING, the system allocator with every block noted against the place it was asked for */
+//distinct call sites that can be told apart, any more are lumped into the last slot
+#define MAX_SITES 4096
+//sites listed in the report, the busiest first
+#define MAX_REPORTED_SITES 30
+
+typedef struct
+{
+	CALLSITE site;
+	long long calls;
+	long long bytes;
+} SITECOUNT;
+
+static struct
+{
+	pthread_mutex_t lock;
+	long long allocations;
+	long long reallocations;
+	long long frees;
+	long long bytes;
+	long long liveBlocks;
+	long long liveBytes;
+	long long peakBytes;
+	SITECOUNT sites[MAX_SITES];
+	int numSites;
+} tracking = { PTHREAD_MUTEX_INITIALIZER };
+
+/* The slot counting <site>, found by hashing where it is.  Called with the lock held. */
+static size_t siteSlot(const CALLSITE *site)
+{
+	size_t hash = ((size_t)site->file >> 4) * 31 + (size_t)site->line;
+	for(int probe=0; probe < MAX_SITES - 1; probe++)
+	{
+		size_t slot = (hash + probe) % (MAX_SITES - 1);
+		SITECOUNT *count = &tracking.sites[slot];
+		if(count->site.file == NULL)
+		{
+			count->site = *site;
+			tracking.numSites++;
+			return slot;
+		}
+		if(count->site.file == site->file && count->site.line == site->line) return slot;
+	}
+
+	tracking.sites[MAX_SITES - 1].site.file = "(other)";
+	return MAX_SITES - 1;
+}
+
+/* Note a new block of <size> bytes from <site>.  Called with the lock held. */
+static void trackBlock(BLOCKHEADER *header, size_t size, const CALLSITE *site)
+{
+	size_t slot = siteSlot(site);
+	tracking.sites[slot].calls++;
+	tracking.sites[slot].bytes += size;
+	tracking.bytes += size;
+	tracking.liveBytes += size;
+	if(tracking.liveBytes > tracking.peakBytes) tracking.peakBytes = tracking.liveBytes;
+
+	header->info.size = size;
+	header->info.tag = slot;
+}
+
+static void *trackingAlloc(size_t size, int zero, const CALLSITE *site)
+{
+	if(size > (size_t)-1 - sizeof(BLOCKHEADER)) return NULL;
+	BLOCKHEADER *header = zero ? calloc(1, sizeof(BLOCKHEADER) + size) : malloc(sizeof(BLOCKHEADER) + size);
+	if(header == NULL) return NULL;
+
+	pthread_mutex_lock(&tracking.lock);
+	tracking.allocations++;
+	tracking.liveBlocks++;
+	trackBlock(header, size, site);
+	pthread_mutex_unlock(&tracking.lock);
+
+	return header + 1;
+}
+
+static void *trackingResize(void *ptr, size_t size, const CALLSITE *site)
+{
+	if(size > (size_t)-1 - sizeof(BLOCKHEADER)) return NULL;
+	size_t oldSize = HEADER(ptr)->info.size;
+	BLOCKHEADER *header = realloc(HEADER(ptr), sizeof(BLOCKHEADER) + size);
+	if(header == NULL) return NULL;
+
+	pthread_mutex_lock(&tracking.lock);
+	tracking.reallocations++;
+	tracking.liveBytes -= oldSize;
+	trackBlock(header, size, site);
+	pthread_mutex_unlock(&tracking.lock);
+
+	return header + 1;
+}
+
+static void trackingRelease(void *ptr)
+{
+	BLOCKHEADER *header = HEADER(ptr);
+
+	pthread_mutex_lock(&tracking.lock);
+	tracking.frees++;
+	tracking.liveBlocks--;
+	tracking.liveBytes -= header->info.size;
+	pthread_mutex_unlock(&tracking.lock);
+
+	free(header);
+}
+
+static int compareSites(const void *a, const void *b)
+{
+	const SITECOUNT *x = a;
+	const SITECOUNT *y = b;
+	if(x->calls != y->calls) return x->calls < y->calls ? 1 : -1;
+	return x->bytes < y->bytes ? 1 : (x->bytes > y->bytes ? -1 : 0);
+}
+
+/* Print the totals and the busiest call sites to stderr, run at exit */
+static void reportTracking(void)
+{
+	pthread_mutex_lock(&tracking.lock);
+
+	fprintf(stderr, "Allocations: %lld (%lld reallocs, %lld frees), %lld bytes requested\n", tracking.allocations, tracking.reallocations, tracking.frees, tracking.bytes);
+	fprintf(stderr, "Live at exit: %lld bytes in %lld blocks, peak %lld bytes\n", tracking.liveBytes, tracking.liveBlocks, tracking.peakBytes);
+
+	SITECOUNT *sites = malloc(sizeof(SITECOUNT) * MAX_SITES);
+	if(sites != NULL)
+	{
+		int n = 0;
+		for(int i=0; i < MAX_SITES; i++)
+		{
+			if(tracking.sites[i].calls > 0) sites[n++] = tracking.sites[i];
+		}
+		qsort(sites, n, sizeof(SITECOUNT), compareSites);
+
+		fprintf(stderr, "%12s %14s  %s\n", "calls", "bytes", "site");
+		for(int i=0; i < n && i < MAX_REPORTED_SITES; i++)
+		{
+			CALLSITE *site = &sites[i].site;
+			fprintf(stderr, "%12lld %14lld  %s:%d %s\n", sites[i].calls, sites[i].bytes, site->file, site->line, site->func != NULL ? site->func : "");
+		}
+		if(n > MAX_REPORTED_SITES) fprintf(stderr, "(%d more sites)\n", n - MAX_REPORTED_SITES);
+		free(sites);
+	}
+
+	pthread_mutex_unlock(&tracking.lock);
+}
+
+
+static const ALLOCATOR allocators[] = {
+	{ "system", systemAlloc, systemResize, systemRelease },
+	{ "bump", bumpAlloc, bumpResize, bumpRelease },
+	{ "tracking", trackingAlloc, trackingResize, trackingRelease },
+};
+#define NUM_ALLOCATORS ((int)(sizeof(allocators) / sizeof(allocators[0])))
+
+//the one in use, fixed by the first allocation
+static const ALLOCATOR *allocator = NULL;
+//asked for by setAllocator() ahead of that
+static const ALLOCATOR *requested = NULL;
+static pthread_once_t allocatorOnce = PTHREAD_ONCE_INIT;
+
+static const ALLOCATOR *findAllocator(const char *name)
+{
+	for(int i=0; i < NUM_ALLOCATORS; i++)
+	{
+		if(strcmp(allocators[i].name, name) == 0) return &allocators[i];
+	}
+	return NULL;
+}
+
+static void fixAllocator(void)
+{
+	allocator = requested;
+	if(allocator == NULL)
+	{
+		char *name = getenv(ALLOCATOR_ENV);
+		if(name != NULL && *name != '\0')
+		{
+			allocator = findAllocator(name);
+			if(allocator == NULL) fprintf(stderr, "Unknown allocator '%s' in %s, using system.\n", name, ALLOCATOR_ENV);
+		}
+	}
+	if(allocator == NULL) allocator = &allocators[0];
+
+	if(allocator->release == trackingRelease) atexit(reportTracking);
+}
+
+static const ALLOCATOR *currentAllocator(void)
+{
+	pthread_once(&allocatorOnce, fixAllocator);
+	return allocator;
+}
+
+int setAllocator(const char *name)
+{
+	const ALLOCATOR *a = findAllocator(name);
+	if(a == NULL || allocator != NULL) return -1;
+
+	requested = a;
+	pthread_once(&allocatorOnce, fixAllocator);
+	return allocator == a ? 0 : -1;
+}
+
 
 /* A quick function to check the result of calls to malloc, terminating if they fail. */
-void *checked_malloc(size_t size) 
+void *checkedMalloc(size_t size, const char *file, int line, const char *func)
 {
-	void *mem = malloc( size );
+	CALLSITE site = { file, line, func };
+	void *mem = currentAllocator()->alloc(size, 0, &site);
 	if( mem == NULL )
 	{
 		fprintf(stderr, "Call to malloc failed.\n");
@@ -16,31 +349,68 @@ void *checked_malloc(size_t size)
 
 }
 /* Ditto for realloc */
-void *checked_realloc(void *ptr, size_t size)
+void *checkedRealloc(void *ptr, size_t size, const char *file, int line, const char *func)
 {
-	void *mem = realloc(ptr, size);
+	CALLSITE site = { file, line, func };
+	const ALLOCATOR *a = currentAllocator();
+	void *mem = ptr == NULL ? a->alloc(size, 0, &site) : a->resize(ptr, size, &site);
 	if(mem == NULL)
 	{
 		fprintf(stderr, "Call to realloc failed.\n");
 		fprintf(stderr, "Terminating program.\n");
 		exit(EXIT_FAILURE);
-	}	
+	}
 
 	return mem;
 }
 
 /* Ditto for calloc */
-void *checked_calloc(size_t nmemb, size_t size)
+void *checkedCalloc(size_t nmemb, size_t size, const char *file, int line, const char *func)
 {
-	void *mem = calloc(nmemb, size);
+	CALLSITE site = { file, line, func };
+	void *mem = NULL;
+	if(size == 0 || nmemb <= (size_t)-1 / size) mem = currentAllocator()->alloc(nmemb * size, 1, &site);
 	if(mem == NULL)
 	{
 		fprintf(stderr, "Call to calloc failed.\n");
 		fprintf(stderr, "Terminating program.\n");
 		exit(EXIT_FAILURE);
 	}
-	
+
 	return mem;
 }
 
+/* Give back anything from the checked functions, NULL is ignored like free() */
+void checked_free(void *ptr)
+{
+	if(ptr == NULL) return;
+
+	currentAllocator()->release(ptr);
+}
+
+
+/* Allocate the single block backing an ARENA, <size> should be the sum of ARENA_ROUND() of every request to come */
+void arenaInit(ARENA *arena, size_t size)
+{
+	arena->base = checked_malloc(size);
+	arena->size = size;
+	arena->used = 0;
+}
+
+/* Hand out the next <size> bytes of an ARENA (NULL for 0 bytes, like an empty array).  Running past the end means the sizing was wrong, so terminate like the other checked functions. */
+void *arenaAlloc(ARENA *arena, size_t size)
+{
+	if(size == 0) return NULL;
+
+	size_t rounded = ARENA_ROUND(size);
+	if(rounded > arena->size - arena->used)
+	{
+		fprintf(stderr, "Arena of %lu bytes exhausted.\n", (unsigned long)arena->size);
+		fprintf(stderr, "Terminating program.\n");
+		exit(EXIT_FAILURE);
+	}
 
+	void *mem = arena->base + arena->used;
+	arena->used += rounded;
+	return mem;
+}
@@ -1,5 +1,35 @@
 #include <stddef.h>
 
-void *checked_malloc(size_t size);
-void *checked_realloc(void *ptr, size_t size);
-void *checked_calloc(size_t nmemb, size_t size);
+/* Allocations which terminate the program rather than return NULL.  Each call site is passed along so the tracking allocator can say where the memory went.  Anything from these must be released with checked_free(), not free(). */
+#define checked_malloc(size) checkedMalloc((size), __FILE__, __LINE__, __func__)
+#define checked_realloc(ptr, size) checkedRealloc((ptr), (size), __FILE__, __LINE__, __func__)
+#define checked_calloc(nmemb, size) checkedCalloc((nmemb), (size), __FILE__, __LINE__, __func__)
+
+void *checkedMalloc(size_t size, const char *file, int line, const char *func);
+void *checkedRealloc(void *ptr, size_t size, const char *file, int line, const char *func);
+void *checkedCalloc(size_t nmemb, size_t size, const char *file, int line, const char *func);
+void checked_free(void *ptr);
+
+/* The allocator underneath the checked functions, picked by name:
+	"system"	malloc() and free() (the default)
+	"bump"		pieces of large chunks which are never given back, so freeing costs nothing (memory only grows, for timing a single conversion)
+	"tracking"	malloc() and free() while counting the allocations, live and peak bytes, and each call site, reported on stderr at exit
+It is fixed by the first allocation, taken from the environment variable CHECKEDMEM_ALLOCATOR unless setAllocator() was called before then.  Returns 0 on success, -1 for an unknown name or if it is too late to change. */
+int setAllocator(const char *name);
+#define ALLOCATOR_ENV "CHECKEDMEM_ALLOCATOR"
+
+/* A single block of memory handed out in pieces, all of which are released together by checked_free() of <base> */
+typedef struct
+{
+	char *base;
+	size_t size;
+	size_t used;
+} ARENA;
+
+//every piece handed out by an ARENA is aligned to this many bytes
+#define ARENA_ALIGN 8
+//the space a request of <n> bytes actually takes up within an ARENA
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+void arenaInit(ARENA *arena, size_t size);
+void *arenaAlloc(ARENA *arena, size_t size);
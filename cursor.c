@@ -0,0 +1,72 @@
+/* Stepping through a .3do file held in memory, shared by the readers (see read3do.c and visit3do.c) */
+
+#include "cursor.h"
+
+#include <stdio.h>
+#include <string.h> //for memcpy
+
+void failCursor( CURSOR *c )
+{
+	c->failed = 1;
+	c->pos = c->size;
+}
+
+const unsigned char *takeBytes( CURSOR *c, size_t n )
+{
+	if( n > c->size - c->pos )
+	{
+		if( !c->failed ) fprintf(stderr, "Hit end of the .3do data unexpectedly.\n");
+		failCursor(c);
+		return NULL;
+	}
+	const unsigned char *p = c->data + c->pos;
+	c->pos += n;
+
+	return p;
+}
+
+int peekInt( const unsigned char *p )
+{
+	int result;
+	memcpy(&result, p, 4);
+
+	return result;
+}
+
+int takeInt( CURSOR *c )
+{
+	return peekInt(takeBytes(c, 4));
+}
+
+float takeFloat( CURSOR *c )
+{
+	float result;
+	memcpy(&result, takeBytes(c, 4), 4);
+
+	return result;
+}
+
+int checkCount( CURSOR *c, int count )
+{
+	if( count < 0 )
+	{
+		fprintf(stderr, "Negative count %d in the .3do data.\n", count);
+		failCursor(c);
+		return 0;
+	}
+
+	return count;
+}
+
+int takeCount( CURSOR *c )
+{
+	const unsigned char *p = takeBytes(c, 4);
+	if( p == NULL ) return 0;
+
+	return checkCount(c, peekInt(p));
+}
+
+void takeBlock( CURSOR *c, void *dest, size_t n )
+{
+	memcpy(dest, takeBytes(c, n), n);
+}
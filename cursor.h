@@ -0,0 +1,40 @@
+#include <stddef.h>
+
+//sizes of the fixed length parts of each section of a .3do file
+#define FACE_HEADER_SIZE 76	//9 ints, 3 vector3's and a float
+#define MESH_HEADER_SIZE 60	//32 byte name and 7 ints
+#define MESH_FOOTER_SIZE 36	//2 ints, a float and 2 vector3's
+#define NODE_FIXED_SIZE 184	//64 byte name, 9 ints, 2 vector3's, 3 floats and 48 unknown bytes
+#define MODL_FOOTER_SIZE 52	//a float, 2 vector3's and 24 unknown bytes
+
+/* A read position within a .3do file held in memory */
+typedef struct
+{
+	const unsigned char *data;
+	size_t size;
+	size_t pos;
+	//set once the data turns out to be truncated or corrupt
+	int failed;
+} CURSOR;
+
+/* Mark the data as corrupt, nothing more can be taken from the cursor */
+void failCursor( CURSOR *c );
+
+/* Return a pointer to the next <n> bytes and step over them.  If the data runs out the cursor fails and NULL is returned. */
+const unsigned char *takeBytes( CURSOR *c, size_t n );
+
+/* Read a 4 byte integer from any position in the data */
+int peekInt( const unsigned char *p );
+
+/* Read a 4 byte integer or float, the bytes must be there (no check is made) */
+int takeInt( CURSOR *c );
+float takeFloat( CURSOR *c );
+
+/* Check a count of vertices, faces etc. read from the data, a negative one can only mean the file is corrupt.  Returns 0 for a bad count. */
+int checkCount( CURSOR *c, int count );
+
+/* Read a count, 0 if the data has run out */
+int takeCount( CURSOR *c );
+
+/* Copy the next <n> bytes into <dest> in one go, the bytes must be there */
+void takeBlock( CURSOR *c, void *dest, size_t n );
@@ -0,0 +1,39 @@
+/* Stamps of files, see fileStamp.h */
+
+//stat() and its nanosecond times are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include "fileStamp.h"
+
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+int stampFile( const char *filename, FILESTAMP *stamp )
+{
+	memset(stamp, 0, sizeof(FILESTAMP));
+#ifndef _WIN32
+	struct stat st;
+	if( stat(filename, &st) != 0 ) return -1;
+
+	stamp->device = st.st_dev;
+	stamp->inode = st.st_ino;
+	stamp->size = st.st_size;
+	stamp->modified = (long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+int sameFile( const FILESTAMP *a, const FILESTAMP *b )
+{
+	return a->device == b->device && a->inode == b->inode;
+}
+
+int sameContents( const FILESTAMP *a, const FILESTAMP *b )
+{
+	return sameFile(a, b) && a->size == b->size && a->modified == b->modified;
+}
@@ -0,0 +1,26 @@
+/* Telling whether a file is still the one that was read earlier, or is the same file as another (i.e before copying parts of it or writing over it).  Only available on POSIX systems, elsewhere stampFile() always fails. */
+
+//included by modl.h and others, stop it being redefined
+#ifndef FILESTAMP_H
+#define FILESTAMP_H
+
+typedef struct
+{
+	//which file it is
+	unsigned long long device;
+	unsigned long long inode;
+	//and what it was like
+	unsigned long long size;
+	long long modified;
+} FILESTAMP;
+
+/* Fill in <stamp> for the file <filename> as it is now, returns 0 on success or -1 if it can't be found */
+int stampFile( const char *filename, FILESTAMP *stamp );
+
+/* 1 if the two stamps are of the same file */
+int sameFile( const FILESTAMP *a, const FILESTAMP *b );
+
+/* 1 if the two stamps are of the same file, with the same size and modification time (so presumably unchanged) */
+int sameContents( const FILESTAMP *a, const FILESTAMP *b );
+
+#endif
@@ -0,0 +1,237 @@
+/* Synthetic models, for tests and benchmarks where real game files can't be shipped.
+
+Every mesh hangs off its own node, and the nodes are put into chains of up to <depth> below the root.  The faces are triangles and quads whose indices step through the vertices so that every vertex (and texture vertex) is used, as a real model's would be.  Only materials with known dimensions are used, so the texture vertices scale cleanly. */
+
+#include "modl.h"
+#include "genModel.h"
+#include "checkedMem.h"
+#include "matScaler.h"	//the names to use for the materials
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A small, fast random number generator (xorshift) so the models are the same everywhere */
+static unsigned int nextRandom( unsigned int *state )
+{
+	unsigned int x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+
+	return x;
+}
+
+/* A random float between <low> and <high> */
+static float randomFloat( unsigned int *state, float low, float high )
+{
+	return low + (high - low) * (nextRandom(state) >> 8) / (float)(1 << 24);
+}
+
+/* A copy of <s> */
+static char *copyString( const char *s )
+{
+	char *copy = checked_malloc(strlen(s) + 1);
+	strcpy(copy, s);
+
+	return copy;
+}
+
+/* Whether built in material <i> has dimensions which texture vertices can be scaled by */
+static int usableMaterial( int i )
+{
+	int width, height;
+	return materialSize(builtinMaterialName(i), &width, &height) && width > 0 && height > 0;
+}
+
+void defaultGENPARAMS( GENPARAMS *params )
+{
+	params->numMeshes = 8;
+	params->numVertices = 500;
+	params->numFaces = 800;
+	params->depth = 4;
+	params->numMaterials = 8;
+	params->seed = 1;
+}
+
+static MESH *generateMESH( GENPARAMS *params, int index, unsigned int *state )
+{
+	MESH *mesh = createMESH();
+
+	char name[32];
+	sprintf(name, "mesh%d", index);
+	mesh->meshName = copyString(name);
+	mesh->unknown1 = 0;
+	mesh->geometryMode = 3;
+	mesh->lightingMode = 3;
+	mesh->textureMode = 3;
+
+	int numVertices = params->numVertices;
+	mesh->numVertices = numVertices;
+	mesh->numTexVertices = numVertices;
+	mesh->vertices = checked_malloc(sizeof(vector3) * numVertices);
+	mesh->texVertices = checked_malloc(sizeof(vector2) * numVertices);
+	mesh->lightData = checked_malloc(sizeof(float) * numVertices);
+	mesh->unknown2 = checked_calloc(numVertices, sizeof(int));
+	mesh->normals = checked_malloc(sizeof(vector3) * numVertices);
+	for(int i=0; i < numVertices; i++)
+	{
+		for(int j=0; j < 3; j++) mesh->vertices[i][j] = randomFloat(state, -1.0f, 1.0f);
+		//in pixels, as they are in a .3do
+		for(int j=0; j < 2; j++) mesh->texVertices[i][j] = randomFloat(state, 0.0f, 64.0f);
+		mesh->lightData[i] = 0.0f;
+		for(int j=0; j < 3; j++) mesh->normals[i][j] = randomFloat(state, -1.0f, 1.0f);
+	}
+
+	//alternate triangles and quads
+	int numFaces = params->numFaces;
+	mesh->numFaces = numFaces;
+	mesh->faces = checked_malloc(sizeof(FACE) * numFaces);
+	mesh->faceOffsets = checked_malloc(sizeof(int) * (numFaces + 1));
+	mesh->faceOffsets[0] = 0;
+	for(int i=0; i < numFaces; i++)
+	{
+		mesh->faceOffsets[i+1] = mesh->faceOffsets[i] + (i % 2 == 0 ? 3 : 4);
+	}
+	int numIndices = mesh->faceOffsets[numFaces];
+	mesh->faceVertexIndices = checked_malloc(sizeof(int) * (numIndices + 1));
+	mesh->faceTexVertexIndices = checked_malloc(sizeof(int) * (numIndices + 1));
+	for(int i=0; i < numIndices; i++)
+	{
+		//stepping through the vertices in turn uses every one of them (given enough faces)
+		mesh->faceVertexIndices[i] = i % numVertices;
+		mesh->faceTexVertexIndices[i] = i % numVertices;
+	}
+
+	for(int i=0; i < numFaces; i++)
+	{
+		FACE *face = &mesh->faces[i];
+		memset(face, 0, sizeof(FACE));
+		face->faceID = i;
+		face->geometryMode = 3;
+		face->lightingMode = 3;
+		face->textureMode = 3;
+		face->numVertices = mesh->faceOffsets[i+1] - mesh->faceOffsets[i];
+		face->hasTexture = 1;
+		face->hasMaterial = 1;
+		//runs of faces share a material, as they tend to
+		face->materialIndex = (i / 16) % params->numMaterials;
+		for(int j=0; j < 3; j++) face->faceNormal[j] = randomFloat(state, -1.0f, 1.0f);
+	}
+
+	mesh->hasShadow = 0;
+	mesh->unknown3 = 0;
+	mesh->meshRadius = 2.0f;
+	memset(mesh->unknown4, 0, sizeof(vector3));
+	memset(mesh->unknown5, 0, sizeof(vector3));
+
+	return mesh;
+}
+
+static NODE *generateNODE( int index, int meshID, unsigned int *state )
+{
+	NODE *node = createNODE();
+
+	char name[64];
+	sprintf(name, "node%d", index);
+	node->name = copyString(name);
+	node->flags = 0;
+	node->unknown1 = 0;
+	node->type = 1;
+	node->meshID = meshID;
+	node->depth = 0;
+	node->hasParent = 0;
+	node->numChildren = 0;
+	node->hasChildren = 0;
+	node->hasSibling = 0;
+	for(int j=0; j < 3; j++)
+	{
+		node->pivot[j] = randomFloat(state, -0.5f, 0.5f);
+		node->position[j] = randomFloat(state, -0.5f, 0.5f);
+	}
+	node->pitch = node->yaw = node->roll = 0.0f;
+	memset(node->unknown2, 0, sizeof(node->unknown2));
+	node->parentID = node->childID = node->siblingID = 0;
+
+	return node;
+}
+
+MODL *generateMODL( GENPARAMS *params )
+{
+	unsigned int state = params->seed != 0 ? params->seed : 1;
+	//each face needs 4 distinct vertices at most
+	if( params->numVertices < 4 ) params->numVertices = 4;
+	if( params->numFaces < 0 ) params->numFaces = 0;
+	if( params->numMeshes < 0 ) params->numMeshes = 0;
+	MODL *model = createMODL();
+
+	memcpy(model->fourcc, "LDOM", 4);
+
+	//materials with known dimensions, spread through the table
+	int numUsable = 0;
+	for(int i=0; i < numBuiltinMaterials(); i++)
+	{
+		if( usableMaterial(i) ) numUsable++;
+	}
+	if( params->numMaterials < 1 ) params->numMaterials = 1;
+	if( params->numMaterials > numUsable ) params->numMaterials = numUsable;
+	model->numMaterials = params->numMaterials;
+	model->materialNames = checked_malloc(sizeof(char *) * model->numMaterials);
+	int step = numUsable / model->numMaterials;
+	for(int i=0, m=0, usable=0; i < numBuiltinMaterials() && m < model->numMaterials; i++)
+	{
+		if( !usableMaterial(i) ) continue;
+		if( usable++ % step == 0 ) model->materialNames[m++] = copyString(builtinMaterialName(i));
+	}
+	model->modelName = copyString("generated.3do");
+
+	model->unknown1 = 0;
+	model->numGeosets = 1;
+	model->numMeshes = params->numMeshes;
+	model->meshes = checked_malloc(sizeof(MESH *) * (params->numMeshes + 1));
+	for(int i=0; i < params->numMeshes; i++)
+	{
+		model->meshes[i] = generateMESH(params, i, &state);
+	}
+
+	//a root without a mesh, then node i+1 holds mesh i
+	int depth = params->depth > 0 ? params->depth : 1;
+	model->unknown2 = 0;
+	model->numNodes = params->numMeshes + 1;
+	model->nodes = checked_malloc(sizeof(NODE *) * model->numNodes);
+	model->nodes[0] = generateNODE(0, -1, &state);
+	int lastChain = -1;
+	for(int i=1; i < model->numNodes; i++)
+	{
+		NODE *node = generateNODE(i, i - 1, &state);
+		model->nodes[i] = node;
+
+		//start a new chain under the root every <depth> nodes, otherwise hang below the node before
+		int parent = (i - 1) % depth == 0 ? 0 : i - 1;
+		NODE *p = model->nodes[parent];
+		node->hasParent = 1;
+		node->parentID = parent;
+		node->depth = p->depth + 1;
+		if( parent == 0 && lastChain != -1 )
+		{
+			//chains are siblings of each other
+			model->nodes[lastChain]->hasSibling = 1;
+			model->nodes[lastChain]->siblingID = i;
+		}
+		else
+		{
+			p->hasChildren = 1;
+			p->childID = i;
+		}
+		p->numChildren++;
+		if( parent == 0 ) lastChain = i;
+	}
+
+	model->modelRadius = 2.0f;
+	memset(model->insertionOffset, 0, sizeof(vector3));
+	memset(model->unknown3, 0, sizeof(vector3));
+	memset(model->unknown4, 0, sizeof(model->unknown4));
+
+	return model;
+}
@@ -0,0 +1,22 @@
+/* Building synthetic models for testing and benchmarking (include modl.h first) */
+
+/* What to put in a generated model */
+typedef struct
+{
+	int numMeshes;
+	//per mesh
+	int numVertices;
+	int numFaces;
+	//longest chain of nodes below the root, the meshes are spread over as many chains as needed
+	int depth;
+	//how many different materials the faces use, taken from the built in table (matNames.h)
+	int numMaterials;
+	//the same seed always gives the same model
+	unsigned int seed;
+} GENPARAMS;
+
+/* Fill in <params> with a small default model */
+void defaultGENPARAMS( GENPARAMS *params );
+
+/* A new MODL as described by <params>, valid to write with write3do() and convert both ways.  Free with freeMODL(). */
+MODL *generateMODL( GENPARAMS *params );
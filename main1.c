@@ -5,52 +5,271 @@
 #include <string.h>
 
 #include "modl.h"
+#include "meshFilter.h"
 #include "read3do.h"
+#include "modlImage.h"
+#include "visit3do.h"
+#include "textOut.h"
 #include "writeObj.h"
+#include "streamObj.h"
+#include "matScaler.h"
+#include "checkedMem.h"
+#include "batch.h"
+#include "stats.h"
+
+//the image format for the textures in the .mtl file
+static char *imageFormat = ".png";
+//convert a mesh at a time (see streamObj.h) rather than reading in the whole model
+static int streamMode = 0;
+//write a flat image of the model (see modlImage.h) rather than a .obj
+static int imageMode = 0;
+//report the time and counts of each phase (see stats.h), STATS_JSON for JSON rather than a table
+static int statsMode = 0;
+//convert only the meshes named by --only and --exclude, NULL for all of them
+static MESHFILTER *meshFilter = NULL;
+#define STATS_TABLE 1
+#define STATS_JSON 2
+
+/* Determine a .mtl name for a .obj file (i.e manny.obj will have manny.mtl), the caller frees it */
+char *mtlFilename(char *objFilename)
+{
+    //replace everything from the first . in the file name (not the directories)
+    char *name = strrchr(objFilename, '/');
+    name = name != NULL ? name + 1 : objFilename;
+    char *dot = strchr(name, '.');
+    size_t length = dot != NULL ? (size_t)(dot - objFilename) : strlen(objFilename);
+
+    char *mtl = checked_malloc(length + 5);
+    memcpy(mtl, objFilename, length);
+    strcpy(mtl + length, ".mtl");
+    return mtl;
+}
+
+/* Convert one .3do into a .obj and .mtl, returns 0 on success or -1 on failure */
+int convertOne(BATCHJOB *job)
+{
+    if(streamMode)
+    {
+	char *mtl = mtlFilename(job->output);
+	int status = streamObj(job->inputs[0], job->output, mtl, imageFormat, meshFilter);
+	checked_free(mtl);
+	return status;
+    }
+
+    //read in the .3do file to a MODL structure, skipping the meshes not asked for
+    MODL *m = meshFilter != NULL ? read3doLazy(job->inputs[0], meshFilter) : read3doMapped(job->inputs[0]);
+    if(m == NULL)
+    {
+	fprintf(stderr, "Failed to read in .3do file %s\n", job->inputs[0]);
+	return -1;
+    }
+
+    if(imageMode)
+    {
+	int status = writeModlImage(m, job->output);
+	freeMODL(m);
+	return status;
+    }
+
+    //write out the structure to a .obj file, then the .mtl alongside it
+    int status = printObj(m, job->output);
+    if(status == 0)
+    {
+	char *mtl = mtlFilename(job->output);
+	status = printMtl(m, mtl, imageFormat);
+	checked_free(mtl);
+    }
+
+    //free memory associated with the MODL structure
+    freeMODL(m);
+
+    return status;
+}
+
+/* Convert one model, recording the stats if asked */
+int convertModel(BATCHJOB *job)
+{
+    if(!statsMode) return convertOne(job);
+
+    STATS stats;
+    startStats(&stats, job->inputs[0]);
+    int status = convertOne(job);
+    stopStats();
+    printStats(&stats, statsMode == STATS_JSON, stdout);
+    return status;
+}
+
+//--info callbacks, print the parts of the model as they are reached
+int infoHeader(void *data, const VISITHEADER *header)
+{
+    printf("%s: model %s, %d materials, %d meshes\n", (char *)data, header->modelName, header->numMaterials, header->numMeshes);
+    return 0;
+}
+
+int infoMaterial(void *data, int index, const char *name)
+{
+    printf("  material %d %s\n", index, name);
+    return 0;
+}
+
+int infoMesh(void *data, const VISITMESH *mesh)
+{
+    printf("  mesh %d %s: %d vertices, %d texture vertices, %d faces\n", mesh->index, mesh->name, mesh->numVertices, mesh->numTexVertices, mesh->numFaces);
+    return 0;
+}
+
+int infoFooter(void *data, const VISITFOOTER *footer)
+{
+    printf("  %d nodes\n", footer->numNodes);
+    return 0;
+}
+
+/* List what is in a .3do without reading in the whole model, returns 0 on success or -1 on failure */
+int printInfo(char *filename)
+{
+    VISITOR visitor = { filename, infoHeader, infoMaterial, infoMesh, NULL, NULL, NULL, NULL, infoFooter };
+    return visit3do(filename, &visitor) == 0 ? 0 : -1;
+}
 
 int main(int argc, char *argv[])
 {
-    if(argc < 3)
+    //pull out any options, leaving the filenames (and image format) in args
+    char *args[3];
+    int numArgs = 0;
+    int batchMode = 0;
+    int numJobs = 0;
+    int numThreads = -1;
+    size_t maxMemory = BATCH_MEMORY;
+    for(int i=1; i < argc; i++)
+    {
+	if(strcmp(argv[i], "--threads") == 0 && i+1 < argc)
+	{
+	    //threads used to decode the meshes of the .3do and write the .obj, 1 for serial
+	    numThreads = atoi(argv[++i]);
+	}
+	else if(strcmp(argv[i], "--precision") == 0 && i+1 < argc)
+	{
+	    //fixed decimal places instead of the exact shortest floats
+	    setObjPrecision(atoi(argv[++i]));
+	}
+	else if(strcmp(argv[i], "--materials") == 0 && i+1 < argc)
+	{
+	    //material sizes from a database built with matdb
+	    if(loadMaterialDb(argv[++i]) != 0) exit(EXIT_FAILURE);
+	}
+	else if((strcmp(argv[i], "--only") == 0 || strcmp(argv[i], "--exclude") == 0) && i+1 < argc)
+	{
+	    //comma separated mesh names or patterns
+	    if(meshFilter == NULL) meshFilter = createMESHFILTER();
+	    addMeshFilter(meshFilter, argv[i+1], strcmp(argv[i], "--exclude") == 0);
+	    i++;
+	}
+	else if(strcmp(argv[i], "--batch") == 0)
+	{
+	    batchMode = 1;
+	}
+	else if(strcmp(argv[i], "--stream") == 0)
+	{
+	    streamMode = 1;
+	}
+	else if(strcmp(argv[i], "--image") == 0)
+	{
+	    imageMode = 1;
+	}
+	else if(strcmp(argv[i], "--stats") == 0)
+	{
+	    statsMode = STATS_TABLE;
+	}
+	else if(strcmp(argv[i], "--stats-json") == 0)
+	{
+	    statsMode = STATS_JSON;
+	}
+	else if(strcmp(argv[i], "--info") == 0)
+	{
+	    //the rest of the arguments are all .3do files to list
+	    int numFailed = 0;
+	    for(i++; i < argc; i++)
+	    {
+		if(printInfo(argv[i]) != 0) numFailed++;
+	    }
+	    exit(numFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	else if(strcmp(argv[i], "--jobs") == 0 && i+1 < argc)
+	{
+	    numJobs = atoi(argv[++i]);
+	}
+	else if(strcmp(argv[i], "--max-memory") == 0 && i+1 < argc)
+	{
+	    //given in MB
+	    maxMemory = (size_t)atol(argv[++i]) << 20;
+	}
+	else if(numArgs < 3)
+	{
+	    args[numArgs++] = argv[i];
+	}
+    }
+
+    if(numArgs < 2)
     {
 	printf("Expected at least 2 arguments, an input and output filename.\n");
 	printf("Usage example '%s manny.3do manny.obj\n", argv[0]);
 	printf("Accepts an optional third argument which is the image format for the textures in the .mtl file\n");
 	printf("i.e '%s manny.3do manny.obj .jpg'\n", argv[0]);
+	printf("Floats are written exactly, '--precision 6' writes 6 fixed decimal places instead\n");
+	printf("The meshes of large models are decoded and written using one thread per processor, '--threads N' uses N instead\n");
+	printf("'--materials file.matdb' takes material sizes from a database built with matdb ahead of the built in ones\n");
+	printf("To convert many models at once '%s --batch models/ objs/' takes a directory of .3do files (or a manifest listing one per line) and an output directory\n", argv[0]);
+	printf("Batches run on one thread per processor ('--jobs N' for N) using at most about 1024 MB ('--max-memory MB')\n");
+	printf("'--only head,*arm*' converts just the meshes with those names (shell style patterns allowed), '--exclude names' all but those (an image is always of the whole model, so neither goes with '--image')\n");
+	printf("'--stream' converts a mesh at a time, overlapping the reading and writing and never holding the whole model in memory\n");
+	printf("'--image' writes a flat image of the model instead, which loads in place of the .3do without any decoding\n");
+	printf("'--stats' reports the time, bytes and counts of each phase of the conversion ('--stats-json' as JSON)\n");
+	printf("'%s --info a.3do b.3do ...' lists the materials and meshes of each model without converting them\n", argv[0]);
 	exit(EXIT_FAILURE);
     }
 
-    //read in the .3do file to a MODL structure
-    MODL *m = read3do(argv[1]);
-    if(m == NULL)
+    if(numArgs == 3)
     {
-	fprintf(stderr, "Failed to read in .3do file %s\n", argv[1]);
-	exit(EXIT_FAILURE);
+	//if a third command line argument given use it as the image format for the .mtl
+	imageFormat = args[2];
     }
 
-    //write out the structure to a .obj file
-    printObj(m, argv[2]);
-    
-    //determine a .mtl name (i.e manny.obj will have manny.mtl) 
-    char mtlFilename[32];
-    strncpy(mtlFilename, argv[2], 32);
-    char *c = mtlFilename;
-    while(*c++ != '.');
-    strncpy(c, "mtl", 4);   //one more space for null byte
-	
-    if(argc == 4)
+    //a filter letting every mesh through needn't be applied at all
+    if(meshFilterEmpty(meshFilter))
     {
-	//if a third command line argument given use it as the image format for the .mtl
-	printMtl(m, mtlFilename, argv[3]);
+	freeMESHFILTER(meshFilter);
+	meshFilter = NULL;
     }
-    else
+    if(imageMode && meshFilter != NULL)
     {
-        //default to .png 
-	printMtl(m, mtlFilename, ".png"); 	
+	fprintf(stderr, "'--only' and '--exclude' can't be used with '--image', an image holds the whole model.\n");
+	freeMESHFILTER(meshFilter);
+	exit(EXIT_FAILURE);
     }
 
+    if(batchMode)
+    {
+	//the models are already spread over the threads, don't split up each one as well
+	setDecodeThreads(numThreads >= 0 ? numThreads : 1);
+	setPrintThreads(numThreads >= 0 ? numThreads : 1);
 
-    //free memory associated with the MODL structure
-    freeMODL(m);
+	BATCH *batch = listBatch(args[0], args[1], 1, imageMode ? MODLIMAGE_EXT : ".obj");
+	if(batch == NULL) exit(EXIT_FAILURE);
+	int numFailed = runBatch(batch, convertModel, numJobs, maxMemory);
+	freeBATCH(batch);
+	freeMESHFILTER(meshFilter);
+	exit(numFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if(numThreads >= 0)
+    {
+	setDecodeThreads(numThreads);
+	setPrintThreads(numThreads);
+    }
+    BATCHJOB job = { { args[0], NULL }, args[1], 0, 0 };
+    int status = convertModel(&job);
+    freeMESHFILTER(meshFilter);
+    if(status != 0) exit(EXIT_FAILURE);
 
     exit(EXIT_SUCCESS);
 }
@@ -2,52 +2,174 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "modl.h"
 #include "objStructs.h"
+#include "meshFilter.h"
 #include "read3do.h"
 #include "readObj.h"
 #include "update3do.h"
 #include "write3do.h"
+#include "matScaler.h"
+#include "batch.h"
+#include "stats.h"
 
-int main( int argc, char *argv[] )
-{
-	if( argc != 4 )
-	{
-		printf("Expected 3 arguments, two input and one output filenames.\n");
-		printf("Usage example '%s manny.3do updated.obj manny.3do'\n", argv[0]);
-		exit(EXIT_FAILURE);
-	}
+//report the time and counts of each phase (see stats.h), STATS_JSON for JSON rather than a table
+static int statsMode = 0;
+#define STATS_TABLE 1
+#define STATS_JSON 2
+//merge only into the meshes named by --only and --exclude, NULL for all of them
+static MESHFILTER *meshFilter = NULL;
 
-	//read in the .3do file
-	MODL *m = read3do(argv[1]);
+/* Merge one .obj back into its .3do, returns 0 on success or -1 on failure */
+int mergeOne( BATCHJOB *job )
+{
+	//read in the .3do file, leaving the meshes not asked for as they are
+	MODL *m = meshFilter != NULL ? read3doLazy(job->inputs[0], meshFilter) : read3doMapped(job->inputs[0]);
 	if(m == NULL)
 	{
-		fprintf(stderr, "Failed to read in .3do file %s\n", argv[1]);
-		exit(EXIT_FAILURE);
+		fprintf(stderr, "Failed to read in .3do file %s\n", job->inputs[0]);
+		return -1;
 	}
 
 	//read in the .obj file which will update the .3do
-	OBJ *o = readObj(argv[2]);
+	OBJ *o = readObj(job->inputs[1]);
 	if(o == NULL)
 	{
-		fprintf(stderr, "Failed to read in .obj file %s\n", argv[2]);
-		exit(EXIT_FAILURE);
+		fprintf(stderr, "Failed to read in .obj file %s\n", job->inputs[1]);
+		freeMODL(m);
+		return -1;
 	}
 
 	//JOIN EM
 	update3do(m, o);
 
 	//write it out
-	write3do(m, argv[3]);
-
-
+	int status = write3do(m, job->output);
 
 	//free memory
+	freeOBJ(o);
 	freeMODL(m);
 
-	//no free functions for the obj end of things yet
-	//not really needed 
+	return status;
+}
+
+/* Merge one model, recording the stats if asked */
+int mergeModel( BATCHJOB *job )
+{
+	if( !statsMode ) return mergeOne(job);
+
+	STATS stats;
+	startStats(&stats, job->inputs[0]);
+	int status = mergeOne(job);
+	stopStats();
+	printStats(&stats, statsMode == STATS_JSON, stdout);
+	return status;
+}
+
+int main( int argc, char *argv[] )
+{
+	//pull out any options, leaving the three filenames in args
+	char *args[3];
+	int numArgs = 0;
+	int batchMode = 0;
+	int numJobs = 0;
+	int numThreads = -1;
+	size_t maxMemory = BATCH_MEMORY;
+	for(int i=1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "--threads") == 0 && i+1 < argc)
+		{
+			//threads used to decode the .3do, parse the .obj file and write the new .3do, 1 for serial
+			numThreads = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--materials") == 0 && i+1 < argc)
+		{
+			//material sizes from a database built with matdb
+			if(loadMaterialDb(argv[++i]) != 0) exit(EXIT_FAILURE);
+		}
+		else if((strcmp(argv[i], "--only") == 0 || strcmp(argv[i], "--exclude") == 0) && i+1 < argc)
+		{
+			//comma separated mesh names or patterns
+			if(meshFilter == NULL) meshFilter = createMESHFILTER();
+			addMeshFilter(meshFilter, argv[i+1], strcmp(argv[i], "--exclude") == 0);
+			i++;
+		}
+		else if(strcmp(argv[i], "--batch") == 0)
+		{
+			batchMode = 1;
+		}
+		else if(strcmp(argv[i], "--stats") == 0)
+		{
+			statsMode = STATS_TABLE;
+		}
+		else if(strcmp(argv[i], "--stats-json") == 0)
+		{
+			statsMode = STATS_JSON;
+		}
+		else if(strcmp(argv[i], "--jobs") == 0 && i+1 < argc)
+		{
+			numJobs = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--max-memory") == 0 && i+1 < argc)
+		{
+			//given in MB
+			maxMemory = (size_t)atol(argv[++i]) << 20;
+		}
+		else if(numArgs < 3)
+		{
+			args[numArgs++] = argv[i];
+		}
+		else numArgs++;
+	}
+
+	//a filter letting every mesh through needn't be applied at all
+	if(meshFilterEmpty(meshFilter))
+	{
+		freeMESHFILTER(meshFilter);
+		meshFilter = NULL;
+	}
+
+	if( numArgs != (batchMode ? 2 : 3) )
+	{
+		printf("Expected 3 arguments, two input and one output filenames.\n");
+		printf("Usage example '%s manny.3do updated.obj manny.3do'\n", argv[0]);
+		printf("Large .3do and .obj files are read and written using one thread per processor, '--threads N' uses N instead\n");
+		printf("'--materials file.matdb' takes material sizes from a database built with matdb ahead of the built in ones\n");
+		printf("'--only head,*arm*' merges into just the meshes with those names (shell style patterns allowed), '--exclude names' all but those, the rest are copied unchanged\n");
+		printf("'--stats' reports the time, bytes and counts of each phase of the merge ('--stats-json' as JSON)\n");
+		printf("To merge many models at once '%s --batch models/ out/' takes a directory of .3do files with their edited .obj alongside\n", argv[0]);
+		printf("(or a manifest with a .3do and .obj per line) and an output directory\n");
+		printf("Batches run on one thread per processor ('--jobs N' for N) using at most about 1024 MB ('--max-memory MB')\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if(batchMode)
+	{
+		//the models are already spread over the threads, don't split up each .obj as well
+		setObjThreads(numThreads >= 0 ? numThreads : 1);
+		setDecodeThreads(numThreads >= 0 ? numThreads : 1);
+		setWriteThreads(numThreads >= 0 ? numThreads : 1);
+
+		BATCH *batch = listBatch(args[0], args[1], 2, ".3do");
+		if(batch == NULL) exit(EXIT_FAILURE);
+		int numFailed = runBatch(batch, mergeModel, numJobs, maxMemory);
+		freeBATCH(batch);
+		freeMESHFILTER(meshFilter);
+		exit(numFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	if(numThreads >= 0)
+	{
+		setObjThreads(numThreads);
+		setDecodeThreads(numThreads);
+		setWriteThreads(numThreads);
+	}
+	BATCHJOB job = { { args[0], args[1] }, args[2], 0, 0 };
+	int status = mergeModel(&job);
+	freeMESHFILTER(meshFilter);
+	if(status != 0) exit(EXIT_FAILURE);
 
 	exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,120 @@
+/* The main file for the third executable.  This builds a material database (see matDb.h) from a text list of material names and their texture dimensions, so that new or modded materials can be used without recompiling. */
+
+//getline() is POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkedMem.h"
+#include "matDb.h"
+#include "matNames.h"
+#include "matSize.h"
+
+#define NUM_BUILTIN_MATS ((int)(sizeof(matList) / sizeof(matList[0])))
+
+/* Print the built in table in the text list format, as a starting point for a new list */
+void printBuiltin( void )
+{
+	printf("# name width height\n");
+	for(int i=0; i < NUM_BUILTIN_MATS; i++)
+	{
+		printf("%s %d %d\n", matList[i], matSize[i][0], matSize[i][1]);
+	}
+}
+
+int main( int argc, char *argv[] )
+{
+	if( argc == 2 && strcmp(argv[1], "--builtin") == 0 )
+	{
+		printBuiltin();
+		exit(EXIT_SUCCESS);
+	}
+	if( argc != 3 )
+	{
+		printf("Expected 2 arguments, a text list of materials and the database to write.\n");
+		printf("Usage example '%s materials.txt materials.matdb'\n", argv[0]);
+		printf("Each line of the list is a material name then its width and height, i.e 'm_eye.mat 64 64'\n");
+		printf("'%s --builtin' prints the built in list to start from\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	FILE *ifp = fopen(argv[1], "r");
+	if( ifp == NULL )
+	{
+		fprintf(stderr, "Could not open %s\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	//read in the list
+	int numMats = 0;
+	int size = 1024;
+	char **names = checked_malloc(sizeof(char *) * size);
+	int (*sizes)[2] = checked_malloc(sizeof(int[2]) * size);
+
+	char *line = NULL;
+	size_t lineSize = 0;
+	int lineNumber = 0;
+	int errors = 0;
+	while( getline(&line, &lineSize, ifp) != -1 )
+	{
+		lineNumber++;
+		char *name = strtok(line, " \t\r\n");
+		if( name == NULL || name[0] == '#' ) continue;
+
+		char *width = strtok(NULL, " \t\r\n");
+		char *height = strtok(NULL, " \t\r\n");
+		char *end1 = NULL, *end2 = NULL;
+		long w = width != NULL ? strtol(width, &end1, 10) : 0;
+		long h = height != NULL ? strtol(height, &end2, 10) : 0;
+		if( height == NULL || *end1 != '\0' || *end2 != '\0' || w < 0 || h < 0 || strlen(name) >= MATDB_NAME_SIZE )
+		{
+			fprintf(stderr, "%s line %d: expected 'name width height' with a name under %d chars\n", argv[1], lineNumber, MATDB_NAME_SIZE);
+			errors++;
+			continue;
+		}
+
+		if( numMats == size )
+		{
+			size *= 2;
+			names = checked_realloc(names, sizeof(char *) * size);
+			sizes = checked_realloc(sizes, sizeof(int[2]) * size);
+		}
+		names[numMats] = checked_malloc(strlen(name) + 1);
+		strcpy(names[numMats], name);
+		sizes[numMats][0] = (int)w;
+		sizes[numMats][1] = (int)h;
+		numMats++;
+	}
+	free(line);
+	fclose(ifp);
+
+	if( errors != 0 ) exit(EXIT_FAILURE);
+
+	//build it and write it out in one go
+	size_t dbSize;
+	int numStored;
+	unsigned char *db = buildMatDb(names, sizes, numMats, &dbSize, &numStored);
+
+	FILE *ofp = fopen(argv[2], "wb");
+	if( ofp == NULL )
+	{
+		fprintf(stderr, "Could not open %s for writing.\n", argv[2]);
+		exit(EXIT_FAILURE);
+	}
+	size_t written = fwrite(db, 1, dbSize, ofp);
+	if( fclose(ofp) != 0 || written != dbSize )
+	{
+		fprintf(stderr, "fwrite() failed to write all bytes.\n");
+		exit(EXIT_FAILURE);
+	}
+	printf("Wrote %d materials to %s\n", numStored, argv[2]);
+
+	for(int i=0; i < numMats; i++) checked_free(names[i]);
+	checked_free(names);
+	checked_free(sizes);
+	checked_free(db);
+
+	exit(EXIT_SUCCESS);
+}
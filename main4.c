@@ -0,0 +1,48 @@
+/* The main file for the fourth executable.  This writes synthetic .3do models (see genModel.h) of any size, for testing and benchmarking the converters without the game's own files. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "modl.h"
+#include "genModel.h"
+#include "write3do.h"
+
+int main( int argc, char *argv[] )
+{
+	GENPARAMS params;
+	defaultGENPARAMS(&params);
+
+	//pull out any options, leaving the output filename
+	char *filename = NULL;
+	int numArgs = 0;
+	for(int i=1; i < argc; i++)
+	{
+		if( strcmp(argv[i], "--meshes") == 0 && i+1 < argc ) params.numMeshes = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--vertices") == 0 && i+1 < argc ) params.numVertices = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--faces") == 0 && i+1 < argc ) params.numFaces = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--depth") == 0 && i+1 < argc ) params.depth = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--materials") == 0 && i+1 < argc ) params.numMaterials = atoi(argv[++i]);
+		else if( strcmp(argv[i], "--seed") == 0 && i+1 < argc ) params.seed = (unsigned int)atol(argv[++i]);
+		else
+		{
+			filename = argv[i];
+			numArgs++;
+		}
+	}
+
+	if( numArgs != 1 )
+	{
+		printf("Expected 1 argument, the .3do file to write.\n");
+		printf("Usage example '%s --meshes 8 --vertices 500 --faces 800 test.3do'\n", argv[0]);
+		printf("Options (defaults in brackets): --meshes (%d), --vertices (%d) and --faces (%d) per mesh,\n", params.numMeshes, params.numVertices, params.numFaces);
+		printf("--depth (%d) the longest chain of nodes, --materials (%d) taken from the built in table and --seed (%u)\n", params.depth, params.numMaterials, params.seed);
+		exit(EXIT_FAILURE);
+	}
+
+	MODL *model = generateMODL(&params);
+	int status = write3do(model, filename);
+	freeMODL(model);
+
+	exit(status == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
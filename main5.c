@@ -0,0 +1,113 @@
+/* The main file for the fifth executable.  This builds the index kept alongside a .3do (see modlIndex.h), so the converters can find its meshes without stepping through every face first, and checks or prints existing ones. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vector.h"
+#include "fileStamp.h"
+#include "modlIndex.h"
+#include "mapFile.h"
+#include "checkedMem.h"
+
+enum { BUILD, CHECK, PRINT };
+
+/* Index the .3do <filename> and save it alongside, returns 0 on success or -1 on failure */
+int buildIndex( char *filename )
+{
+	FILESTAMP stamp;
+	MAPPEDFILE *mf = mapFile(filename);
+	if( mf == NULL || stampFile(filename, &stamp) != 0 )
+	{
+		fprintf(stderr, "File %s could not be opened.\n", filename);
+		if( mf != NULL ) unmapFile(mf);
+		return -1;
+	}
+
+	int status = -1;
+	MODLINDEX *index = buildModlIndex(mf->data, mf->size, &stamp, filename);
+	if( index != NULL )
+	{
+		char *name = indexFilename(filename);
+		status = writeModlIndex(index, name);
+		if( status == 0 ) printf("Indexed %d meshes of %s in %s\n", index->numMeshes, filename, name);
+		checked_free(name);
+		freeMODLINDEX(index);
+	}
+	unmapFile(mf);
+
+	return status;
+}
+
+/* Check the saved index of <filename> is for the file as it is now, down to its hash.  If <print> is set the index is listed too.  Returns 0 if it is up to date or -1 if not. */
+int checkIndex( char *filename, int print )
+{
+	MAPPEDFILE *mf = mapFile(filename);
+	if( mf == NULL )
+	{
+		fprintf(stderr, "File %s could not be opened.\n", filename);
+		return -1;
+	}
+
+	int status = -1;
+	MODLINDEX *index = readModlIndex(filename, mf->data, mf->size);
+	if( index == NULL )
+	{
+		printf("%s: no index, or it is out of date\n", filename);
+	}
+	else if( !indexMatches(index, mf->data, mf->size) )
+	{
+		printf("%s: index is out of date (contents changed)\n", filename);
+	}
+	else
+	{
+		printf("%s: index is up to date\n", filename);
+		status = 0;
+	}
+
+	if( index != NULL && print )
+	{
+		printf("%d materials, %d meshes, %d nodes, hash %016llx\n", index->numMaterials, index->numMeshes, index->numNodes, (unsigned long long)index->hash);
+		printf("mesh\toffset\tlength\tfaces at\tvertices\ttexVertices\tfaces\tindices\n");
+		for(int i=0; i < index->numMeshes; i++)
+		{
+			const INDEXMESH *im = &index->meshes[i];
+			printf("%d\t%llu\t%llu\t%llu\t%d\t%d\t%d\t%d\n", i, (unsigned long long)im->offset, (unsigned long long)im->length, (unsigned long long)im->faceOffset, im->numVertices, im->numTexVertices, im->numFaces, im->numIndices);
+		}
+		printf("nodes\t%llu\t%llu\nfooter\t%llu\n", (unsigned long long)index->nodesOffset, (unsigned long long)index->nodesLength, (unsigned long long)index->footerOffset);
+	}
+	freeMODLINDEX(index);
+	unmapFile(mf);
+
+	return status;
+}
+
+int main( int argc, char *argv[] )
+{
+	int mode = BUILD;
+	int numFiles = 0;
+	int failures = 0;
+	for(int i=1; i < argc; i++)
+	{
+		if( strcmp(argv[i], "--check") == 0 ) mode = CHECK;
+		else if( strcmp(argv[i], "--print") == 0 ) mode = PRINT;
+		else numFiles++;
+	}
+
+	if( numFiles == 0 )
+	{
+		printf("Expected 1 or more arguments, the .3do files to index.\n");
+		printf("Usage example '%s manny.3do' writes manny.3do%s\n", argv[0], MODLINDEX_EXT);
+		printf("'%s --check manny.3do' checks its index is up to date and '--print' lists it as well\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	for(int i=1; i < argc; i++)
+	{
+		if( argv[i][0] == '-' && argv[i][1] == '-' ) continue;
+		int status = mode == BUILD ? buildIndex(argv[i]) : checkIndex(argv[i], mode == PRINT);
+		if( status != 0 ) failures++;
+	}
+
+	exit(failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
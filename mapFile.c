@@ -0,0 +1,93 @@
+/* Functions for bringing an entire file into memory at once, so that readers can decode it without a library call per field. */
+
+//mmap() and friends are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include "mapFile.h"
+#include "checkedMem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* Read the whole file into a buffer with one fread(), also the fallback for when mmap() is unavailable or fails */
+MAPPEDFILE *readWholeFile( char *filename )
+{
+	FILE *ifp = fopen(filename, "rb");
+	if( ifp == NULL ) return NULL;
+
+	//find the size of the file
+	fseek(ifp, 0, SEEK_END);
+	long size = ftell(ifp);
+	fseek(ifp, 0, SEEK_SET);
+	if( size < 0 )
+	{
+		fclose(ifp);
+		return NULL;
+	}
+
+	MAPPEDFILE *mf = checked_malloc( sizeof(MAPPEDFILE) );
+	mf->size = (size_t)size;
+	mf->isMapped = 0;
+	//always allocate at least one byte so that data is never NULL
+	mf->data = checked_malloc( mf->size + 1 );
+	if( fread(mf->data, 1, mf->size, ifp) != mf->size )
+	{
+		fprintf(stderr, "fread() failed to read all of %s.\n", filename);
+		fclose(ifp);
+		unmapFile(mf);
+		return NULL;
+	}
+
+	fclose(ifp);
+	return mf;
+}
+
+/* Map the file <filename> into memory read only.  Returns NULL if the file could not be opened. */
+MAPPEDFILE *mapFile( char *filename )
+{
+#ifndef _WIN32
+	int fd = open(filename, O_RDONLY);
+	if( fd < 0 ) return NULL;
+
+	struct stat st;
+	//mmap() refuses empty files, let the fallback deal with those
+	if( fstat(fd, &st) == 0 && st.st_size > 0 )
+	{
+		void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if( p != MAP_FAILED )
+		{
+			close(fd);
+			MAPPEDFILE *mf = checked_malloc( sizeof(MAPPEDFILE) );
+			mf->data = p;
+			mf->size = (size_t)st.st_size;
+			mf->isMapped = 1;
+			return mf;
+		}
+	}
+	close(fd);
+#endif
+	return readWholeFile(filename);
+}
+
+/* Unmap (or free) the file contents, and the MAPPEDFILE structure itself */
+void unmapFile( MAPPEDFILE *mf )
+{
+	if( mf == NULL ) return;
+
+#ifndef _WIN32
+	if( mf->isMapped )
+		munmap(mf->data, mf->size);
+	else
+#endif
+		checked_free(mf->data);
+
+	checked_free(mf);
+	return;
+}
@@ -0,0 +1,21 @@
+#include <stddef.h>
+
+/* A whole file held in memory, mapped with mmap() where available, otherwise read in with a single fread() */
+typedef struct
+{
+	//the contents of the file
+	unsigned char *data;
+	//number of bytes in the file
+	size_t size;
+	//1 if data is a mapping that must be munmap()'d, 0 if it was malloc'd
+	int isMapped;
+} MAPPEDFILE;
+
+/* Map the file <filename> into memory, returns NULL if it could not be opened */
+MAPPEDFILE *mapFile( char *filename );
+
+/* Read the file <filename> into a malloc'd buffer with a single fread(), returns NULL if it could not be opened */
+MAPPEDFILE *readWholeFile( char *filename );
+
+/* Release a file previously returned by mapFile() */
+void unmapFile( MAPPEDFILE *mf );
@@ -0,0 +1,150 @@
+/* Reading and building the binary material database described in matDb.h */
+
+#include "matDb.h"
+#include "matHash.h"
+#include "checkedMem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t getU32( const unsigned char *p )
+{
+	uint32_t value;
+	memcpy(&value, p, 4);
+
+	return value;
+}
+
+static void putU32( unsigned char *p, uint32_t value )
+{
+	memcpy(p, &value, 4);
+}
+
+MATDB *openMatDb( char *filename )
+{
+	MAPPEDFILE *mf = mapFile(filename);
+	if( mf == NULL )
+	{
+		fprintf(stderr, "Could not open material database %s\n", filename);
+		return NULL;
+	}
+
+	//check the header and that the file is exactly the size it says
+	const unsigned char *d = mf->data;
+	uint32_t numMats = 0, numSlots = 0;
+	int valid = mf->size >= MATDB_HEADER_SIZE && memcmp(d, "MATD", 4) == 0 && getU32(d + 4) == MATDB_VERSION;
+	if( valid )
+	{
+		numMats = getU32(d + 8);
+		numSlots = getU32(d + 12);
+		valid = numSlots != 0 && (numSlots & (numSlots - 1)) == 0 && numMats < numSlots
+			&& mf->size == MATDB_HEADER_SIZE + 4 * (size_t)numSlots + MATDB_RECORD_SIZE * (size_t)numMats;
+	}
+
+	//and that every slot and name is in range, so lookups can trust them
+	const unsigned char *slots = d + MATDB_HEADER_SIZE;
+	const unsigned char *records = slots + 4 * (size_t)numSlots;
+	uint32_t used = 0;
+	for(uint32_t i=0; valid && i < numSlots; i++)
+	{
+		uint32_t entry = getU32(slots + 4 * i);
+		if( entry > numMats ) valid = 0;
+		if( entry != 0 ) used++;
+	}
+	//a lookup needs an empty slot to stop at
+	if( used > numMats ) valid = 0;
+	for(uint32_t i=0; valid && i < numMats; i++)
+	{
+		if( memchr(records + MATDB_RECORD_SIZE * i, '\0', MATDB_NAME_SIZE) == NULL ) valid = 0;
+	}
+
+	if( !valid )
+	{
+		fprintf(stderr, "%s is not a valid material database\n", filename);
+		unmapFile(mf);
+		return NULL;
+	}
+
+	MATDB *db = checked_malloc(sizeof(MATDB));
+	db->file = mf;
+	db->numMats = numMats;
+	db->numSlots = numSlots;
+	db->slots = slots;
+	db->records = records;
+
+	return db;
+}
+
+int matDbLookup( MATDB *db, const char *name, int *width, int *height )
+{
+	uint32_t mask = db->numSlots - 1;
+	//there is always an empty slot to stop at, the table is never full
+	for(uint32_t s = matHash(name, 0) & mask; ; s = (s + 1) & mask)
+	{
+		uint32_t entry = getU32(db->slots + 4 * s);
+		if( entry == 0 ) return 0;
+
+		const unsigned char *record = db->records + MATDB_RECORD_SIZE * (size_t)(entry - 1);
+		if( strcmp((const char *)record, name) == 0 )
+		{
+			*width = (int)getU32(record + MATDB_NAME_SIZE);
+			*height = (int)getU32(record + MATDB_NAME_SIZE + 4);
+			return 1;
+		}
+	}
+}
+
+void closeMatDb( MATDB *db )
+{
+	if( db == NULL ) return;
+
+	unmapFile(db->file);
+	checked_free(db);
+}
+
+unsigned char *buildMatDb( char **names, int (*sizes)[2], int numMats, size_t *size, int *stored )
+{
+	//keep the table at most half full
+	uint32_t numSlots = 1;
+	while( numSlots < 2 * (uint32_t)numMats + 1 ) numSlots *= 2;
+	uint32_t mask = numSlots - 1;
+
+	*size = MATDB_HEADER_SIZE + 4 * (size_t)numSlots + MATDB_RECORD_SIZE * (size_t)numMats;
+	unsigned char *data = checked_calloc(*size, 1);
+	unsigned char *slots = data + MATDB_HEADER_SIZE;
+	unsigned char *records = slots + 4 * (size_t)numSlots;
+
+	uint32_t count = 0;
+	for(int i=0; i < numMats; i++)
+	{
+		//find the name's slot, either empty or already holding the same name
+		uint32_t s = matHash(names[i], 0) & mask;
+		uint32_t entry;
+		while( (entry = getU32(slots + 4 * s)) != 0 && strcmp((const char *)records + MATDB_RECORD_SIZE * (size_t)(entry - 1), names[i]) != 0 )
+		{
+			s = (s + 1) & mask;
+		}
+		if( entry == 0 )
+		{
+			entry = ++count;
+			putU32(slots + 4 * s, entry);
+		}
+
+		unsigned char *record = records + MATDB_RECORD_SIZE * (size_t)(entry - 1);
+		memset(record, 0, MATDB_NAME_SIZE);
+		strncpy((char *)record, names[i], MATDB_NAME_SIZE - 1);
+		putU32(record + MATDB_NAME_SIZE, (uint32_t)sizes[i][0]);
+		putU32(record + MATDB_NAME_SIZE + 4, (uint32_t)sizes[i][1]);
+	}
+
+	//names listed twice leave records unused at the end
+	*size -= MATDB_RECORD_SIZE * (size_t)(numMats - count);
+	*stored = (int)count;
+	memcpy(data, "MATD", 4);
+	putU32(data + 4, MATDB_VERSION);
+	putU32(data + 8, count);
+	putU32(data + 12, numSlots);
+
+	return data;
+}
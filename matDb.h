@@ -0,0 +1,38 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mapFile.h"
+
+/* A binary database of material dimensions, which can be mapped straight into memory and searched without parsing anything.  Build one from a text list with the matdb tool.
+
+Layout (native byte order):
+	header		"MATD", version, number of materials, number of slots (each 4 bytes)
+	slots		<number of slots> 4 byte entries, an open addressed hash table over the names
+			(matHash() with seed 0, linear probing) holding material index + 1, 0 if empty
+	materials	<number of materials> records of a 32 byte name (0 terminated) then width and height as 4 byte ints */
+
+#define MATDB_VERSION 1
+#define MATDB_HEADER_SIZE 16
+#define MATDB_NAME_SIZE 32
+#define MATDB_RECORD_SIZE (MATDB_NAME_SIZE + 8)
+
+typedef struct
+{
+	MAPPEDFILE *file;
+	uint32_t numMats;
+	//always a power of 2
+	uint32_t numSlots;
+	const unsigned char *slots;
+	const unsigned char *records;
+} MATDB;
+
+/* Map a material database into memory, checking it is well formed.  Returns NULL on failure. */
+MATDB *openMatDb( char *filename );
+
+/* Look up the dimensions of material <name>, returns 1 if found or 0 if not */
+int matDbLookup( MATDB *db, const char *name, int *width, int *height );
+
+void closeMatDb( MATDB *db );
+
+/* Build the bytes of a database holding <numMats> materials (a name listed twice keeps its last size).  Names must be shorter than MATDB_NAME_SIZE.  The size is stored in <*size> and the number of different materials in <*stored>, the caller frees the buffer. */
+unsigned char *buildMatDb( char **names, int (*sizes)[2], int numMats, size_t *size, int *stored );
@@ -0,0 +1,22 @@
+#include <stdint.h>
+
+/* The hash used to look up materials by name, shared by the generated perfect hash table (see matHashGen.c) and lookups at runtime.  Different seeds give independent hashes. */
+static inline uint32_t matHash( const char *name, uint32_t seed )
+{
+	//FNV-1a over the name, starting from the seed
+	uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+	for( ; *name != '\0'; name++)
+	{
+		h ^= (unsigned char)*name;
+		h *= 16777619u;
+	}
+
+	//then mix the bits so the low ones (which pick the slot) depend on all of the name
+	h ^= h >> 16;
+	h *= 0x85EBCA6Bu;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35u;
+	h ^= h >> 16;
+
+	return h;
+}
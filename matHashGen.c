@@ -0,0 +1,123 @@
+/* Build time tool which generates matHashTable.h, a perfect hash over the material names in matNames.h so that scaleTexVerts() can find each material's dimensions (matSize.h) without searching.
+
+Hash and displace: the names are split into small buckets by one hash, then each bucket (biggest first) is given the first seed for which a second hash puts all of its names into empty slots.  A lookup is then two hashes and a single strcmp() to confirm the name. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "matNames.h"
+#include "matSize.h"
+#include "matHash.h"
+
+#define NUM_MATS ((int)(sizeof(matList) / sizeof(matList[0])))
+//average names per bucket
+#define BUCKET_LOAD 4
+#define MAX_DISPLACE 65535
+
+static int numBuckets;
+static int numSlots;
+//the names in each bucket, as indices into matList
+static int **buckets;
+static int *bucketSizes;
+
+static int compareBuckets( const void *a, const void *b )
+{
+	return bucketSizes[*(const int *)b] - bucketSizes[*(const int *)a];
+}
+
+int main( void )
+{
+	//the matNames.h and matSize.h tables must line up
+	if( sizeof(matSize) / sizeof(matSize[0]) != (size_t)NUM_MATS )
+	{
+		fprintf(stderr, "matNames.h has %d names but matSize.h has %d sizes\n", NUM_MATS, (int)(sizeof(matSize) / sizeof(matSize[0])));
+		exit(EXIT_FAILURE);
+	}
+
+	numBuckets = NUM_MATS / BUCKET_LOAD + 1;
+	numSlots = 1;
+	while( numSlots < NUM_MATS * 2 ) numSlots *= 2;
+
+	buckets = calloc(numBuckets, sizeof(int *));
+	bucketSizes = calloc(numBuckets, sizeof(int));
+	for(int i=0; i < numBuckets; i++) buckets[i] = malloc(sizeof(int) * NUM_MATS);
+
+	for(int i=0; i < NUM_MATS; i++)
+	{
+		//if a name is listed twice the last one wins (as the old linear search did)
+		int duplicated = 0;
+		for(int j=i+1; j < NUM_MATS; j++)
+		{
+			if( strcmp(matList[i], matList[j]) == 0 ) duplicated = 1;
+		}
+		if( duplicated ) continue;
+
+		int b = matHash(matList[i], 0) % numBuckets;
+		buckets[b][bucketSizes[b]++] = i;
+	}
+
+	//place the biggest buckets first while there is the most room
+	int *order = malloc(sizeof(int) * numBuckets);
+	for(int i=0; i < numBuckets; i++) order[i] = i;
+	qsort(order, numBuckets, sizeof(int), compareBuckets);
+
+	int *slots = malloc(sizeof(int) * numSlots);
+	for(int i=0; i < numSlots; i++) slots[i] = -1;
+	int *displace = calloc(numBuckets, sizeof(int));
+	int *tried = malloc(sizeof(int) * NUM_MATS);
+
+	for(int i=0; i < numBuckets; i++)
+	{
+		int b = order[i];
+		if( bucketSizes[b] == 0 ) continue;
+
+		int d;
+		for(d = 1; d <= MAX_DISPLACE; d++)
+		{
+			//every name in the bucket needs an empty slot, and not the same one as another
+			int fits = 1;
+			for(int k=0; k < bucketSizes[b] && fits; k++)
+			{
+				tried[k] = matHash(matList[buckets[b][k]], d) % numSlots;
+				if( slots[tried[k]] != -1 ) fits = 0;
+				for(int m=0; m < k && fits; m++)
+				{
+					if( tried[m] == tried[k] ) fits = 0;
+				}
+			}
+			if( fits ) break;
+		}
+		if( d > MAX_DISPLACE )
+		{
+			fprintf(stderr, "Could not place bucket %d of the material hash\n", b);
+			exit(EXIT_FAILURE);
+		}
+
+		displace[b] = d;
+		for(int k=0; k < bucketSizes[b]; k++) slots[tried[k]] = buckets[b][k];
+	}
+
+	//write out the table
+	printf("/* Generated by matHashGen from matNames.h and matSize.h, do not edit */\n\n");
+	printf("#define MAT_HASH_BUCKETS %d\n", numBuckets);
+	printf("#define MAT_HASH_SLOTS %d\n\n", numSlots);
+	printf("//seed for the second hash of the names in each bucket\n");
+	printf("static const unsigned short matHashDisplace[MAT_HASH_BUCKETS] = {");
+	for(int i=0; i < numBuckets; i++) printf("%s%d,", i % 16 == 0 ? "\n\t" : " ", displace[i]);
+	printf("\n};\n\n");
+	printf("//index into matList of the name in each slot, -1 if empty\n");
+	printf("static const short matHashSlots[MAT_HASH_SLOTS] = {");
+	for(int i=0; i < numSlots; i++) printf("%s%d,", i % 16 == 0 ? "\n\t" : " ", slots[i]);
+	printf("\n};\n");
+
+	for(int i=0; i < numBuckets; i++) free(buckets[i]);
+	free(buckets);
+	free(bucketSizes);
+	free(order);
+	free(slots);
+	free(displace);
+	free(tried);
+
+	return 0;
+}
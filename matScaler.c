@@ -1,6 +1,9 @@
 #include "matNames.h"	//static array containg all material naems
 #define TOTAL_MAT_COUNT 943
 #include "matSize.h"	//static array containing dimensions of above
+#include "matHash.h"
+#include "matHashTable.h"	//perfect hash over the names, generated by matHashGen at build time
+#include "matDb.h"
 
 #include "modl.h"
 #include <stdio.h>
@@ -8,82 +11,161 @@
 
 #include <string.h>
 #include "checkedMem.h"
+#include "stats.h"
 
+//material database loaded at startup, searched before the built in table
+static MATDB *materialDb = NULL;
 
 
-/* Scale the texture vertices from absolute pixel values to values between 0 and 1 for the .obj format, and back again. NOTE: must be undone when read back in. A direction flag of 0 will scale to the .obj specification while a direction flag of 1 will scale back to the Grim specification. */
-void scaleTexVerts(MODL *model, int directionFlag)
+int numBuiltinMaterials(void)
+{
+    return TOTAL_MAT_COUNT;
+}
+
+char *builtinMaterialName(int index)
+{
+    return matList[index];
+}
+
+/* Find a material name in matList (and so it's dimensions in matSize), returns -1 if it isn't there */
+int findMaterial(const char *name)
+{
+    int bucket = matHash(name, 0) % MAT_HASH_BUCKETS;
+    int index = matHashSlots[matHash(name, matHashDisplace[bucket]) % MAT_HASH_SLOTS];
+
+    //names not in the table still land in some slot, so check it really is this one
+    if(index < 0 || strcmp(matList[index], name) != 0) return -1;
+    return index;
+}
+
+/* Use the material database <filename> (see matDb.h) ahead of the built in table.  Must be called before any conversions start, returns 0 on success or -1 if it can't be loaded */
+int loadMaterialDb(char *filename)
+{
+    MATDB *db = openMatDb(filename);
+    if(db == NULL) return -1;
+
+    closeMatDb(materialDb);
+    materialDb = db;
+    return 0;
+}
+
+/* Find the dimensions of a material, from the loaded database or else the built in table.  Returns 1 if found, 0 if not. */
+int materialSize(const char *name, int *width, int *height)
 {
-    //should search for material values upfront rather than EVERY SINGLE TIME
-    float *matWidths = checked_malloc(sizeof(float) * model->numMaterials);
-    float *matHeights = checked_malloc(sizeof(float) * model->numMaterials);
+    countStat(STAT_MATERIAL_LOOKUPS, 1);
+    if(materialDb != NULL && matDbLookup(materialDb, name, width, height)) return 1;
+
+    int i = findMaterial(name);
+    if(i == -1) return 0;
+    *width = matSize[i][0];
+    *height = matSize[i][1];
+    return 1;
+}
 
-    for(int i=0; i<model->numMaterials; i++)
+/* Look up the dimensions of each material once, into arrays indexed like <materialNames> which the caller frees.  Unknown materials are given 1 x 1. */
+void materialDimensions(char **materialNames, int numMaterials, float **widths, float **heights)
+{
+    float *matWidths = checked_malloc(sizeof(float) * (numMaterials + 1));
+    float *matHeights = checked_malloc(sizeof(float) * (numMaterials + 1));
+
+    for(int i=0; i<numMaterials; i++)
     {
-	char *mat = model->materialNames[i];
-	for(int j=0; j<TOTAL_MAT_COUNT; j++)
+	char *mat = materialNames[i];
+	int width, height;
+	if(materialSize(mat, &width, &height))
 	{
-	    if(strcmp(mat, matList[j]) == 0)
-	    {
-		//use this index into the matSize array (defined in matSize.h)
-		matWidths[i] = matSize[j][0];
-		matHeights[i] = matSize[j][1];
-	    }
+	    matWidths[i] = width;
+	    matHeights[i] = height;
+	}
+	else
+	{
+	    //unknown size, scaling by 1 leaves the texture vertices as they are (in pixels) both ways
+	    fprintf(stderr, "Unknown material %s, its texture vertices are left unscaled\n", mat);
+	    matWidths[i] = 1.0;
+	    matHeights[i] = 1.0;
 	}
     }
-    //the matWidths and matHeights arrays can now be index by the material index to find it's dimensions
-   
-    //for every mesh
-    for(int i=0; i<model->numMeshes; i++)
-    {
-	MESH *mesh = model->meshes[i];
-	//remember as we scale each texture vertex
-	int *isScaled = checked_calloc(mesh->numTexVertices, sizeof(int));
 
-	//for each face in this mesh
-	for(int j=0; j<mesh->numFaces; j++)
+    *widths = matWidths;
+    *heights = matHeights;
+}
+
+/* Scale the texture vertices of one mesh, see scaleTexVerts().  The dimensions come from materialDimensions(). */
+void scaleMeshTexVerts(MESH *mesh, float *matWidths, float *matHeights, int directionFlag)
+{
+    //no longer as it was in the .3do
+    changedMESH(mesh);
+    //remember as we scale each texture vertex
+    int *isScaled = checked_calloc(mesh->numTexVertices, sizeof(int));
+
+    //for each face in this mesh
+    for(int j=0; j<mesh->numFaces; j++)
+    {
+	FACE *face = &mesh->faces[j];
+	if(face->hasMaterial == 0) continue;    //skip face if no material
+	int *texVertexIndices = mesh->faceTexVertexIndices + mesh->faceOffsets[j];
+	
+	//scale all the texture vertices for this face accordingly
+	//(if they have not been scaled already)
+	for(int k=0; k<face->numVertices; k++)
 	{
-	    FACE *face = mesh->faces[j];
-	    if(face->hasMaterial == 0) continue;    //skip face if no material
-	    
-	    //scale all the texture vertices for this face accordingly
-	    //(if they have not been scaled already)
-	    for(int k=0; k<face->numVertices; k++)
+	    int texVI = texVertexIndices[k];
+	    //if it isnt already scaled
+	    if(!isScaled[texVI])
 	    {
-		int texVI = face->texVertexIndices[k];
-		//if it isnt already scaled
-		if(!isScaled[texVI])
+		    //scale it and remember
+		if(directionFlag == 0)
 		{
-			//scale it and remember
-		    if(directionFlag == 0)
-		    {
-			 //going to .obj
-			 mesh->texVertices[texVI][0] /= matWidths[face->materialIndex];
-			 mesh->texVertices[texVI][1] /= matHeights[face->materialIndex];
-		    }
-		    else
-		    {
-			//coming back from .obj
-			mesh->texVertices[texVI][0] *= matWidths[face->materialIndex];
-			mesh->texVertices[texVI][1] *= matHeights[face->materialIndex];
-	
-		    }
-		    isScaled[texVI] = 1;
+		     //going to .obj
+		     mesh->texVertices[texVI][0] /= matWidths[face->materialIndex];
+		     mesh->texVertices[texVI][1] /= matHeights[face->materialIndex];
 		}
-	    }
+		else
+		{
+		    //coming back from .obj
+		    mesh->texVertices[texVI][0] *= matWidths[face->materialIndex];
+		    mesh->texVertices[texVI][1] *= matHeights[face->materialIndex];
 
+		}
+		isScaled[texVI] = 1;
+	    }
 	}
 
-	//quick check that we scaled all the texture vertices
-	for(int j=0; j<mesh->numTexVertices; j++)
+    }
+
+    //quick check that we scaled all the texture vertices
+    for(int j=0; j<mesh->numTexVertices; j++)
+    {
+	if(isScaled[j] != 1)
 	{
-	    if(isScaled[j] != 1)
-	    {
-		fprintf(stderr, "Texture vertice %d was never scaled in scaleTexVerts()\n", j);	
-	    }
+	    fprintf(stderr, "Texture vertice %d was never scaled in scaleTexVerts()\n", j);	
 	}
     }
+    checked_free(isScaled);
+}
+
+/* Scale the texture vertices from absolute pixel values to values between 0 and 1 for the .obj format, and back again. NOTE: must be undone when read back in. A direction flag of 0 will scale to the .obj specification while a direction flag of 1 will scale back to the Grim specification. */
+void scaleTexVerts(MODL *model, int directionFlag)
+{
+    beginPhase("scaleTexVerts");
+
+    //look up each material's dimensions once upfront
+    //the matWidths and matHeights arrays can then be index by the material index to find it's dimensions
+    float *matWidths, *matHeights;
+    materialDimensions(model->materialNames, model->numMaterials, &matWidths, &matHeights);
 
+    //for every mesh
+    for(int i=0; i<model->numMeshes; i++)
+    {
+	//a pending or unwanted mesh is still as it is in the .3do, and isn't written out
+	if(model->meshes[i]->pending || model->meshes[i]->unwanted) continue;
+	scaleMeshTexVerts(model->meshes[i], matWidths, matHeights, directionFlag);
+	countStat(STAT_MESHES, 1);
+	countStat(STAT_VERTICES, model->meshes[i]->numTexVertices);
+    }
+
+    checked_free(matWidths);
+    checked_free(matHeights);
+    endPhase();
     return;
 }
-
@@ -1 +1,18 @@
 void scaleTexVerts(MODL *model, int directionFlag);
+
+/* The same a mesh at a time: look up every material's dimensions once (arrays the caller frees), then scale each mesh with them */
+void materialDimensions(char **materialNames, int numMaterials, float **widths, float **heights);
+void scaleMeshTexVerts(MESH *mesh, float *matWidths, float *matHeights, int directionFlag);
+
+/* The built in table itself, i.e for generating models */
+int numBuiltinMaterials(void);
+char *builtinMaterialName(int index);
+
+/* Index of a material name in the built in tables (matNames.h and matSize.h), -1 if unknown */
+int findMaterial(const char *name);
+
+/* Use a material database file (see matDb.h) ahead of the built in table, returns 0 on success or -1 on failure.  Call before starting any conversions. */
+int loadMaterialDb(char *filename);
+
+/* The dimensions of a material from the database or the built in table, returns 1 if found and 0 if unknown */
+int materialSize(const char *name, int *width, int *height);
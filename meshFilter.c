@@ -0,0 +1,84 @@
+/* Choosing meshes by name, see meshFilter.h */
+
+//fnmatch() is POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include "meshFilter.h"
+#include "checkedMem.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+
+MESHFILTER *createMESHFILTER( void )
+{
+	MESHFILTER *filter = checked_malloc(sizeof(MESHFILTER));
+	filter->only = NULL;
+	filter->numOnly = 0;
+	filter->exclude = NULL;
+	filter->numExclude = 0;
+
+	return filter;
+}
+
+void addMeshFilter( MESHFILTER *filter, const char *names, int exclude )
+{
+	char ***list = exclude ? &filter->exclude : &filter->only;
+	int *count = exclude ? &filter->numExclude : &filter->numOnly;
+
+	while( *names != '\0' )
+	{
+		size_t length = strcspn(names, ",");
+		if( length != 0 )
+		{
+			*list = checked_realloc(*list, sizeof(char *) * (*count + 1));
+			char *name = checked_malloc(length + 1);
+			memcpy(name, names, length);
+			name[length] = '\0';
+			(*list)[(*count)++] = name;
+		}
+		names += length;
+		if( *names == ',' ) names++;
+	}
+}
+
+/* 1 if <meshName> matches any of the <count> patterns */
+static int matchAny( char **patterns, int count, const char *meshName )
+{
+	for(int i=0; i < count; i++)
+	{
+		if( fnmatch(patterns[i], meshName, 0) == 0 ) return 1;
+	}
+
+	return 0;
+}
+
+int meshWanted( const MESHFILTER *filter, const char *meshName )
+{
+	if( filter == NULL ) return 1;
+	if( filter->numOnly != 0 && !matchAny(filter->only, filter->numOnly, meshName) ) return 0;
+
+	return !matchAny(filter->exclude, filter->numExclude, meshName);
+}
+
+int meshFilterEmpty( const MESHFILTER *filter )
+{
+	return filter == NULL || (filter->numOnly == 0 && filter->numExclude == 0);
+}
+
+void freeMESHFILTER( MESHFILTER *filter )
+{
+	if( filter == NULL ) return;
+
+	for(int i=0; i < filter->numOnly; i++)
+	{
+		checked_free(filter->only[i]);
+	}
+	for(int i=0; i < filter->numExclude; i++)
+	{
+		checked_free(filter->exclude[i]);
+	}
+	checked_free(filter->only);
+	checked_free(filter->exclude);
+	checked_free(filter);
+}
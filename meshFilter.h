@@ -0,0 +1,23 @@
+/* Picking out meshes by name, for converting or merging only part of a model (i.e just a character's head).  Names may be shell style patterns, so "*head*" matches manny_head and headgear. */
+
+/* The meshes wanted: those matching any of <only> (every mesh if it is empty) apart from those matching any of <exclude> */
+typedef struct
+{
+	char **only;
+	int numOnly;
+	char **exclude;
+	int numExclude;
+} MESHFILTER;
+
+MESHFILTER *createMESHFILTER( void );
+
+/* Add the comma separated names in <names> to the filter's <only> list, or its <exclude> list if <exclude> is set */
+void addMeshFilter( MESHFILTER *filter, const char *names, int exclude );
+
+/* 1 if the filter lets the mesh called <meshName> through.  A NULL filter lets everything through. */
+int meshWanted( const MESHFILTER *filter, const char *meshName );
+
+/* 1 if the filter lets everything through, so there is no need to use it */
+int meshFilterEmpty( const MESHFILTER *filter );
+
+void freeMESHFILTER( MESHFILTER *filter );
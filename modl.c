@@ -2,9 +2,11 @@
 
 #include "modl.h"
 #include "checkedMem.h"
+#include "mapFile.h"
 
 #include <stdio.h>
 #include <stdlib.h> 
+#include <string.h>
 
 /* Create a new MODL structure ready to be read into*/ 
 MODL *createMODL() 
@@ -17,6 +19,10 @@ MODL *createMODL()
 	model->modelName = NULL;
 	model->meshes = NULL;
 	model->nodes = NULL;
+	model->arena = NULL;
+	model->arenaSize = 0;
+	model->sourceFile = NULL;
+	model->mapping = NULL;
 
 	return model;
 }
@@ -33,23 +39,19 @@ MESH *createMESH()
 	mesh->lightData = NULL;
 	mesh->unknown2 = NULL;
 	mesh->faces = NULL;
+	mesh->faceOffsets = NULL;
+	mesh->faceVertexIndices = NULL;
+	mesh->faceTexVertexIndices = NULL;
 	mesh->normals = NULL;
+	//not from any file
+	mesh->sourceOffset = 0;
+	mesh->sourceLength = 0;
+	mesh->pending = 0;
+	mesh->unwanted = 0;
 
 	return mesh;
 }
 
-/* Create a new FACE structure ready to be read into */
-FACE *createFACE()
-{
-	FACE *face = checked_malloc( sizeof(FACE) );
-
-	//set all pointer values to NULL for safety
-	face->vertexIndices = NULL;
-	face->texVertexIndices = NULL;
-
-	return face;
-}
-
 /* Create a new NODE structure ready to be read into */
 NODE *createNODE()
 {
@@ -57,70 +59,90 @@ NODE *createNODE()
 
 	//set all pointer fields to NULL for safety
 	node->name = NULL;
+	//not from any file
+	node->sourceOffset = 0;
+	node->sourceLength = 0;
 
 	return node;
 }
 
-/*Free the memory associated with a NODE structure. */
-void freeNODE( NODE *node )
+/* The mesh no longer matches its section of the source file */
+void changedMESH( MESH *mesh )
 {
-	//if already freed, exit early
-	if( node == NULL ) return;
+	mesh->sourceLength = 0;
+}
 
-	//free the node name (allocated by strndup)
-	free(node->name);
+/* The node no longer matches its section of the source file */
+void changedNODE( NODE *node )
+{
+	node->sourceLength = 0;
+}
 
-	//free the memory allocated to the NODE structure
-	free(node);
+/* Returns 1 if <ptr> lies within the arena block the model was read into */
+int inArena( MODL *model, void *ptr )
+{
+	if( model->arena == NULL || ptr == NULL ) return 0;
 
-	return;
+	char *p = ptr;
+	char *base = model->arena;
+	return p >= base && p < base + model->arenaSize;
 }
 
-/* Free the memory associated with a FACE structure. */
-void freeFACE( FACE *face )
+/* checked_free() a block belonging to the model, unless it is part of the arena (freed all at once by freeMODL()) */
+void freeModlBlock( MODL *model, void *ptr )
+{
+	if( !inArena(model, ptr) ) checked_free(ptr);
+}
+
+/* realloc() a block belonging to the model.  Arena memory cannot be resized in place, so it is copied out into a new heap block instead. */
+void *reallocModlBlock( MODL *model, void *ptr, size_t oldSize, size_t newSize )
+{
+	if( !inArena(model, ptr) ) return checked_realloc(ptr, newSize);
+
+	void *mem = checked_malloc(newSize);
+	memcpy(mem, ptr, oldSize < newSize ? oldSize : newSize);
+	return mem;
+}
+
+/*Free the memory associated with a NODE structure. */
+void freeNODE( MODL *model, NODE *node )
 {
 	//if already freed, exit early
-	if( face == NULL ) return;
+	if( node == NULL ) return;
 
-	//free a couple of dynamic arrays
-	free(face->vertexIndices);
-	free(face->texVertexIndices);
+	//free the node name (allocated by strndup)
+	freeModlBlock(model, node->name);
 
-	//free the memory allocated to the FACE structure itself
-	free(face);
+	//free the memory allocated to the NODE structure
+	freeModlBlock(model, node);
 
 	return;
 }
 
 /* Free the memory associated with a MESH structure */
-void freeMESH( MESH *mesh )
+void freeMESH( MODL *model, MESH *mesh )
 {
 	//if already freed, exit early
 	if( mesh == NULL ) return;
 
-	free(mesh->meshName);	//allocate by strndup
+	freeModlBlock(model, mesh->meshName);	//allocate by strndup
 
 	//free some dynamic arrays
-	free(mesh->vertices);
-	free(mesh->texVertices);
-	free(mesh->lightData);
-	free(mesh->unknown2);
+	freeModlBlock(model, mesh->vertices);
+	freeModlBlock(model, mesh->texVertices);
+	freeModlBlock(model, mesh->lightData);
+	freeModlBlock(model, mesh->unknown2);
 
-	if( mesh->faces != NULL )
-	{
-		//free each of the FACE structures
-		for(int i=0; i < mesh->numFaces; i++)
-		{
-			freeFACE(mesh->faces[i]);
-		}
-		//free the memory allocated to the array itself
-		free(mesh->faces);
-	}
+	//the faces are just 4 flat arrays
+	freeModlBlock(model, mesh->faces);
+	freeModlBlock(model, mesh->faceOffsets);
+	freeModlBlock(model, mesh->faceVertexIndices);
+	freeModlBlock(model, mesh->faceTexVertexIndices);
 
-	free(mesh->normals);
+	freeModlBlock(model, mesh->normals);
 
 	//finally free the memory allocated to the MESH structure itself
-	free(mesh);
+	freeModlBlock(model, mesh);
 
 	return;
 }
@@ -134,44 +156,49 @@ void freeMODL( MODL *model )
 		printf("ALREADY FREED THIS MODL");
 		return; 
 	}
-	if( model->materialNames != NULL )
+	if( model->materialNames != NULL && !inArena(model, model->materialNames) )
 	{
 		//free each of the material names (allocate with strndup)
 		for(int i=0; i < model->numMaterials; i++)
 		{
-			free(model->materialNames[i]);
+			checked_free(model->materialNames[i]);
 		}
 		//free the memory allocated to the array itself
-		free(model->materialNames);
+		checked_free(model->materialNames);
 	}
 
-	free(model->modelName);	//allocated by strndup
+	freeModlBlock(model, model->modelName);	//allocated by strndup
+	freeModlBlock(model, model->sourceFile);
+	if( model->mapping != NULL ) unmapFile(model->mapping);
 	
 	if( model->meshes != NULL )
 	{
 		//free each of the MESH structures
+		//(for a model read straight into the arena this frees nothing, only checks for replaced arrays)
 		for(int i=0; i < model->numMeshes; i++)
 		{
-			freeMESH(model->meshes[i]);
+			freeMESH(model, model->meshes[i]);
 		}
 		//free the memory allocated to the array itself
-		free(model->meshes);
+		freeModlBlock(model, model->meshes);
 	}
 	
 
-	if( model->nodes != NULL )
+	if( model->nodes != NULL && !inArena(model, model->nodes) )
 	{
 		//free each of the NODE structures
 		for(int i=0; i < model->numNodes; i++)
 		{
-			freeNODE(model->nodes[i]);
+			freeNODE(model, model->nodes[i]);
 		}
 		//free the memory allocated to the array itself
-		free(model->nodes);
+		checked_free(model->nodes);
 	}
 	
 	//finally free the memory allocated to the structure itself
-	free(model);
+	//(which for an arena model is the start of the arena, releasing everything)
+	if( model->arena != NULL ) checked_free(model->arena);
+	else checked_free(model);
 
 	return;
 }
@@ -5,8 +5,9 @@ The writeup of the model format at wiki.multimedia.cx/index.php?title=MODL was u
 
 //shitstorm of redefintion bvullshut
 #include "vector.h"
+#include "fileStamp.h"
 
-/* A structure to hold each FACE in the .3do file */
+/* A structure to hold the attributes of each FACE in the .3do file.  The vertex and texture vertex indices of every face are kept together in the MESH (see below) rather than in each FACE. */
 typedef struct 
 {
 
@@ -36,10 +37,6 @@ typedef struct
 	vector3 unknown3;
 	//face normal
 	vector3 faceNormal;
-	//mesh vertex indices, an array of int's with size <numVertices> 
-	int *vertexIndices;
-	//texture vertex indices, an array with size <numVertices>
-	int *texVertexIndices;	//only if <hasTexture>
 	//material index
 	int materialIndex;	//only if <hasMaterial>
 } FACE;
@@ -74,8 +71,15 @@ typedef struct
 	float *lightData;
 	//unknown, 4 bytes per vertice, i.e array of size <numVertices>
 	int *unknown2;
-	//face data, an array of pointers to FACE structures, size <numFaces>
-	FACE **faces;
+	//face data, an array of FACE structures, size <numFaces>
+	FACE *faces;
+	//where each face's indices start in the two arrays below, size <numFaces + 1>
+	//face i uses entries faceOffsets[i] up to (not including) faceOffsets[i+1]
+	int *faceOffsets;
+	//mesh vertex indices of every face, one face after another, size <faceOffsets[numFaces]>
+	int *faceVertexIndices;
+	//texture vertex indices laid out the same way (entries for faces without <hasTexture> are 0)
+	int *faceTexVertexIndices;
 	//vertex normals, an array of vector3's with size <numVertices>
 	vector3 *normals;
 	//has shadow
@@ -89,6 +93,15 @@ typedef struct
 	//unknown vector3
 	vector3 unknown5;
 
+	//where this mesh's section lies in the file it was read from (see MODL's <sourceFile>)
+	//a length of 0 means it wasn't read from a file or has since been changed, so must be written out from the fields above
+	size_t sourceOffset;
+	size_t sourceLength;
+	//1 while only the header (the name, modes and counts) has been decoded and the arrays are NULL, see read3doLazy()
+	int pending;
+	//1 if fully decoded (i.e from an image) but not let through by the filter given to read3doLazy(), it is neither converted nor merged but still written back out
+	int unwanted;
+
 } MESH;
 
 
@@ -138,6 +151,10 @@ typedef struct
 	//siblingID
 	int siblingID;
 
+	//where this node's section lies in the file it was read from, as for a MESH
+	size_t sourceOffset;
+	size_t sourceLength;
+
 } NODE;
 
 /* The main structure which the entire .3do file will be read into. */
@@ -188,6 +205,23 @@ typedef struct
 	//that leaves 24 bytes of stuff? just store them in here
 	int unknown4[6];
 
+	/* MEMORY */
+
+	//the single block read3do() places the whole model in (NULL if built piece by piece)
+	//anything pointing inside it must not be freed on its own, see freeModlBlock()
+	void *arena;
+	//size of the arena block in bytes
+	size_t arenaSize;
+
+	/* SOURCE */
+
+	//the .3do this was read from and what it was like at the time, NULL if not read from a .3do
+	//write3do() copies the sections of meshes and nodes which are unchanged straight from it
+	char *sourceFile;
+	FILESTAMP source;
+	//the MAPPEDFILE (see mapFile.h) kept by read3doLazy() while any meshes are pending, NULL otherwise
+	void *mapping;
+
 } MODL; 
 
 /* The "createXXXX()" functions need to be used outside of modl.c, but freeMODL() itself calls the other free functions, and so only freeMODL() needs to be used outside of modl.c */
@@ -198,9 +232,6 @@ MODL *createMODL();
 /*Allocates memory for a new MESH structure and set pointer fields to NULL */
 MESH *createMESH();
 
-/*Allocate memory for a new FACE structure and set pointer fields to NULL */
-FACE *createFACE();
-
 /*Allocate memory for a new NODE structure and set pointer fields to NULL */
 NODE *createNODE();
 
@@ -210,13 +241,24 @@ void freeMODL( MODL *model );
 /* Following not needed by "client" as are called themselves during freeMODL */
 
 /*Free the memory associated with a MESH structure.*/
-//void freeMESH( MESH *mesh );
-
-/*Free the memory associated with a FACE structure.*/
-//this one is needed in update3do.c
-void freeFACE( FACE *face );
+//void freeMESH( MODL *model, MESH *mesh );
 
 /*Free the memory associated with a NODE structure.*/
-//void freeNODE( NODE *node );
+//void freeNODE( MODL *model, NODE *node );
+
+/* Anything changing a MESH or NODE read by read3do() must set its <sourceLength> to 0, or write3do() will copy the original section over the changes */
+void changedMESH( MESH *mesh );
+void changedNODE( NODE *node );
+
+/* Anything replacing part of a MODL read by read3do() must use these rather than free()/realloc() directly, as the original may live inside the arena */
+
+/*Returns 1 if <ptr> points inside the model's arena block */
+int inArena( MODL *model, void *ptr );
+
+/*free() memory belonging to the model, does nothing for memory inside the arena */
+void freeModlBlock( MODL *model, void *ptr );
+
+/*realloc() memory belonging to the model, memory inside the arena is copied out to a new block (<oldSize> bytes of it at most) */
+void *reallocModlBlock( MODL *model, void *ptr, size_t oldSize, size_t newSize );
 
 
@@ -0,0 +1,434 @@
+/* Laying a MODL out flat as an image and taking it back again (see modlImage.h).
+
+The same layout function runs twice, once to total up the size of the image and once to fill it in, so the two can't disagree.  Every piece of the image starts on an ARENA_ALIGN boundary, so the arrays can be used in place. */
+
+#include "modl.h"
+#include "modlImage.h"
+#include "meshFilter.h"
+#include "read3do.h"
+#include "checkedMem.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BYTE_ORDER_MARK 0x01020304
+//longest names the .3do format holds (see write3do.c)
+#define MAX_NAME_LENGTH 32
+#define MAX_NODE_NAME_LENGTH 64
+
+void *imageAt( const MODLIMAGE *image, IMAGEOFFSET offset )
+{
+	if( offset == 0 ) return NULL;
+
+	return (char *)image + offset;
+}
+
+/* LAYOUT */
+
+/* An image being laid out, <base> is NULL on the pass which only totals up the size */
+typedef struct
+{
+	char *base;
+	size_t used;
+} IMAGEBUILDER;
+
+/* Set aside the next <n> bytes, returning their offset (0 for none) */
+static IMAGEOFFSET reserve( IMAGEBUILDER *b, size_t n )
+{
+	if( n == 0 ) return 0;
+
+	IMAGEOFFSET offset = b->used;
+	b->used += ARENA_ROUND(n);
+	return offset;
+}
+
+/* Copy <n> bytes to <offset>, if the image is there yet */
+static void putAt( IMAGEBUILDER *b, IMAGEOFFSET offset, const void *src, size_t n )
+{
+	if( b->base != NULL ) memcpy(b->base + offset, src, n);
+}
+
+/* Set aside and fill in a copy of the <n> bytes at <src>, 0 if there are none */
+static IMAGEOFFSET putData( IMAGEBUILDER *b, const void *src, size_t n )
+{
+	if( src == NULL ) return 0;
+
+	IMAGEOFFSET offset = reserve(b, n);
+	if( n != 0 ) putAt(b, offset, src, n);
+	return offset;
+}
+
+static IMAGEOFFSET putString( IMAGEBUILDER *b, const char *s )
+{
+	return s != NULL ? putData(b, s, strlen(s) + 1) : 0;
+}
+
+static void layoutMesh( IMAGEBUILDER *b, MESH *mesh, IMAGEMESH *im )
+{
+	memset(im, 0, sizeof(IMAGEMESH));
+	im->meshName = putString(b, mesh->meshName);
+	im->unknown1 = mesh->unknown1;
+	im->geometryMode = mesh->geometryMode;
+	im->lightingMode = mesh->lightingMode;
+	im->textureMode = mesh->textureMode;
+	im->numVertices = mesh->numVertices;
+	im->numTexVertices = mesh->numTexVertices;
+	im->numFaces = mesh->numFaces;
+	im->hasShadow = mesh->hasShadow;
+
+	im->vertices = putData(b, mesh->vertices, sizeof(vector3) * mesh->numVertices);
+	im->texVertices = putData(b, mesh->texVertices, sizeof(vector2) * mesh->numTexVertices);
+	im->lightData = putData(b, mesh->lightData, sizeof(float) * mesh->numVertices);
+	im->unknown2 = putData(b, mesh->unknown2, sizeof(int) * mesh->numVertices);
+	im->faces = putData(b, mesh->faces, sizeof(FACE) * mesh->numFaces);
+
+	//a mesh without faces may not have any offsets at all
+	int noFaces = 0;
+	int *faceOffsets = mesh->faceOffsets != NULL ? mesh->faceOffsets : &noFaces;
+	int numIndices = mesh->numFaces > 0 ? faceOffsets[mesh->numFaces] : 0;
+	im->faceOffsets = putData(b, faceOffsets, sizeof(int) * (mesh->numFaces + 1));
+	im->faceVertexIndices = putData(b, mesh->faceVertexIndices, sizeof(int) * numIndices);
+	im->faceTexVertexIndices = putData(b, mesh->faceTexVertexIndices, sizeof(int) * numIndices);
+	im->normals = putData(b, mesh->normals, sizeof(vector3) * mesh->numVertices);
+
+	im->unknown3 = mesh->unknown3;
+	im->meshRadius = mesh->meshRadius;
+	memcpy(im->unknown4, mesh->unknown4, sizeof(vector3));
+	memcpy(im->unknown5, mesh->unknown5, sizeof(vector3));
+}
+
+/* Lay out the whole model, the header first */
+static void layoutImage( IMAGEBUILDER *b, MODL *model )
+{
+	MODLIMAGE header;
+	memset(&header, 0, sizeof(MODLIMAGE));
+	reserve(b, sizeof(MODLIMAGE));
+
+	memcpy(header.magic, MODLIMAGE_MAGIC, 8);
+	header.version = MODLIMAGE_VERSION;
+	header.byteOrder = BYTE_ORDER_MARK;
+	header.faceSize = sizeof(FACE);
+	header.meshSize = sizeof(IMAGEMESH);
+	header.nodeSize = sizeof(IMAGENODE);
+	header.headerSize = sizeof(MODLIMAGE);
+
+	/* HEADER */
+	memcpy(header.fourcc, model->fourcc, 4);
+	header.numMaterials = model->numMaterials;
+	header.materialNames = reserve(b, sizeof(IMAGEOFFSET) * model->numMaterials);
+	for(int i=0; i < model->numMaterials; i++)
+	{
+		IMAGEOFFSET name = putString(b, model->materialNames[i]);
+		putAt(b, header.materialNames + sizeof(IMAGEOFFSET) * i, &name, sizeof(IMAGEOFFSET));
+	}
+	header.modelName = putString(b, model->modelName);
+
+	/* GEOSET */
+	header.unknown1 = model->unknown1;
+	header.numGeosets = model->numGeosets;
+	header.numMeshes = model->numMeshes;
+	header.meshes = reserve(b, sizeof(IMAGEMESH) * model->numMeshes);
+	for(int i=0; i < model->numMeshes; i++)
+	{
+		IMAGEMESH im;
+		layoutMesh(b, model->meshes[i], &im);
+		putAt(b, header.meshes + sizeof(IMAGEMESH) * i, &im, sizeof(IMAGEMESH));
+	}
+
+	/* NODES */
+	header.unknown2 = model->unknown2;
+	header.numNodes = model->numNodes;
+	header.nodes = reserve(b, sizeof(IMAGENODE) * model->numNodes);
+	for(int i=0; i < model->numNodes; i++)
+	{
+		IMAGENODE in;
+		memset(&in, 0, sizeof(IMAGENODE));
+		in.name = putString(b, model->nodes[i]->name);
+		in.node = *model->nodes[i];
+		in.node.name = NULL;
+		putAt(b, header.nodes + sizeof(IMAGENODE) * i, &in, sizeof(IMAGENODE));
+	}
+
+	/* FOOTER */
+	header.modelRadius = model->modelRadius;
+	memcpy(header.insertionOffset, model->insertionOffset, sizeof(vector3));
+	memcpy(header.unknown3, model->unknown3, sizeof(vector3));
+	memcpy(header.unknown4, model->unknown4, sizeof(header.unknown4));
+
+	header.size = b->used;
+	putAt(b, 0, &header, sizeof(MODLIMAGE));
+}
+
+MODLIMAGE *modlToImage( MODL *model, size_t *size )
+{
+	//an image holds every mesh in full
+	for(int i=0; i < model->numMeshes; i++)
+	{
+		loadMesh(model, i);
+	}
+
+	IMAGEBUILDER sizing = { NULL, 0 };
+	layoutImage(&sizing, model);
+
+	//zeroed so the padding is the same every time
+	IMAGEBUILDER b = { checked_calloc(1, sizing.used), 0 };
+	layoutImage(&b, model);
+
+	*size = b.used;
+	return (MODLIMAGE *)b.base;
+}
+
+int writeModlImage( MODL *model, char *filename )
+{
+	beginPhase("writeImage");
+
+	size_t size;
+	MODLIMAGE *image = modlToImage(model, &size);
+
+	FILE *ofp = fopen(filename, "wb");
+	if( ofp == NULL )
+	{
+		fprintf(stderr, "Could not open %s for writing.\n", filename);
+		checked_free(image);
+		endPhase();
+		return -1;
+	}
+
+	int status = 0;
+	size_t written = fwrite(image, 1, size, ofp);
+	if( fclose(ofp) != 0 || written != size )
+	{
+		fprintf(stderr, "fwrite() failed to write all bytes.\n");
+		status = -1;
+	}
+	countBytes(0, written);
+
+	checked_free(image);
+	endPhase();
+	return status;
+}
+
+/* CHECKING */
+
+int isModlImage( const void *data, size_t size )
+{
+	return size >= 8 && memcmp(data, MODLIMAGE_MAGIC, 8) == 0;
+}
+
+/* 1 if <count> things of <elemSize> bytes at <offset> all lie within the image */
+static int inImage( uint64_t size, IMAGEOFFSET offset, int count, size_t elemSize )
+{
+	if( count < 0 || offset % ARENA_ALIGN != 0 || offset > size ) return 0;
+	if( count == 0 ) return 1;
+
+	return offset != 0 && (uint64_t)count <= (size - offset) / elemSize;
+}
+
+/* 1 if the string at <offset> ends within the image, and within <maxLength> characters */
+static int stringInImage( const unsigned char *data, uint64_t size, IMAGEOFFSET offset, size_t maxLength )
+{
+	if( offset == 0 ) return 1;
+	if( offset >= size ) return 0;
+
+	size_t room = size - offset;
+	return memchr(data + offset, '\0', room < maxLength + 1 ? room : maxLength + 1) != NULL;
+}
+
+/* The mesh's arrays, and that everything it indexes (vertices and materials) is there */
+static int checkMesh( const unsigned char *data, uint64_t size, const IMAGEMESH *im, int numMaterials )
+{
+	if( !stringInImage(data, size, im->meshName, MAX_NAME_LENGTH) ) return 0;
+	if( !inImage(size, im->vertices, im->numVertices, sizeof(vector3)) ) return 0;
+	if( !inImage(size, im->texVertices, im->numTexVertices, sizeof(vector2)) ) return 0;
+	if( !inImage(size, im->lightData, im->numVertices, sizeof(float)) ) return 0;
+	if( !inImage(size, im->unknown2, im->numVertices, sizeof(int)) ) return 0;
+	if( !inImage(size, im->normals, im->numVertices, sizeof(vector3)) ) return 0;
+	if( !inImage(size, im->faces, im->numFaces, sizeof(FACE)) ) return 0;
+	if( im->numFaces == 0 ) return 1;
+
+	//each face's indices must follow on from the one before
+	if( !inImage(size, im->faceOffsets, im->numFaces + 1, sizeof(int)) ) return 0;
+	const FACE *faces = (const FACE *)(data + im->faces);
+	const int *faceOffsets = (const int *)(data + im->faceOffsets);
+	if( faceOffsets[0] != 0 ) return 0;
+	for(int i=0; i < im->numFaces; i++)
+	{
+		if( faces[i].numVertices < 0 || (long long)faceOffsets[i+1] - faceOffsets[i] != faces[i].numVertices ) return 0;
+	}
+	int numIndices = faceOffsets[im->numFaces];
+	if( !inImage(size, im->faceVertexIndices, numIndices, sizeof(int)) || !inImage(size, im->faceTexVertexIndices, numIndices, sizeof(int)) ) return 0;
+
+	const int *vertexIndices = (const int *)(data + im->faceVertexIndices);
+	const int *texVertexIndices = (const int *)(data + im->faceTexVertexIndices);
+	for(int i=0; i < im->numFaces; i++)
+	{
+		if( faces[i].hasMaterial != 0 && (faces[i].materialIndex < 0 || faces[i].materialIndex >= numMaterials) ) return 0;
+		for(int j=faceOffsets[i]; j < faceOffsets[i+1]; j++)
+		{
+			if( vertexIndices[j] < 0 || vertexIndices[j] >= im->numVertices ) return 0;
+			if( (faces[i].hasTexture != 0 || faces[i].hasMaterial != 0) && (texVertexIndices[j] < 0 || texVertexIndices[j] >= im->numTexVertices) ) return 0;
+		}
+	}
+	return 1;
+}
+
+/* Everything but the header, which has already been checked */
+static int checkContents( const unsigned char *data, const MODLIMAGE *header )
+{
+	uint64_t size = header->size;
+
+	if( !inImage(size, header->materialNames, header->numMaterials, sizeof(IMAGEOFFSET)) ) return 0;
+	const IMAGEOFFSET *names = (const IMAGEOFFSET *)(data + header->materialNames);
+	for(int i=0; i < header->numMaterials; i++)
+	{
+		if( !stringInImage(data, size, names[i], MAX_NAME_LENGTH) ) return 0;
+	}
+	if( !stringInImage(data, size, header->modelName, MAX_NAME_LENGTH) ) return 0;
+
+	if( !inImage(size, header->meshes, header->numMeshes, sizeof(IMAGEMESH)) ) return 0;
+	const IMAGEMESH *meshes = (const IMAGEMESH *)(data + header->meshes);
+	for(int i=0; i < header->numMeshes; i++)
+	{
+		if( !checkMesh(data, size, &meshes[i], header->numMaterials) ) return 0;
+	}
+
+	if( !inImage(size, header->nodes, header->numNodes, sizeof(IMAGENODE)) ) return 0;
+	const IMAGENODE *nodes = (const IMAGENODE *)(data + header->nodes);
+	for(int i=0; i < header->numNodes; i++)
+	{
+		if( !stringInImage(data, size, nodes[i].name, MAX_NODE_NAME_LENGTH) ) return 0;
+		const NODE *node = &nodes[i].node;
+		if( node->meshID < -1 || node->meshID >= header->numMeshes ) return 0;
+		if( node->hasChildren != 0 && (node->childID < 0 || node->childID >= header->numNodes) ) return 0;
+		if( node->hasSibling != 0 && (node->siblingID < 0 || node->siblingID >= header->numNodes) ) return 0;
+	}
+
+	return 1;
+}
+
+const MODLIMAGE *checkModlImage( const void *data, size_t size, char *filename )
+{
+	const MODLIMAGE *header = data;
+	if( size < sizeof(MODLIMAGE) || !isModlImage(data, size) )
+	{
+		fprintf(stderr, "%s is not a model image.\n", filename);
+		return NULL;
+	}
+	if( (uintptr_t)data % ARENA_ALIGN != 0 )
+	{
+		fprintf(stderr, "%s is not aligned in memory.\n", filename);
+		return NULL;
+	}
+	if( header->version != MODLIMAGE_VERSION || header->byteOrder != BYTE_ORDER_MARK || header->faceSize != sizeof(FACE) || header->meshSize != sizeof(IMAGEMESH) || header->nodeSize != sizeof(IMAGENODE) || header->headerSize != sizeof(MODLIMAGE) )
+	{
+		fprintf(stderr, "%s is a model image from a different version or kind of machine.\n", filename);
+		return NULL;
+	}
+	//(the memory it is in may be larger, i.e rounded up to a page of shared memory)
+	if( header->size > size || header->size < sizeof(MODLIMAGE) || !checkContents(data, header) )
+	{
+		fprintf(stderr, "%s is truncated or corrupt.\n", filename);
+		return NULL;
+	}
+
+	return header;
+}
+
+/* BACK TO A MODL */
+
+MODL *imageToMODL( const MODLIMAGE *image )
+{
+	//the copy of the image comes first, then the structures pointing into it
+	size_t arenaSize = ARENA_ROUND(image->size) + ARENA_ROUND(sizeof(MODL));
+	arenaSize += ARENA_ROUND(sizeof(char *) * image->numMaterials);
+	arenaSize += ARENA_ROUND(sizeof(MESH *) * image->numMeshes) + ARENA_ROUND(sizeof(MESH)) * image->numMeshes;
+	arenaSize += ARENA_ROUND(sizeof(NODE *) * image->numNodes) + ARENA_ROUND(sizeof(NODE)) * image->numNodes;
+	ARENA arena;
+	arenaInit(&arena, arenaSize);
+	ARENA *a = &arena;
+
+	MODLIMAGE *copy = arenaAlloc(a, image->size);
+	memcpy(copy, image, image->size);
+
+	MODL *model = arenaAlloc(a, sizeof(MODL));
+	model->arena = arena.base;
+	model->arenaSize = arena.size;
+	//nothing to copy sections from, write3do() serializes it all
+	model->sourceFile = NULL;
+	model->mapping = NULL;
+
+	/* HEADER */
+	memcpy(model->fourcc, copy->fourcc, 4);
+	model->numMaterials = copy->numMaterials;
+	model->materialNames = arenaAlloc(a, sizeof(char *) * copy->numMaterials);
+	IMAGEOFFSET *names = imageAt(copy, copy->materialNames);
+	for(int i=0; i < copy->numMaterials; i++)
+	{
+		model->materialNames[i] = imageAt(copy, names[i]);
+	}
+	model->modelName = imageAt(copy, copy->modelName);
+
+	/* GEOSET */
+	model->unknown1 = copy->unknown1;
+	model->numGeosets = copy->numGeosets;
+	model->numMeshes = copy->numMeshes;
+	model->meshes = arenaAlloc(a, sizeof(MESH *) * copy->numMeshes);
+	IMAGEMESH *meshes = imageAt(copy, copy->meshes);
+	for(int i=0; i < copy->numMeshes; i++)
+	{
+		IMAGEMESH *im = &meshes[i];
+		MESH *mesh = arenaAlloc(a, sizeof(MESH));
+		mesh->meshName = imageAt(copy, im->meshName);
+		mesh->unknown1 = im->unknown1;
+		mesh->geometryMode = im->geometryMode;
+		mesh->lightingMode = im->lightingMode;
+		mesh->textureMode = im->textureMode;
+		mesh->numVertices = im->numVertices;
+		mesh->numTexVertices = im->numTexVertices;
+		mesh->numFaces = im->numFaces;
+		mesh->vertices = imageAt(copy, im->vertices);
+		mesh->texVertices = imageAt(copy, im->texVertices);
+		mesh->lightData = imageAt(copy, im->lightData);
+		mesh->unknown2 = imageAt(copy, im->unknown2);
+		mesh->faces = imageAt(copy, im->faces);
+		mesh->faceOffsets = imageAt(copy, im->faceOffsets);
+		mesh->faceVertexIndices = imageAt(copy, im->faceVertexIndices);
+		mesh->faceTexVertexIndices = imageAt(copy, im->faceTexVertexIndices);
+		mesh->normals = imageAt(copy, im->normals);
+		mesh->hasShadow = im->hasShadow;
+		mesh->unknown3 = im->unknown3;
+		mesh->meshRadius = im->meshRadius;
+		memcpy(mesh->unknown4, im->unknown4, sizeof(vector3));
+		memcpy(mesh->unknown5, im->unknown5, sizeof(vector3));
+		mesh->sourceOffset = 0;
+		mesh->sourceLength = 0;
+		mesh->pending = 0;
+		mesh->unwanted = 0;
+		model->meshes[i] = mesh;
+	}
+
+	/* NODES */
+	model->unknown2 = copy->unknown2;
+	model->numNodes = copy->numNodes;
+	model->nodes = arenaAlloc(a, sizeof(NODE *) * copy->numNodes);
+	IMAGENODE *nodes = imageAt(copy, copy->nodes);
+	for(int i=0; i < copy->numNodes; i++)
+	{
+		NODE *node = arenaAlloc(a, sizeof(NODE));
+		*node = nodes[i].node;
+		node->name = imageAt(copy, nodes[i].name);
+		node->sourceOffset = 0;
+		node->sourceLength = 0;
+		model->nodes[i] = node;
+	}
+
+	/* FOOTER */
+	model->modelRadius = copy->modelRadius;
+	memcpy(model->insertionOffset, copy->insertionOffset, sizeof(vector3));
+	memcpy(model->unknown3, copy->unknown3, sizeof(vector3));
+	memcpy(model->unknown4, copy->unknown4, sizeof(model->unknown4));
+
+	return model;
+}
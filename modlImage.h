@@ -0,0 +1,115 @@
+/* A whole MODL laid out flat in one block of memory (include modl.h first).
+
+Everything refers to everything else by its offset from the start of the image instead of a pointer, so an image can be written to disk or placed in shared memory and used again wherever it ends up, without fixing anything up.  The meshes, faces and nodes are plain arrays and the names are held in the same block.  Reading an image back is a single copy, so converting the same model repeatedly skips decoding the .3do.
+
+An image is only meant for the machine (or at least the kind of machine) that made it.  The header records the byte order and structure sizes and an image which doesn't match is refused. */
+
+#include <stdint.h>
+
+//the first 8 bytes of every image
+#define MODLIMAGE_MAGIC "3DOIMAGE"
+#define MODLIMAGE_VERSION 1
+//the extension given to images written by 3doobj --image
+#define MODLIMAGE_EXT ".3dimg"
+
+/* Bytes from the start of the image, 0 where the MODL would have a NULL pointer */
+typedef uint64_t IMAGEOFFSET;
+
+/* A MESH with its arrays as offsets, the counts and faces are the same as in the MESH */
+typedef struct
+{
+	IMAGEOFFSET meshName;
+	int unknown1;
+	int geometryMode;
+	int lightingMode;
+	int textureMode;
+	int numVertices;
+	int numTexVertices;
+	int numFaces;
+	int hasShadow;
+
+	//vector3 [numVertices]
+	IMAGEOFFSET vertices;
+	//vector2 [numTexVertices]
+	IMAGEOFFSET texVertices;
+	//float [numVertices]
+	IMAGEOFFSET lightData;
+	//int [numVertices]
+	IMAGEOFFSET unknown2;
+	//FACE [numFaces]
+	IMAGEOFFSET faces;
+	//int [numFaces + 1]
+	IMAGEOFFSET faceOffsets;
+	//both int [faceOffsets[numFaces]]
+	IMAGEOFFSET faceVertexIndices;
+	IMAGEOFFSET faceTexVertexIndices;
+	//vector3 [numVertices]
+	IMAGEOFFSET normals;
+
+	int unknown3;
+	float meshRadius;
+	vector3 unknown4;
+	vector3 unknown5;
+} IMAGEMESH;
+
+/* A NODE with its name as an offset */
+typedef struct
+{
+	IMAGEOFFSET name;
+	NODE node;
+} IMAGENODE;
+
+/* The start of an image, the MODL apart from the meshes and nodes */
+typedef struct
+{
+	char magic[8];
+	int version;
+	//0x01020304 as written by the machine that made it
+	uint32_t byteOrder;
+	//sizeof() each structure, which must match to use the image
+	int faceSize;
+	int meshSize;
+	int nodeSize;
+	int headerSize;
+	//of the whole image, header included
+	uint64_t size;
+
+	char fourcc[4];
+	int numMaterials;
+	//IMAGEOFFSET [numMaterials], each the offset of a name
+	IMAGEOFFSET materialNames;
+	IMAGEOFFSET modelName;
+
+	int unknown1;
+	int numGeosets;
+	int numMeshes;
+	int unknown2;
+	//IMAGEMESH [numMeshes]
+	IMAGEOFFSET meshes;
+	int numNodes;
+	float modelRadius;
+	//IMAGENODE [numNodes]
+	IMAGEOFFSET nodes;
+
+	vector3 insertionOffset;
+	vector3 unknown3;
+	int unknown4[6];
+} MODLIMAGE;
+
+/* The memory at <offset> into an image, NULL for offset 0 */
+void *imageAt( const MODLIMAGE *image, IMAGEOFFSET offset );
+
+/* Lay out <model> as an image in a single block from checked_malloc(), its size is put in <size>.  Any pending meshes (see read3doLazy()) are loaded first. */
+MODLIMAGE *modlToImage( MODL *model, size_t *size );
+
+/* Write <model> out as an image, returns 0 on success or -1 on failure */
+int writeModlImage( MODL *model, char *filename );
+
+/* 1 if <data> starts like an image (see checkModlImage() before trusting it) */
+int isModlImage( const void *data, size_t size );
+
+/* Check the <size> bytes at <data> (8 byte aligned, i.e from mapFile()) are an image this machine can use, with every offset and index in range.  Returns it, or NULL with a message naming <filename> if not. */
+const MODLIMAGE *checkModlImage( const void *data, size_t size, char *filename );
+
+/* A MODL from a checked image.  The image is copied once into the MODL's arena and the MODL points straight into that copy, so there is no decoding. */
+MODL *imageToMODL( const MODLIMAGE *image );
@@ -0,0 +1,224 @@
+/* Building, saving and checking the index of a .3do (see modlIndex.h).
+
+Building steps through the file the same way as the sizing pass in read3do.c, noting where each section starts rather than totalling up memory. */
+
+#include "vector.h"
+#include "fileStamp.h"
+#include "modlIndex.h"
+#include "cursor.h"
+#include "mapFile.h"
+#include "checkedMem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BYTE_ORDER_MARK 0x01020304
+//bytes into a mesh section of its vertex, texture vertex and face counts
+#define MESH_COUNTS_OFFSET (MESH_HEADER_SIZE - 12)
+
+char *indexFilename( const char *filename )
+{
+	char *name = checked_malloc(strlen(filename) + strlen(MODLINDEX_EXT) + 1);
+	strcpy(name, filename);
+	strcat(name, MODLINDEX_EXT);
+
+	return name;
+}
+
+uint64_t hash3do( const unsigned char *data, size_t size )
+{
+	uint64_t h = 14695981039346656037ULL;
+	for(size_t i=0; i < size; i++)
+	{
+		h ^= data[i];
+		h *= 1099511628211ULL;
+	}
+
+	return h;
+}
+
+/* Step over a mesh section, noting where it and its faces are */
+static void indexMesh( CURSOR *c, INDEXMESH *im )
+{
+	im->offset = c->pos;
+	takeBytes(c, MESH_COUNTS_OFFSET);
+	im->numVertices = takeCount(c);
+	im->numTexVertices = takeCount(c);
+	im->numFaces = takeCount(c);
+
+	//vertices, light data and unknown2 then the texture vertices
+	takeBytes(c, (sizeof(vector3) + sizeof(float) + sizeof(int)) * im->numVertices);
+	takeBytes(c, sizeof(vector2) * im->numTexVertices);
+
+	im->faceOffset = c->pos;
+	im->numIndices = 0;
+	for(int i=0; i < im->numFaces && !c->failed; i++)
+	{
+		const unsigned char *h = takeBytes(c, FACE_HEADER_SIZE);
+		if( h == NULL ) break;
+		int numVertices = checkCount(c, peekInt(h + 20));
+		takeBytes(c, sizeof(int) * numVertices);
+		if( peekInt(h + 28) != 0 ) takeBytes(c, sizeof(int) * numVertices);	//hasTexture
+		if( peekInt(h + 32) != 0 ) takeBytes(c, 4);	//hasMaterial
+		im->numIndices += numVertices;
+	}
+	im->faceLength = c->pos - im->faceOffset;
+
+	//normals and the footer
+	takeBytes(c, sizeof(vector3) * im->numVertices);
+	takeBytes(c, MESH_FOOTER_SIZE);
+	im->length = c->pos - im->offset;
+}
+
+MODLINDEX *buildModlIndex( const unsigned char *data, size_t size, const FILESTAMP *stamp, char *filename )
+{
+	if( size < 4 || strncmp((const char *)data, "LDOM", 4) != 0 )
+	{
+		fprintf(stderr, "%s is not a binary .3do file.\n", filename);
+		return NULL;
+	}
+	CURSOR cursor = { data, size, 4, 0 };
+	CURSOR *c = &cursor;
+
+	int numMaterials = takeCount(c);
+	takeBytes(c, 32 * (size_t)numMaterials + 32 + 8);
+	int numMeshes = takeCount(c);
+
+	size_t indexSize = sizeof(MODLINDEX) + sizeof(INDEXMESH) * numMeshes;
+	MODLINDEX *index = checked_calloc(1, indexSize);
+	memcpy(index->magic, MODLINDEX_MAGIC, 8);
+	index->version = MODLINDEX_VERSION;
+	index->byteOrder = BYTE_ORDER_MARK;
+	index->headerSize = sizeof(MODLINDEX);
+	index->meshSize = sizeof(INDEXMESH);
+	index->size = indexSize;
+	index->source = *stamp;
+	index->numMaterials = numMaterials;
+	index->numMeshes = numMeshes;
+
+	index->meshesOffset = c->pos;
+	for(int i=0; i < numMeshes && !c->failed; i++)
+	{
+		indexMesh(c, &index->meshes[i]);
+	}
+
+	index->nodesOffset = c->pos;
+	takeBytes(c, 4);
+	index->numNodes = takeCount(c);
+	for(int i=0; i < index->numNodes && !c->failed; i++)
+	{
+		const unsigned char *n = takeBytes(c, NODE_FIXED_SIZE);
+		if( n == NULL ) break;
+		//parent, child and sibling ids are only present if flagged
+		if( peekInt(n + 84) != 0 ) takeBytes(c, 4);
+		if( peekInt(n + 92) != 0 ) takeBytes(c, 4);
+		if( peekInt(n + 96) != 0 ) takeBytes(c, 4);
+	}
+	index->nodesLength = c->pos - index->nodesOffset;
+
+	index->footerOffset = c->pos;
+	takeBytes(c, MODL_FOOTER_SIZE);
+	if( c->failed )
+	{
+		fprintf(stderr, "%s is truncated or corrupt.\n", filename);
+		checked_free(index);
+		return NULL;
+	}
+
+	index->hash = hash3do(data, size);
+	return index;
+}
+
+int writeModlIndex( MODLINDEX *index, char *filename )
+{
+	FILE *ofp = fopen(filename, "wb");
+	if( ofp == NULL )
+	{
+		fprintf(stderr, "Could not open %s for writing.\n", filename);
+		return -1;
+	}
+
+	int status = 0;
+	size_t written = fwrite(index, 1, index->size, ofp);
+	if( fclose(ofp) != 0 || written != index->size )
+	{
+		fprintf(stderr, "fwrite() failed to write all bytes.\n");
+		status = -1;
+	}
+
+	return status;
+}
+
+/* The count at <offset> in the file, -1 if it is out of range */
+static int countAt( const unsigned char *data, size_t size, uint64_t offset )
+{
+	if( offset > size || size - offset < 4 ) return -1;
+
+	return peekInt(data + offset);
+}
+
+/* 1 if the index holds together and agrees with the counts in the file, so every offset in it can be used without further checks */
+static int indexFits( const MODLINDEX *index, size_t indexSize, const unsigned char *data, size_t size )
+{
+	if( indexSize < sizeof(MODLINDEX) || memcmp(index->magic, MODLINDEX_MAGIC, 8) != 0 ) return 0;
+	if( index->version != MODLINDEX_VERSION || index->byteOrder != BYTE_ORDER_MARK || index->headerSize != sizeof(MODLINDEX) || index->meshSize != sizeof(INDEXMESH) ) return 0;
+	if( index->numMeshes < 0 || index->numMaterials < 0 || index->numNodes < 0 ) return 0;
+	if( index->size != indexSize || (indexSize - sizeof(MODLINDEX)) / sizeof(INDEXMESH) != (size_t)index->numMeshes ) return 0;
+	if( index->source.size != size ) return 0;
+
+	//the header, then each mesh straight after the one before
+	if( size < 8 || strncmp((const char *)data, "LDOM", 4) != 0 || countAt(data, size, 4) != index->numMaterials ) return 0;
+	if( index->meshesOffset != 4 + 4 + 32 * (uint64_t)index->numMaterials + 32 + 12 ) return 0;
+	if( countAt(data, size, index->meshesOffset - 4) != index->numMeshes ) return 0;
+	uint64_t pos = index->meshesOffset;
+	for(int i=0; i < index->numMeshes; i++)
+	{
+		const INDEXMESH *im = &index->meshes[i];
+		if( im->offset != pos || im->length > size - pos || im->length < MESH_HEADER_SIZE + MESH_FOOTER_SIZE ) return 0;
+		if( im->faceOffset < pos + MESH_HEADER_SIZE || im->faceOffset > pos + im->length || im->faceLength > pos + im->length - im->faceOffset ) return 0;
+		if( countAt(data, size, pos + MESH_COUNTS_OFFSET) != im->numVertices ) return 0;
+		if( countAt(data, size, pos + MESH_COUNTS_OFFSET + 4) != im->numTexVertices ) return 0;
+		if( countAt(data, size, pos + MESH_COUNTS_OFFSET + 8) != im->numFaces ) return 0;
+		if( im->numVertices < 0 || im->numTexVertices < 0 || im->numFaces < 0 || im->numIndices < 0 ) return 0;
+		pos += im->length;
+	}
+
+	//then the nodes and the footer to finish
+	if( index->nodesOffset != pos || countAt(data, size, pos + 4) != index->numNodes ) return 0;
+	if( index->nodesLength > size - pos || index->footerOffset != pos + index->nodesLength ) return 0;
+	if( MODL_FOOTER_SIZE > size - index->footerOffset ) return 0;
+
+	return 1;
+}
+
+MODLINDEX *readModlIndex( char *filename, const unsigned char *data, size_t size )
+{
+	char *name = indexFilename(filename);
+	MAPPEDFILE *mf = readWholeFile(name);
+	checked_free(name);
+	if( mf == NULL ) return NULL;
+
+	//it must be for this very file, unchanged since it was indexed
+	FILESTAMP now;
+	MODLINDEX *index = NULL;
+	const MODLINDEX *saved = (const MODLINDEX *)mf->data;
+	if( indexFits(saved, mf->size, data, size) && stampFile(filename, &now) == 0 && sameContents(&now, &saved->source) )
+	{
+		index = checked_malloc(mf->size);
+		memcpy(index, saved, mf->size);
+	}
+	unmapFile(mf);
+
+	return index;
+}
+
+int indexMatches( const MODLINDEX *index, const unsigned char *data, size_t size )
+{
+	return index->source.size == size && index->hash == hash3do(data, size);
+}
+
+void freeMODLINDEX( MODLINDEX *index )
+{
+	checked_free(index);
+}
@@ -0,0 +1,82 @@
+/* A small index kept alongside a .3do, saying where each of its sections starts (include fileStamp.h first, as modl.h does).
+
+The .3do format has no table of contents, so finding the nodes or the Nth mesh otherwise means stepping over every face record before it.  The index is built once by the 3doindex tool and saved next to the model (manny.3do gets manny.3do.3dx).  The readers then take the mesh offsets from it instead of walking the file, as long as it is for the file exactly as it is now.
+
+Like an image (see modlImage.h) it is only meant for the kind of machine that made it.  The header records the byte order and structure sizes and an index which doesn't match is ignored. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+//the first 8 bytes of every index
+#define MODLINDEX_MAGIC "3DOINDEX"
+#define MODLINDEX_VERSION 1
+//added to the name of the .3do for the name of its index
+#define MODLINDEX_EXT ".3dx"
+
+/* Where one mesh is in the .3do, and its counts */
+typedef struct
+{
+	//the whole mesh section
+	uint64_t offset;
+	uint64_t length;
+	//the face records within it
+	uint64_t faceOffset;
+	uint64_t faceLength;
+
+	int32_t numVertices;
+	int32_t numTexVertices;
+	int32_t numFaces;
+	//total of the faces' vertices, the length of the MESH's index arrays
+	int32_t numIndices;
+} INDEXMESH;
+
+/* The whole index, the meshes follow on from the header */
+typedef struct
+{
+	char magic[8];
+	int32_t version;
+	//0x01020304 as written by the machine that made it
+	uint32_t byteOrder;
+	int32_t headerSize;
+	int32_t meshSize;
+	//of the whole index, header included
+	uint64_t size;
+
+	//the .3do as it was when indexed, the index is only used while it is still the same
+	FILESTAMP source;
+	//FNV-1a over every byte of the .3do
+	uint64_t hash;
+
+	int32_t numMaterials;
+	int32_t numMeshes;
+	int32_t numNodes;
+	int32_t unused;
+
+	//the first mesh, the nodes section (from its count) and the footer
+	uint64_t meshesOffset;
+	uint64_t nodesOffset;
+	uint64_t nodesLength;
+	uint64_t footerOffset;
+
+	INDEXMESH meshes[];
+} MODLINDEX;
+
+/* The name of the index for the .3do <filename>, from checked_malloc() */
+char *indexFilename( const char *filename );
+
+/* FNV-1a over <size> bytes, the content hash an index records */
+uint64_t hash3do( const unsigned char *data, size_t size );
+
+/* Index the .3do held in <data> (taken from the file <stamp> describes).  Returns a block from checked_malloc(), or NULL with a message naming <filename> if it isn't a .3do or is truncated or corrupt. */
+MODLINDEX *buildModlIndex( const unsigned char *data, size_t size, const FILESTAMP *stamp, char *filename );
+
+/* Write an index to <filename>, returns 0 on success or -1 on failure */
+int writeModlIndex( MODLINDEX *index, char *filename );
+
+/* The index saved for the .3do <filename>, whose contents are the <size> bytes at <data>.  Returns NULL if there is none or it is not for the file as it is now, so the caller walks the file instead.  Only the file's stamp and the counts at each section are checked here, not the hash, so opening costs next to nothing.  read3do checks each section is as the index says as it decodes it, falling back to walking the file if not. */
+MODLINDEX *readModlIndex( char *filename, const unsigned char *data, size_t size );
+
+/* 1 if <index> has the same content hash as the <size> bytes at <data> */
+int indexMatches( const MODLINDEX *index, const unsigned char *data, size_t size );
+
+void freeMODLINDEX( MODLINDEX *index );
@@ -0,0 +1,106 @@
+/* A simple open addressed hash table from names to integers, see nameIndex.h */
+
+#include "nameIndex.h"
+#include "checkedMem.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* FNV-1a over <length> chars */
+static uint32_t hashName( const char *name, size_t length )
+{
+	uint32_t h = 2166136261u;
+	for(size_t i=0; i < length; i++)
+	{
+		h ^= (unsigned char)name[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+/* The slot holding the name, or the empty slot where it would go */
+static int findSlot( NAMEINDEX *index, const char *name, size_t length )
+{
+	int mask = index->numSlots - 1;
+	int s = hashName(name, length) & mask;
+	while( index->names[s] != NULL )
+	{
+		if( strncmp(index->names[s], name, length) == 0 && index->names[s][length] == '\0' ) break;
+		s = (s + 1) & mask;
+	}
+
+	return s;
+}
+
+NAMEINDEX *createNAMEINDEX( int expected )
+{
+	NAMEINDEX *index = checked_malloc(sizeof(NAMEINDEX));
+	index->numSlots = 16;
+	while( index->numSlots < 2 * expected ) index->numSlots *= 2;
+	index->count = 0;
+	index->names = checked_calloc(index->numSlots, sizeof(char *));
+	index->values = checked_malloc(sizeof(int) * index->numSlots);
+
+	return index;
+}
+
+/* Double the number of slots, placing everything again */
+static void growNAMEINDEX( NAMEINDEX *index )
+{
+	char **oldNames = index->names;
+	int *oldValues = index->values;
+	int oldSlots = index->numSlots;
+
+	index->numSlots *= 2;
+	index->names = checked_calloc(index->numSlots, sizeof(char *));
+	index->values = checked_malloc(sizeof(int) * index->numSlots);
+	for(int i=0; i < oldSlots; i++)
+	{
+		if( oldNames[i] == NULL ) continue;
+		int s = findSlot(index, oldNames[i], strlen(oldNames[i]));
+		index->names[s] = oldNames[i];
+		index->values[s] = oldValues[i];
+	}
+
+	checked_free(oldNames);
+	checked_free(oldValues);
+}
+
+int *nameIndexInsert( NAMEINDEX *index, const char *name, size_t length, int value )
+{
+	int s = findSlot(index, name, length);
+	if( index->names[s] == NULL )
+	{
+		if( 2 * (index->count + 1) > index->numSlots )
+		{
+			growNAMEINDEX(index);
+			s = findSlot(index, name, length);
+		}
+		index->names[s] = checked_malloc(length + 1);
+		memcpy(index->names[s], name, length);
+		index->names[s][length] = '\0';
+		index->values[s] = value;
+		index->count++;
+	}
+
+	return &index->values[s];
+}
+
+int nameIndexFind( NAMEINDEX *index, const char *name )
+{
+	int s = findSlot(index, name, strlen(name));
+
+	return index->names[s] != NULL ? index->values[s] : -1;
+}
+
+void freeNAMEINDEX( NAMEINDEX *index )
+{
+	if( index == NULL ) return;
+
+	for(int i=0; i < index->numSlots; i++) checked_free(index->names[i]);
+	checked_free(index->names);
+	checked_free(index->values);
+	checked_free(index);
+}
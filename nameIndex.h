@@ -0,0 +1,23 @@
+#include <stddef.h>
+
+/* A hash table from names to integer values (i.e the index of the thing with that name).  The names are copied in. */
+typedef struct
+{
+	//the slots, NULL if empty
+	char **names;
+	int *values;
+	//always a power of 2, kept at most half full
+	int numSlots;
+	int count;
+} NAMEINDEX;
+
+/* Create an index with room for about <expected> names before it needs to grow */
+NAMEINDEX *createNAMEINDEX( int expected );
+
+/* Find the name made of the first <length> chars of <name>, adding it with <value> if it isn't there.  Returns a pointer to the value stored for it (only valid until the next insert). */
+int *nameIndexInsert( NAMEINDEX *index, const char *name, size_t length, int value );
+
+/* The value stored for <name>, or -1 if it isn't in the index */
+int nameIndexFind( NAMEINDEX *index, const char *name );
+
+void freeNAMEINDEX( NAMEINDEX *index );
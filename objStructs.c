@@ -2,20 +2,55 @@
 #include "objStructs.h"
 #include "checkedMem.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 //the size to begin the array's in these structures
 #define INIT_ARR_SIZE 16;
 
 
 OBJ *createOBJ()
+{
+    int size = INIT_ARR_SIZE;
+    return createSizedOBJ(size);
+}
+
+//create an OBJ with room for <groupSize> groups up front (at least 1)
+OBJ *createSizedOBJ(int groupSize)
 {
     OBJ *obj = checked_malloc(sizeof(OBJ));
     obj->numGroups = 0;
-    obj->groupSize = INIT_ARR_SIZE;
+    obj->groupSize = groupSize > 0 ? groupSize : 1;
     obj->groups = checked_malloc(sizeof(GROUP *) * obj->groupSize);
 
+    obj->numMaterials = 0;
+    obj->materialSize = 16;
+    obj->materialNames = checked_malloc(sizeof(char *) * obj->materialSize);
+    obj->materialIndex = createNAMEINDEX(obj->materialSize);
+
     return obj;	
 }
 
+//the ID of a material name (its first <length> chars), adding it if this is the first time it's been seen
+int addMaterial(OBJ *obj, const char *name, size_t length)
+{
+    int *id = nameIndexInsert(obj->materialIndex, name, length, obj->numMaterials);
+    if(*id == obj->numMaterials)
+    {
+	//a new name
+	if(obj->numMaterials == obj->materialSize)
+	{
+	    obj->materialSize *= 2;
+	    obj->materialNames = checked_realloc(obj->materialNames, sizeof(char *) * obj->materialSize);
+	}
+	char *copy = checked_malloc(length + 1);
+	memcpy(copy, name, length);
+	copy[length] = '\0';
+	obj->materialNames[obj->numMaterials++] = copy;
+    }
+    return *id;
+}
+
 void growGroups(OBJ *obj)
 {
     //double the space of the groups array
@@ -25,6 +60,13 @@ void growGroups(OBJ *obj)
 }
 
 GROUP *createGROUP()
+{
+    int size = INIT_ARR_SIZE;
+    return createSizedGROUP(size, size, size, size);
+}
+
+//create a GROUP with its arrays already the given sizes (at least 1), so they never need growing if the counts are known
+GROUP *createSizedGROUP(int vertSize, int texVertSize, int normSize, int faceSize)
 {
     GROUP *group = checked_malloc(sizeof(GROUP));
 	
@@ -33,10 +75,10 @@ GROUP *createGROUP()
     group->numTexVertices = 0;
     group->numNormals = 0;
     group->numFaces = 0;
-    group->vertSize = INIT_ARR_SIZE;
-    group->texVertSize = INIT_ARR_SIZE;
-    group->normSize = INIT_ARR_SIZE;
-    group->faceSize = INIT_ARR_SIZE;
+    group->vertSize = vertSize > 0 ? vertSize : 1;
+    group->texVertSize = texVertSize > 0 ? texVertSize : 1;
+    group->normSize = normSize > 0 ? normSize : 1;
+    group->faceSize = faceSize > 0 ? faceSize : 1;
 
     group->vertices = checked_malloc(sizeof(vector3) * group->vertSize);
     group->texVertices = checked_malloc(sizeof(vector2) * group->texVertSize);
@@ -74,14 +116,71 @@ void growFaces(GROUP *group)
     return;
 }
 
-OBJFACE *createOBJFACE()
+//create an OBJFACE with room for the index triplets of <numVertices> vertices
+OBJFACE *createOBJFACE(int numVertices)
 {
     OBJFACE *objface = checked_malloc(sizeof(OBJFACE));
     objface->numVertices = 0;
-    objface->indices = checked_malloc(sizeof(indexTriplet) * MAX_VERTS_PER_FACE);
+    objface->indices = checked_malloc(sizeof(indexTriplet) * (numVertices > 0 ? numVertices : 1));
 
     return objface;
 }
 
+//move the contents of <tail> onto the end of <group>, then free what is left of <tail>
+void appendGROUP(GROUP *group, GROUP *tail)
+{
+    while(group->numVertices + tail->numVertices > group->vertSize) growVertices(group);
+    while(group->numTexVertices + tail->numTexVertices > group->texVertSize) growTexVertices(group);
+    while(group->numNormals + tail->numNormals > group->normSize) growNormals(group);
+    while(group->numFaces + tail->numFaces > group->faceSize) growFaces(group);
+
+    memcpy(group->vertices + group->numVertices, tail->vertices, sizeof(vector3) * tail->numVertices);
+    memcpy(group->texVertices + group->numTexVertices, tail->texVertices, sizeof(vector2) * tail->numTexVertices);
+    memcpy(group->normals + group->numNormals, tail->normals, sizeof(vector3) * tail->numNormals);
+    //the faces themselves now belong to <group>
+    memcpy(group->faces + group->numFaces, tail->faces, sizeof(OBJFACE *) * tail->numFaces);
+
+    group->numVertices += tail->numVertices;
+    group->numTexVertices += tail->numTexVertices;
+    group->numNormals += tail->numNormals;
+    group->numFaces += tail->numFaces;
+
+    tail->numFaces = 0;
+    freeGROUP(tail);
+    return;
+}
 
+//free a GROUP and all of its faces
+void freeGROUP(GROUP *group)
+{
+    for(int i=0; i < group->numFaces; i++)
+    {
+	checked_free(group->faces[i]->indices);
+	checked_free(group->faces[i]);
+    }
+    checked_free(group->faces);
+    checked_free(group->vertices);
+    checked_free(group->texVertices);
+    checked_free(group->normals);
+    checked_free(group->groupName);
+    checked_free(group);
+    return;
+}
 
+//free an OBJ and all of its groups
+void freeOBJ(OBJ *obj)
+{
+    for(int i=0; i < obj->numGroups; i++)
+    {
+	freeGROUP(obj->groups[i]);
+    }
+    checked_free(obj->groups);
+    for(int i=0; i < obj->numMaterials; i++)
+    {
+	checked_free(obj->materialNames[i]);
+    }
+    checked_free(obj->materialNames);
+    freeNAMEINDEX(obj->materialIndex);
+    checked_free(obj);
+    return;
+}
@@ -1,15 +1,13 @@
-//the most number of vertices we will see in a single face
-#define MAX_VERTS_PER_FACE 8
-
 #include "vector.h"
+#include "nameIndex.h"
 typedef int indexTriplet[3];
 
 typedef struct
 {
     int numVertices;
     indexTriplet *indices;
-	//need to add a material index of some sort here, and update it while read in the .obj file	
-    char *materialName; 
+    //the material named by the last usemtl line, an index into the OBJ's materialNames
+    int materialID;
 } OBJFACE;
 
 
@@ -52,16 +50,30 @@ typedef struct
     //number of groups we have allocated space for
     int groupSize;
     GROUP **groups;
+
+    //every distinct usemtl name, each stored once
+    int numMaterials;
+    //number of names we have allocated space for
+    int materialSize;
+    char **materialNames;
+    //looks up the ID of a name
+    NAMEINDEX *materialIndex;
 } OBJ;
 
 OBJ *createOBJ();
+OBJ *createSizedOBJ(int groupSize);
 void growGroups(OBJ *obj);
+void freeOBJ(OBJ *obj);
+int addMaterial(OBJ *obj, const char *name, size_t length);
 
 GROUP *createGROUP();
+GROUP *createSizedGROUP(int vertSize, int texVertSize, int normSize, int faceSize);
 void growVertices(GROUP *group);
 void growTexVertices(GROUP *group);
 void growNormals(GROUP *group);
 void growFaces(GROUP *group);
+void appendGROUP(GROUP *group, GROUP *tail);
+void freeGROUP(GROUP *group);
 
-OBJFACE *createOBJFACE();
+OBJFACE *createOBJFACE(int numVertices);
 
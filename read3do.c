@@ -1,353 +1,717 @@
-/* Contains functions for reading a .3do model file into a MODL structure (see modl.h and modl.c) */
+/* Contains functions for reading a .3do model file into a MODL structure (see modl.h and modl.c)
 
-#include "modl.h" //lets us use structures 
+The whole file is brought into memory first (see mapFile.h) and decoded from there.  A sizing pass walks the file to total up the memory the MODL will need, so that the entire model can then be placed in a single ARENA block (see checkedMem.h) and released with one checked_free().
+
+The sizing pass also notes where each mesh starts and how much of the arena it takes, so once the block is allocated every mesh can be decoded on its own.  For larger files the meshes are shared out between threads, each decoding into its own slice of the arena, which leaves the MODL exactly as decoding them in order would.
+
+read3doLazy() decodes just the header of the meshes that aren't wanted yet and keeps the file mapped, and loadMesh() decodes the rest of one into its slice whenever it is needed.  The slices of meshes never loaded are never touched, so cost next to nothing. */
+
+//pthreads and sysconf() are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include "modl.h" //lets us use structures
+#include "meshFilter.h"
 #include "read3do.h"
+#include "modlImage.h" //or a flat image of one
+#include "modlIndex.h" //with an index to skip the sizing pass
 #include "checkedMem.h" //checked memory allocators
+#include "mapFile.h" //whole file in memory
+#include "cursor.h" //stepping through it
+#include "stats.h"
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h> //for strndup, may need to declare it as well, also strncmp
+#include <string.h> //for strncmp
+#include <pthread.h>
+#include <unistd.h>
+
+#define MIN_THREAD_BYTES (1 << 18)	//files are not decoded on more threads than they have this many bytes
+#define MAX_DECODE_THREADS 64
+
+//number of threads to decode meshes with, 0 for one per processor
+static int decodeThreads = 0;
+
+/* Where the sizing pass found a mesh, and the space in the arena decoding it takes */
+typedef struct
+{
+	size_t offset;
+	size_t arenaSize;
+} MESHSPAN;
+
+/* Copy the next <n> bytes into a fresh piece of the arena, NULL if there are none */
+void *takeArray( CURSOR *c, ARENA *a, size_t n )
+{
+	if( n == 0 ) return NULL;
 
-//extern char *strndup(const char *s, size_t n);
-//windows couldn't find strndup so use this instead
-char *mystrndup(const char *s, size_t n)
+	void *dest = arenaAlloc(a, n);
+	takeBlock(c, dest, n);
+
+	return dest;
+}
+
+/* Copy the next <numBytes> byte string into the arena.  Should be terminated within the .3do file but add a terminator just in case. */
+char *takeString( CURSOR *c, ARENA *a, size_t numBytes )
 {
-	//allocate memory (n chars plus a terminating byte)
-	char *r = checked_malloc(sizeof(char) * (n+1));
-	strncpy(r, s, n);
-	//should be terminated within the .3do file but just in case
-	r[n] = '\0';
+	char *s = arenaAlloc(a, numBytes + 1);
+	strncpy(s, (const char *)takeBytes(c, numBytes), numBytes);
+	s[numBytes] = '\0';
 
-	return r;
+	return s;
 }
 
 
-/* Delegates to fread but checks for failure, reports and terminates. */
-size_t checked_fread(void *ptr, size_t size, size_t nmemb, FILE *stream)
+/* SIZING PASS: step over each section, totalling the arena space decoding it will use.  These must mirror the decodeXXXX() functions below exactly.  They are also what finds truncated or corrupt data, leaving the cursor failed. */
+
+/* Step over a face, returning the number of vertices it has (the entries it needs in each of the mesh's index arrays) */
+int sizeFace( CURSOR *c )
 {
-	size_t numRead = fread(ptr, size, nmemb, stream);
-	if( numRead != nmemb )
-	{
-		if( feof(stream) ) 
-		{
-			fprintf(stderr, "fread() hit end of file unexpectedly.\n");
-		}
-		else 
-			fprintf(stderr, "fread() failed to read all bytes.\n");
+	const unsigned char *h = takeBytes(c, FACE_HEADER_SIZE);
+	if( h == NULL ) return 0;
+	int numVertices = checkCount(c, peekInt(h + 20));
+	int hasTexture = peekInt(h + 28);
+	int hasMaterial = peekInt(h + 32);
+
+	takeBytes(c, sizeof(int) * numVertices);
+	if( hasTexture != 0 ) takeBytes(c, sizeof(int) * numVertices);
+	if( hasMaterial != 0 ) takeBytes(c, 4);
+
+	return numVertices;
+}
 
-		exit(EXIT_FAILURE);
+/* Total the index entries of the next <numFaces> faces, leaving the cursor where it is */
+int countFaceIndices( CURSOR c, int numFaces )
+{
+	int total = 0;
+	for(int i=0; i < numFaces; i++)
+	{
+		total += sizeFace(&c);
 	}
-	//pass on return value of fread for transparency
-	return numRead;
+
+	return total;
 }
 
-/* Read and allocate memory for a string from a file.  When rewriting to a 3do how will short strings be handled, '\0' for remaining bytes? */
-char *readString( FILE *ifp, size_t numBytes )
+/* The arena space a mesh with these counts takes */
+size_t meshArenaSize( int numVertices, int numTexVertices, int numFaces, int numIndices )
 {
-	char buffer[numBytes];
-	checked_fread(buffer, 1, numBytes, ifp);
-	
-	char *s = mystrndup(buffer, numBytes);
-	if( s == NULL )
+	size_t size = ARENA_ROUND(sizeof(MESH)) + ARENA_ROUND(32 + 1);
+
+	//vertices, light data, unknown2 then (after the faces) normals
+	size_t perVertex[4] = { sizeof(vector3), sizeof(float), sizeof(int), sizeof(vector3) };
+	if( numVertices != 0 )
 	{
-		fprintf(stderr, "strndup() failed.\n");
-		exit(EXIT_FAILURE);
+		for(int i=0; i < 4; i++) size += ARENA_ROUND(perVertex[i] * numVertices);
 	}
+	if( numTexVertices != 0 ) size += ARENA_ROUND(sizeof(vector2) * numTexVertices);
 
-	return s;
+	//the face attribute array, the offsets (always present) and the two index arrays
+	size += ARENA_ROUND(sizeof(FACE) * numFaces);
+	size += ARENA_ROUND(sizeof(int) * (numFaces + 1));
+	if( numIndices != 0 ) size += 2 * ARENA_ROUND(sizeof(int) * numIndices);
+
+	return size;
 }
 
-/* Read a single 4 byte integer from the file and return the value. */
-int readInt(FILE *ifp)
+size_t sizeMesh( CURSOR *c )
 {
-	int result;
-	checked_fread(&result, 4, 1, ifp);
+	//name and the first 4 ints, the counts make up the rest of the header
+	takeBytes(c, MESH_HEADER_SIZE - 12);
+	int numVertices = takeCount(c);
+	int numTexVertices = takeCount(c);
+	int numFaces = takeCount(c);
+
+	takeBytes(c, (sizeof(vector3) + sizeof(float) + sizeof(int)) * numVertices);
+	takeBytes(c, sizeof(vector2) * numTexVertices);
+	int numIndices = 0;
+	for(int i=0; i < numFaces && !c->failed; i++)
+	{
+		numIndices += sizeFace(c);
+	}
+	takeBytes(c, sizeof(vector3) * numVertices);
+	takeBytes(c, MESH_FOOTER_SIZE);
 
-	return result;
+	return meshArenaSize(numVertices, numTexVertices, numFaces, numIndices);
 }
 
-float readFloat(FILE *ifp)
+//the arena space each node takes
+#define NODE_ARENA_SIZE (ARENA_ROUND(sizeof(NODE)) + ARENA_ROUND(64 + 1))
+
+size_t sizeNode( CURSOR *c )
 {
-	float result;
-	checked_fread(&result, 4, 1, ifp);
-	
-	return result;
+	const unsigned char *n = takeBytes(c, NODE_FIXED_SIZE);
+	if( n == NULL ) return 0;
+	//parent, child and sibling ids are only present if flagged
+	if( peekInt(n + 84) != 0 ) takeBytes(c, 4);	//hasParent
+	if( peekInt(n + 92) != 0 ) takeBytes(c, 4);	//hasChildren
+	if( peekInt(n + 96) != 0 ) takeBytes(c, 4);	//hasSibling
+
+	return NODE_ARENA_SIZE;
 }
 
-/* Creates a new FACE structure and reads the face section of a .3do file into it. */
-FACE *readFace( FILE *ifp )
+/* Total the arena space needed for the whole file, the cursor is left failed if the file is truncated or corrupt.  Where each mesh is goes in <*spans>, which the caller frees. */
+size_t size3do( CURSOR *c, MESHSPAN **spans )
 {
-	//create a new FACE structure to return
-	FACE *face = createFACE();
-
-	//fill it in
-	face->faceID = readInt(ifp);
-	face->faceType = readInt(ifp);
-	face->geometryMode = readInt(ifp);
-	face->lightingMode = readInt(ifp);
-	face->textureMode = readInt(ifp);
-	face->numVertices = readInt(ifp);
-	face->unknown1 = readInt(ifp);
-	face->hasTexture = readInt(ifp);
-	face->hasMaterial = readInt(ifp);
-	//read 3 floats into a vector3
-	checked_fread(face->unknown2, 4, 3, ifp);
-	face->extraLight = readFloat(ifp);
-	checked_fread(face->unknown3, 4, 3, ifp);
-	checked_fread(face->faceNormal, 4, 3, ifp);
-
-	//allocate memory for the vertex indices (could there be none?) and texture vertex indices
-	if( face->numVertices != 0 )
+	size_t size = ARENA_ROUND(sizeof(MODL));
+
+	takeBytes(c, 4);
+	int numMaterials = takeCount(c);
+	takeBytes(c, 32 * (size_t)numMaterials);
+	size += ARENA_ROUND(sizeof(char *) * numMaterials);
+	size += ARENA_ROUND(32 + 1) * numMaterials;
+
+	takeBytes(c, 32);
+	size += ARENA_ROUND(32 + 1);
+
+	takeBytes(c, 8);
+	int numMeshes = takeCount(c);
+	size += ARENA_ROUND(sizeof(MESH *) * numMeshes);
+	*spans = checked_malloc(sizeof(MESHSPAN) * (numMeshes + 1));
+	for(int i=0; i < numMeshes && !c->failed; i++)
 	{
-		face->vertexIndices = checked_malloc( sizeof(int) * face->numVertices );
-		for(int i=0; i < face->numVertices; i++)
-		{
-			face->vertexIndices[i] = readInt(ifp);
-		}
-
+		(*spans)[i].offset = c->pos;
+		(*spans)[i].arenaSize = sizeMesh(c);
+		size += (*spans)[i].arenaSize;
 	}
+	//and where the meshes end
+	(*spans)[numMeshes].offset = c->pos;
 
-	//allocate memory for the texture vertex indices (must have a texture for this)
-	if( face->numVertices != 0 && face->hasTexture != 0 )
-	{
-		face->texVertexIndices = checked_malloc(sizeof(int) * face->numVertices);
-		for(int i=0; i < face->numVertices; i++)
-		{
-			face->texVertexIndices[i] = readInt(ifp);
-		}
-	}
-	
-	//if <hasMaterial> there will be a material index
-	if( face->hasMaterial != 0 )
+	takeBytes(c, 4);
+	int numNodes = takeCount(c);
+	size += ARENA_ROUND(sizeof(NODE *) * numNodes);
+	for(int i=0; i < numNodes && !c->failed; i++)
 	{
-		face->materialIndex = readInt(ifp);
+		size += sizeNode(c);
 	}
-	
-	//done, return the pointer the structure
-	return face;
+
+	takeBytes(c, MODL_FOOTER_SIZE);
+
+	return size;
 }
 
-/* Creates a new MESH structure and read the mesh section of a .3do into it. */
-MESH *readMesh( FILE *ifp )
+/* The same as size3do() but taking the meshes from an index (see modlIndex.h) rather than stepping over every face.  The nodes are few, so they are still stepped through from <c>, which fails if they aren't as the index says.  Each mesh is checked against its span as it is decoded (see decodeMeshAt()). */
+size_t size3doIndexed( CURSOR *c, const MODLINDEX *index, MESHSPAN **spans )
 {
-	//create a new MESH structure to return
-	MESH *mesh = createMESH();
-
-	//fill it in
-	mesh->meshName = readString(ifp, 32);
-	mesh->unknown1 = readInt(ifp);
-	mesh->geometryMode = readInt(ifp);
-	mesh->lightingMode = readInt(ifp);
-	mesh->textureMode = readInt(ifp);
-	mesh->numVertices = readInt(ifp);
-	mesh->numTexVertices = readInt(ifp);
-	mesh->numFaces = readInt(ifp);
-
-	//allocate memory for the mesh vertex data array (unless no vertices)
-	if( mesh->numVertices != 0 )
+	size_t size = ARENA_ROUND(sizeof(MODL));
+	size += ARENA_ROUND(sizeof(char *) * index->numMaterials);
+	size += ARENA_ROUND(32 + 1) * index->numMaterials;
+	size += ARENA_ROUND(32 + 1);
+
+	size += ARENA_ROUND(sizeof(MESH *) * index->numMeshes);
+	*spans = checked_malloc(sizeof(MESHSPAN) * (index->numMeshes + 1));
+	for(int i=0; i < index->numMeshes; i++)
 	{
-		mesh->vertices = checked_malloc( sizeof(vector3) * mesh->numVertices );
-		//read in the data
-		for(int i=0; i < mesh->numVertices; i++)
-		{
-			//read 3 floats into a vector3
-			checked_fread(mesh->vertices[i], 4, 3, ifp);
-		}
+		const INDEXMESH *im = &index->meshes[i];
+		(*spans)[i].offset = im->offset;
+		(*spans)[i].arenaSize = meshArenaSize(im->numVertices, im->numTexVertices, im->numFaces, im->numIndices);
+		size += (*spans)[i].arenaSize;
 	}
-
-	//allocate memory for the texture vertex data array (unless no texture vertices)
-	if( mesh->numTexVertices != 0 )
+	(*spans)[index->numMeshes].offset = index->nodesOffset;
+
+	c->pos = index->nodesOffset;
+	takeBytes(c, 4);
+	int numNodes = takeCount(c);
+	if( numNodes != index->numNodes ) failCursor(c);
+	size += ARENA_ROUND(sizeof(NODE *) * numNodes);
+	for(int i=0; i < numNodes && !c->failed; i++)
 	{
-		mesh->texVertices = checked_malloc( sizeof(vector2) * mesh->numTexVertices );
-		//read in the data
-		for(int i=0; i < mesh->numTexVertices; i++)
-		{
-			//read 2 flots into a vector2
-			checked_fread(mesh->texVertices[i], 4, 2, ifp);
-		}
+		size += sizeNode(c);
 	}
+	takeBytes(c, MODL_FOOTER_SIZE);
 
-	//allocate memory for the extra light data array (unless no vertices)
-	if( mesh->numVertices != 0 )
+	return size;
+}
+
+
+/* DECODING: fill in the structures, carving all their memory out of the arena */
+
+/* Decodes the face section of a .3do into face <i> of the mesh, the faces before it must already be decoded. */
+void decodeFace( CURSOR *c, MESH *mesh, int i )
+{
+	FACE *face = &mesh->faces[i];
+
+	face->faceID = takeInt(c);
+	face->faceType = takeInt(c);
+	face->geometryMode = takeInt(c);
+	face->lightingMode = takeInt(c);
+	face->textureMode = takeInt(c);
+	face->numVertices = takeInt(c);
+	face->unknown1 = takeInt(c);
+	face->hasTexture = takeInt(c);
+	face->hasMaterial = takeInt(c);
+	takeBlock(c, face->unknown2, 12);
+	face->extraLight = takeFloat(c);
+	takeBlock(c, face->unknown3, 12);
+	takeBlock(c, face->faceNormal, 12);
+
+	//the index lists are copied as whole blocks onto the end of the mesh's index arrays
+	int start = mesh->faceOffsets[i];
+	size_t indexBytes = sizeof(int) * face->numVertices;
+	mesh->faceOffsets[i+1] = start + face->numVertices;
+	if( indexBytes != 0 )
 	{
-		mesh->lightData = checked_malloc( sizeof(float) * mesh->numVertices );
-		for(int i=0; i < mesh->numVertices; i++)
-		{
-			//read in 1 float
-			mesh->lightData[i] = readFloat(ifp);
-		}
+		takeBlock(c, mesh->faceVertexIndices + start, indexBytes);
+		if( face->hasTexture != 0 )
+			takeBlock(c, mesh->faceTexVertexIndices + start, indexBytes);
+		else
+			memset(mesh->faceTexVertexIndices + start, 0, indexBytes);
 	}
 
-	//allocate memory for unknown data, 4 bytes per vertice
-	if( mesh->numVertices != 0 )
+	if( face->hasMaterial != 0 )
 	{
-		mesh->unknown2 = checked_malloc( sizeof(int) * mesh->numVertices );
-		for(int i=0; i < mesh->numVertices; i++)
-		{
-			mesh->unknown2[i] = readInt(ifp);
-		}
+		face->materialIndex = takeInt(c);
 	}
 
-	//allocate memory for the face data (unless no faces)
-	if( mesh->numFaces != 0 )
-	{
-		mesh->faces = checked_malloc( sizeof(FACE *) * mesh->numFaces );
-		for(int i=0; i < mesh->numFaces; i++)
-		{
-			mesh->faces[i] = readFace(ifp);
-		}
+	return;
+}
 
+/* Places a new MESH structure in the arena and decodes the mesh section of a .3do into it, the per vertex arrays are each copied with a single memcpy() */
+MESH *decodeMesh( CURSOR *c, ARENA *a )
+{
+	MESH *mesh = arenaAlloc(a, sizeof(MESH));
+	mesh->sourceOffset = c->pos;
+	mesh->pending = 0;
+	mesh->unwanted = 0;
+
+	mesh->meshName = takeString(c, a, 32);
+	mesh->unknown1 = takeInt(c);
+	mesh->geometryMode = takeInt(c);
+	mesh->lightingMode = takeInt(c);
+	mesh->textureMode = takeInt(c);
+	mesh->numVertices = takeInt(c);
+	mesh->numTexVertices = takeInt(c);
+	mesh->numFaces = takeInt(c);
+
+	mesh->vertices = takeArray(c, a, sizeof(vector3) * mesh->numVertices);
+	mesh->texVertices = takeArray(c, a, sizeof(vector2) * mesh->numTexVertices);
+	mesh->lightData = takeArray(c, a, sizeof(float) * mesh->numVertices);
+	mesh->unknown2 = takeArray(c, a, sizeof(int) * mesh->numVertices);
+
+	//the face records vary in length, so peek ahead to size the flat index arrays
+	int numIndices = countFaceIndices(*c, mesh->numFaces);
+	mesh->faces = arenaAlloc(a, sizeof(FACE) * mesh->numFaces);
+	mesh->faceOffsets = arenaAlloc(a, sizeof(int) * (mesh->numFaces + 1));
+	mesh->faceOffsets[0] = 0;
+	mesh->faceVertexIndices = NULL;
+	mesh->faceTexVertexIndices = NULL;
+	if( numIndices != 0 )
+	{
+		mesh->faceVertexIndices = arenaAlloc(a, sizeof(int) * numIndices);
+		mesh->faceTexVertexIndices = arenaAlloc(a, sizeof(int) * numIndices);
 	}
-
-	//allocate memory for the vertex normals
-	if( mesh->numVertices != 0 )
+	for(int i=0; i < mesh->numFaces; i++)
 	{
-		mesh->normals = checked_malloc( sizeof(vector3) * mesh->numVertices );
-		for(int i=0; i < mesh->numVertices; i++)
-		{
-			//read 3 floats into a vector3
-			checked_fread(mesh->normals[i], 4, 3, ifp);
-		}
+		decodeFace(c, mesh, i);
 	}
 
-	mesh->hasShadow = readInt(ifp);
-	mesh->unknown3 = readInt(ifp);
-	mesh->meshRadius = readFloat(ifp);
-	checked_fread(mesh->unknown4, 4, 3, ifp);
-	checked_fread(mesh->unknown5, 4, 3, ifp);
+	mesh->normals = takeArray(c, a, sizeof(vector3) * mesh->numVertices);
+
+	mesh->hasShadow = takeInt(c);
+	mesh->unknown3 = takeInt(c);
+	mesh->meshRadius = takeFloat(c);
+	takeBlock(c, mesh->unknown4, 12);
+	takeBlock(c, mesh->unknown5, 12);
+	mesh->sourceLength = c->pos - mesh->sourceOffset;
 
-	//all done, return the pointer to this MESH structure
 	return mesh;
 }
 
+/* Places a new MESH structure in the arena with only the header of the <length> byte mesh section decoded (and the footer, from the end of the section).  The arrays are left NULL until loadMesh(). */
+MESH *decodeMeshHeader( CURSOR *c, ARENA *a, size_t length )
+{
+	MESH *mesh = arenaAlloc(a, sizeof(MESH));
+	mesh->sourceOffset = c->pos;
+	mesh->sourceLength = length;
+	mesh->pending = 1;
+	mesh->unwanted = 0;
+
+	mesh->meshName = takeString(c, a, 32);
+	mesh->unknown1 = takeInt(c);
+	mesh->geometryMode = takeInt(c);
+	mesh->lightingMode = takeInt(c);
+	mesh->textureMode = takeInt(c);
+	mesh->numVertices = takeInt(c);
+	mesh->numTexVertices = takeInt(c);
+	mesh->numFaces = takeInt(c);
+
+	mesh->vertices = NULL;
+	mesh->texVertices = NULL;
+	mesh->lightData = NULL;
+	mesh->unknown2 = NULL;
+	mesh->faces = NULL;
+	mesh->faceOffsets = NULL;
+	mesh->faceVertexIndices = NULL;
+	mesh->faceTexVertexIndices = NULL;
+	mesh->normals = NULL;
+
+	c->pos = mesh->sourceOffset + length - MESH_FOOTER_SIZE;
+	mesh->hasShadow = takeInt(c);
+	mesh->unknown3 = takeInt(c);
+	mesh->meshRadius = takeFloat(c);
+	takeBlock(c, mesh->unknown4, 12);
+	takeBlock(c, mesh->unknown5, 12);
 
-/* Creates a new NODE structure and reads the node section of a .3do file into it. */
-NODE *readNode( FILE *ifp )
+	return mesh;
+}
+
+/* Places a new NODE structure in the arena and decodes the node section of a .3do into it. */
+NODE *decodeNode( CURSOR *c, ARENA *a )
 {
-	//create a new node structure to return
-	NODE *node = createNODE();
-
-	//fill it
-	node->name = readString(ifp, 64);
-	node->flags = readInt(ifp);
-	node->unknown1 = readInt(ifp);
-	node->type = readInt(ifp);
-	node->meshID = readInt(ifp);
-	node->depth = readInt(ifp);
-	node->hasParent = readInt(ifp);
-	node->numChildren = readInt(ifp);
-	node->hasChildren = readInt(ifp);
-	node->hasSibling = readInt(ifp);
-	//read some vector3's
-	checked_fread(node->pivot, 4, 3, ifp);
-	checked_fread(node->position, 4, 3, ifp);
-	//read some floats
-	node->pitch = readFloat(ifp);
-	node->yaw = readFloat(ifp);
-	node->roll = readFloat(ifp);
-	//read 48 unknown bytes
-	checked_fread(node->unknown2, 4, 12, ifp);
-	if( node->hasParent != 0 ) 
-		node->parentID = readInt(ifp);
+	NODE *node = arenaAlloc(a, sizeof(NODE));
+	node->sourceOffset = c->pos;
+
+	node->name = takeString(c, a, 64);
+	node->flags = takeInt(c);
+	node->unknown1 = takeInt(c);
+	node->type = takeInt(c);
+	node->meshID = takeInt(c);
+	node->depth = takeInt(c);
+	node->hasParent = takeInt(c);
+	node->numChildren = takeInt(c);
+	node->hasChildren = takeInt(c);
+	node->hasSibling = takeInt(c);
+	takeBlock(c, node->pivot, 12);
+	takeBlock(c, node->position, 12);
+	node->pitch = takeFloat(c);
+	node->yaw = takeFloat(c);
+	node->roll = takeFloat(c);
+	takeBlock(c, node->unknown2, 48);
+	if( node->hasParent != 0 )
+		node->parentID = takeInt(c);
 	if( node->hasChildren != 0 )
-		node->childID = readInt(ifp);
+		node->childID = takeInt(c);
 	if( node->hasSibling != 0 )
-		node->siblingID = readInt(ifp);
+		node->siblingID = takeInt(c);
+	node->sourceLength = c->pos - node->sourceOffset;
 
-	//all done, return a pointer to this NODE structure
 	return node;
 }
 
+/* The meshes of one model being decoded, maybe by several threads */
+typedef struct
+{
+	const unsigned char *data;
+	size_t size;
+	MESHSPAN *spans;
+	//if set only the meshes <filter> lets through are decoded in full, the rest are left pending
+	int lazy;
+	//set if the spans came from an index, so each mesh must be checked to be what its span says before decoding it
+	int checkSpans;
+	const MESHFILTER *filter;
+	//the start of each mesh's slice of the arena, worked out from the spans
+	char **slices;
+	MESH **meshes;
+	int numMeshes;
+
+	pthread_mutex_t lock;
+	//the next mesh not yet taken by a thread
+	int next;
+} MESHDECODER;
+
+/* Decode mesh <i> into its own slice of the arena, leaving it NULL if it doesn't fit its span */
+void decodeMeshAt( MESHDECODER *d, int i )
+{
+	CURSOR cursor = { d->data, d->size, d->spans[i].offset, 0 };
+	ARENA slice = { d->slices[i], d->spans[i].arenaSize, 0 };
+	if( d->checkSpans )
+	{
+		//every face record must lie within the span, and need exactly the slice reserved for it
+		CURSOR sizing = { d->data, d->spans[i+1].offset, d->spans[i].offset, 0 };
+		if( sizeMesh(&sizing) != d->spans[i].arenaSize || sizing.failed || sizing.pos != d->spans[i+1].offset )
+		{
+			d->meshes[i] = NULL;
+			return;
+		}
+	}
+	if( d->lazy )
+	{
+		//the name decides whether it is wanted now
+		MESH *mesh = decodeMeshHeader(&cursor, &slice, d->spans[i+1].offset - d->spans[i].offset);
+		d->meshes[i] = mesh;
+		if( d->filter == NULL || !meshWanted(d->filter, mesh->meshName) ) return;
+
+		//over the top of the header, in the same place
+		cursor.pos = d->spans[i].offset;
+		slice.used = 0;
+	}
+	d->meshes[i] = decodeMesh(&cursor, &slice);
+}
 
-/* Reads the .3do file given as an argument into a MODL structure and returns a pointer to it.  If the process fails it returns NULL. */
-MODL *read3do( char *filename )
+/* Take meshes one at a time until there are none left (also a pthread start routine) */
+void *meshWorker( void *arg )
 {
-	//open the file for reading and ensure success
-	//note b not needed in linux, but caused fread to hit eof early on windows
-	FILE *ifp = fopen( filename, "rb" );
-	if( ifp == NULL )
+	MESHDECODER *d = arg;
+
+	pthread_mutex_lock(&d->lock);
+	while( d->next < d->numMeshes )
 	{
-		printf("File %s could not be opened.\n", filename);
-		return NULL;
+		int i = d->next++;
+		pthread_mutex_unlock(&d->lock);
+		decodeMeshAt(d, i);
+		pthread_mutex_lock(&d->lock);
+	}
+	pthread_mutex_unlock(&d->lock);
+
+	return NULL;
+}
+
+/* Decode the meshes found by the sizing pass into the arena, which must be just past the MESH pointer array.  Spread over threads if the file is big enough, the arena ends up the same either way. */
+void decodeMeshes( MESHDECODER *d, ARENA *a )
+{
+	//each mesh's slice follows on from the one before
+	d->slices = checked_malloc(sizeof(char *) * (d->numMeshes + 1));
+	for(int i=0; i < d->numMeshes; i++)
+	{
+		d->slices[i] = a->base + a->used;
+		a->used += d->spans[i].arenaSize;
+	}
+	d->next = 0;
+
+	int numThreads = decodeThreads;
+	if( numThreads <= 0 ) numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if( (size_t)numThreads > d->size / MIN_THREAD_BYTES ) numThreads = (int)(d->size / MIN_THREAD_BYTES);
+	if( numThreads > d->numMeshes ) numThreads = d->numMeshes;
+	if( numThreads > MAX_DECODE_THREADS ) numThreads = MAX_DECODE_THREADS;
+
+	if( numThreads <= 1 )
+	{
+		//in order on this thread
+		for(int i=0; i < d->numMeshes; i++)
+		{
+			decodeMeshAt(d, i);
+		}
+		checked_free(d->slices);
+		return;
 	}
 
-	//create a new MODL structure to return
-	MODL *model = createMODL();
+	//this thread decodes along with the rest
+	pthread_mutex_init(&d->lock, NULL);
+	pthread_t threads[MAX_DECODE_THREADS];
+	int numStarted = 0;
+	for(int i=1; i < numThreads; i++)
+	{
+		if( pthread_create(&threads[numStarted], NULL, meshWorker, d) == 0 ) numStarted++;
+	}
+	meshWorker(d);
+	for(int i=0; i < numStarted; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	pthread_mutex_destroy(&d->lock);
+	checked_free(d->slices);
+}
+
+/* Set how many threads read3do() may decode meshes with, 0 (the default) for one per processor and 1 to decode serially */
+void setDecodeThreads( int numThreads )
+{
+	decodeThreads = numThreads > 0 ? numThreads : 0;
+}
+
+/* Decode a whole .3do held in memory into a MODL structure living in a single arena block.  If <lazy> is set only the meshes <filter> lets through are decoded in full, leaving the rest pending.  With an <index> for the data the sizing pass over the file is skipped.  Returns NULL if it is not a .3do file or is truncated or corrupt. */
+MODL *decode3do( const unsigned char *data, size_t size, char *filename, int lazy, const MESHFILTER *filter, const MODLINDEX *index )
+{
+	CURSOR cursor = { data, size, 0, 0 };
+	CURSOR *c = &cursor;
 
 	/* HEADER */
 
-	//read in the fourcc code and check it is the right type of file
-	checked_fread(model->fourcc, 1, 4, ifp);
-	if( strncmp(model->fourcc, "LDOM", 4) != 0 )
+	//check the fourcc code before anything else, it is the right type of file
+	if( size < 4 || strncmp((const char *)data, "LDOM", 4) != 0 )
 	{
 		fprintf(stderr, "%s is not a binary .3do file.\n", filename);
 		return NULL;
 	}
-	
-	model->numMaterials = readInt(ifp);
 
-	//allocate memory for the array of character pointers, and read material names
-	model->materialNames = checked_malloc( sizeof(char *) * model->numMaterials);
+	//size up the whole model (checking it is all there) and allocate it in one go
+	CURSOR sizing = cursor;
+	MESHSPAN *spans;
+	size_t arenaSize = index != NULL ? size3doIndexed(&sizing, index, &spans) : size3do(&sizing, &spans);
+	if( sizing.failed && index != NULL )
+	{
+		fprintf(stderr, "The index of %s doesn't match it, reading it without.\n", filename);
+		checked_free(spans);
+		return decode3do(data, size, filename, lazy, filter, NULL);
+	}
+	if( sizing.failed )
+	{
+		fprintf(stderr, "%s is truncated or corrupt.\n", filename);
+		checked_free(spans);
+		return NULL;
+	}
+	ARENA arena;
+	arenaInit(&arena, arenaSize);
+	ARENA *a = &arena;
+
+	MODL *model = arenaAlloc(a, sizeof(MODL));
+	model->arena = arena.base;
+	model->arenaSize = arena.size;
+	//filled in by load3do(), which knows where the data came from
+	model->sourceFile = NULL;
+	model->mapping = NULL;
+
+	takeBlock(c, model->fourcc, 4);
+	model->numMaterials = takeInt(c);
+
+	model->materialNames = arenaAlloc(a, sizeof(char *) * model->numMaterials);
 	for(int i=0; i < model->numMaterials; i++)
 	{
-		model->materialNames[i] = readString(ifp, 32);
+		model->materialNames[i] = takeString(c, a, 32);
 	}
 
-	model->modelName = readString(ifp, 32);
+	model->modelName = takeString(c, a, 32);
 
 	/* GEOSET */
 
-	model->unknown1 = readInt(ifp);
-	model->numGeosets = readInt(ifp);
+	model->unknown1 = takeInt(c);
+	model->numGeosets = takeInt(c);
 	//normally only one geoset, alert if different
 	if(model->numGeosets != 1)
 	{
 		fprintf(stderr, "More than one geoset in this file!\n");
 		fprintf(stderr, "Probably won't work!\n");
 	}
-	model->numMeshes = readInt(ifp);
+	model->numMeshes = takeInt(c);
 
-	//allocate memory for the array of MESH pointers, and read them in
-	model->meshes = checked_malloc( sizeof(MESH *) * model->numMeshes);
+	model->meshes = arenaAlloc(a, sizeof(MESH *) * model->numMeshes);
+	MESHDECODER d = { data, size, spans, lazy, index != NULL, filter, NULL, model->meshes, model->numMeshes };
+	decodeMeshes(&d, a);
 	for(int i=0; i < model->numMeshes; i++)
 	{
-		model->meshes[i] = readMesh(ifp);
+		if( model->meshes[i] != NULL ) continue;
+		fprintf(stderr, "The index of %s doesn't match it, reading it without.\n", filename);
+		checked_free(spans);
+		checked_free(model->arena);
+		return decode3do(data, size, filename, lazy, filter, NULL);
 	}
+	//carry on after the last mesh
+	c->pos = spans[model->numMeshes].offset;
+	checked_free(spans);
 
 	/* NODES */
 
-	model->unknown2 = readInt(ifp);
-	model->numNodes = readInt(ifp);
+	model->unknown2 = takeInt(c);
+	model->numNodes = takeInt(c);
 
-	//allocate memory for the array of NODE pointers, and read them in
-	model->nodes = checked_malloc( sizeof(NODE *) * model->numNodes );
+	model->nodes = arenaAlloc(a, sizeof(NODE *) * model->numNodes);
 	for(int i=0; i < model->numNodes; i++)
 	{
-		model->nodes[i] = readNode(ifp);
+		model->nodes[i] = decodeNode(c, a);
 	}
 
 	/* FOOTER */
-	
-	//read a float
-	model->modelRadius = readFloat(ifp);
-	//read a vector3
-	checked_fread(model->insertionOffset, 4, 3, ifp);
+
+	model->modelRadius = takeFloat(c);
+	takeBlock(c, model->insertionOffset, 12);
 	//36 bytes left, looks like another vector3, then 24 bytes of other stuff? alot zeros, could be a padded string or maybe whole file is padded?
-	checked_fread(model->unknown3, 4, 3, ifp);
+	takeBlock(c, model->unknown3, 12);
+	takeBlock(c, model->unknown4, 24);
+
+	return model;
+}
+
+/* Remember which file the model came from, so write3do() can copy the sections which haven't changed.  Only if the file on disk is still the size of the data that was decoded. */
+void noteSource( MODL *model, MAPPEDFILE *mf, char *filename )
+{
+	FILESTAMP stamp;
+	if( stampFile(filename, &stamp) != 0 || stamp.size != mf->size ) return;
 
-	checked_fread(model->unknown4, 4, 6, ifp);
+	model->sourceFile = checked_malloc(strlen(filename) + 1);
+	strcpy(model->sourceFile, filename);
+	model->source = stamp;
+}
 
-	/*	
-	//Was used to see if anything left in the file.
-	char remainder[1000];
-	size_t numRead = fread(remainder, 1, 1000, ifp);
-	printf("Had %d more bytes\n", (int)numRead);
-	for(int i=0; i<numRead; i++) putchar(remainder[i]);
-	*/
-	
+/* Decode a file already in memory, then release it (the MODL holds copies of everything).  For <lazy> see decode3do(), the file is kept by the model if any meshes are left pending. */
+MODL *load3do( MAPPEDFILE *mf, char *filename, int lazy, const MESHFILTER *filter )
+{
+	if( mf == NULL )
+	{
+		printf("File %s could not be opened.\n", filename);
+		return NULL;
+	}
 
-	//all done, close file and return a pointer to this MODL structure
-	fclose(ifp);
+	beginPhase("read3do");
+	MODL *model = NULL;
+	if( isModlImage(mf->data, mf->size) )
+	{
+		//already laid out, just copy it
+		const MODLIMAGE *image = checkModlImage(mf->data, mf->size, filename);
+		if( image != NULL ) model = imageToMODL(image);
+		//which is all decoded at once, so the meshes not asked for are just marked
+		for(int i=0; model != NULL && lazy && i < model->numMeshes; i++)
+		{
+			MESH *mesh = model->meshes[i];
+			mesh->unwanted = filter == NULL || !meshWanted(filter, mesh->meshName);
+		}
+	}
+	else
+	{
+		//an up to date index saves walking the faces just to size the model
+		MODLINDEX *index = readModlIndex(filename, mf->data, mf->size);
+		model = decode3do(mf->data, mf->size, filename, lazy, filter, index);
+		freeMODLINDEX(index);
+		if( model != NULL ) noteSource(model, mf, filename);
+		for(int i=0; model != NULL && i < model->numMeshes; i++)
+		{
+			if( model->meshes[i]->pending ) model->mapping = mf;
+		}
+	}
+	countBytes(mf->size, 0);
+	if( model != NULL )
+	{
+		countStat(STAT_MESHES, model->numMeshes);
+		for(int i=0; i < model->numMeshes; i++)
+		{
+			countStat(STAT_VERTICES, model->meshes[i]->numVertices);
+			countStat(STAT_FACES, model->meshes[i]->numFaces);
+		}
+	}
+	endPhase();
+	if( model == NULL || model->mapping != mf ) unmapFile(mf);
 
 	return model;
 }
+
+/* Reads the .3do file given as an argument into a MODL structure and returns a pointer to it.  If the process fails it returns NULL.  The file is read in with a single fread(). */
+MODL *read3do( char *filename )
+{
+	return load3do(readWholeFile(filename), filename, 0, NULL);
+}
+
+/* Same as read3do() except the file is mapped into memory rather than read */
+MODL *read3doMapped( char *filename )
+{
+	return load3do(mapFile(filename), filename, 0, NULL);
+}
+
+MODL *read3doLazy( char *filename, const MESHFILTER *filter )
+{
+	return load3do(mapFile(filename), filename, 1, filter);
+}
+
+MESH *loadMesh( MODL *model, int index )
+{
+	MESH *mesh = model->meshes[index];
+	if( !mesh->pending ) return mesh;
+
+	//into the slice of the arena sized for it, which starts with the MESH itself
+	MAPPEDFILE *mf = model->mapping;
+	CURSOR sizing = { mf->data, mf->size, mesh->sourceOffset, 0 };
+	ARENA slice = { (char *)mesh, sizeMesh(&sizing), 0 };
+	CURSOR cursor = { mf->data, mf->size, mesh->sourceOffset, 0 };
+
+	return decodeMesh(&cursor, &slice);
+}
+
+MESH *read3doMesh( const unsigned char *data, size_t size, size_t offset )
+{
+	if( offset > size ) return NULL;
+	CURSOR cursor = { data, size, offset, 0 };
+
+	//size it up the same way as a whole model, the MESH comes first in the arena so freeing it frees everything
+	CURSOR sizing = cursor;
+	size_t meshSize = sizeMesh(&sizing);
+	if( sizing.failed ) return NULL;
+	ARENA arena;
+	arenaInit(&arena, meshSize);
+
+	return decodeMesh(&cursor, &arena);
+}
@@ -1,2 +1,12 @@
-/* Provide access to the read3do function */
+/* Provide access to the read3do function (include modl.h and meshFilter.h first) */
 MODL *read3do( char *filename );
+/* Same result as read3do(), but decoded straight from a memory mapping of the file */
+MODL *read3doMapped( char *filename );
+/* Decode just the mesh starting <offset> bytes into a .3do held in memory (i.e an offset from visit3do()), everything in one block released with checked_free(mesh).  Returns NULL if it is truncated or corrupt. */
+MESH *read3doMesh( const unsigned char *data, size_t size, size_t offset );
+/* Set how many threads read3do() may decode the meshes of a large model with, 0 (the default) for one per processor and 1 to decode serially */
+void setDecodeThreads( int numThreads );
+/* Same as read3doMapped() but only the meshes <filter> lets through are decoded (none for a NULL filter).  The rest are left pending, with just their header decoded, until loadMesh().  The file stays mapped until freeMODL().  An image is decoded in full whatever the filter, with the meshes it leaves out marked unwanted instead. */
+MODL *read3doLazy( char *filename, const MESHFILTER *filter );
+/* Mesh <index> of the model, decoding it first if it is pending.  Not safe to call for the same model from more than one thread. */
+MESH *loadMesh( MODL *model, int index );
@@ -1,257 +1,702 @@
-/*Second attempt.  This time just read the contents of the .obj file into some structures and later can deal with how to output them. */
+/*Second attempt.  This time just read the contents of the .obj file into some structures and later can deal with how to output them.
+
+The file is mapped into memory (see mapFile.h) and tokenized by hand, with no limit on line length.  A quick prescan counts what each group holds so its arrays can be allocated at the right size up front.
+
+Large files are split into chunks at line boundaries which are parsed on separate threads.  A chunk can start partway through a group, and not know the current material or how many vertices came before it, so those loose ends are tied up once all the chunks are done: face indices are made local to their group with a prefix sum over the group counts, and faces are given the material left over from the earlier chunks.  The result is identical to parsing the file in one go. */
+#define _POSIX_C_SOURCE 200809L
+
 #include "objStructs.h"
 #include "checkedMem.h"
+#include "mapFile.h"
+#include "stats.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <float.h>
+#include <pthread.h>
+#include <unistd.h>
 
-#define MAX_LINE_LEN 128	//had  a face line over 64 chars so 128
 #define MAX_GROUP_NAME 32
 #define MAX_MAT_NAME 32
+#define MAX_NUMBER_CHARS 128	//longest number handed over to strtof()
+#define MIN_CHUNK_SIZE (1 << 20)	//files are not split into chunks smaller than this
+#define MAX_CHUNKS 64
+
+//number of threads to parse with, 0 for one per processor
+static int objThreads = 0;
+
+/* What the prescan finds in each group */
+typedef struct
+{
+    int numVertices;
+    int numTexVertices;
+    int numNormals;
+    int numFaces;
+} GROUPCOUNTS;
+
+/* The state kept while working through the lines of one chunk of a file */
+typedef struct
+{
+    //the text of the chunk
+    const char *start;
+    const char *end;
+
+    //the groups which begin in this chunk
+    OBJ *obj;
+    //the vertice group which lines from the file are contributing to
+    GROUP *group;
+    //set for every chunk but the first, which may start partway through a group
+    int continuing;
+    //lines before the chunk's first group line, which belong to a group from an earlier chunk
+    GROUP *continuation;
+
+    //the current material (an ID in the chunk's OBJ), once a usemtl line has been seen in one of this chunk's own groups
+    int matID;
+    int matSet;
+    //the material from a usemtl line in the continuation
+    int contMatID;
+    int contMatSet;
+
+    //prescan results, [0] for the lines before the first group line then one per group line
+    GROUPCOUNTS *counts;
+    int numCounts;
+} OBJPARSER;
+
+/* The kinds of line we care about, determined from the first couple of chars */
+enum { LINE_GROUP, LINE_VERTEX, LINE_TEXVERTEX, LINE_NORMAL, LINE_FACE, LINE_MATERIAL, LINE_BLANK, LINE_OTHER };
+
+static int isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char *skipSpace(const char *p, const char *end)
+{
+    while(p < end && isSpace(*p)) p++;
+    return p;
+}
+
+static const char *skipToken(const char *p, const char *end)
+{
+    while(p < end && !isSpace(*p)) p++;
+    return p;
+}
+
+static int lineType(const char *line, const char *end)
+{
+    if(line == end) return LINE_BLANK;
+    switch(line[0])
+    {
+	case 'o':
+	case 'g':
+	    return LINE_GROUP;
+	case 'v':
+	    if(line + 1 == end) return LINE_OTHER;
+	    if(line[1] == ' ' || line[1] == '\t') return LINE_VERTEX;
+	    if(line[1] == 't') return LINE_TEXVERTEX;
+	    if(line[1] == 'n') return LINE_NORMAL;
+	    return LINE_OTHER;
+	case 'f':
+	    return LINE_FACE;
+	case 'u':
+	    return LINE_MATERIAL;
+	case '\r':
+	    return LINE_BLANK;
+	default:
+	    return LINE_OTHER;
+    }
+}
+
+/* Parse a float after any whitespace at *pp, moving *pp past it.  Returns 0 if there is no number there.
+
+Numbers of up to 19 significant digits and small exponents (nearly all of them) are converted with a single correctly rounded double operation.  The rare case where that double lands exactly halfway between two floats, and anything unusual, goes to strtof() instead so the result is always the correctly rounded float. */
+static int parseFloat(const char **pp, const char *end, float *out)
+{
+    static const double pow10[23] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    const char *p = skipSpace(*pp, end);
+    const char *start = p;
+    int negative = 0;
+    if(p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int numDigits = 0;	//significant digits in the mantissa
+    int exp10 = 0;
+    int anyDigits = 0;
+    int truncated = 0;	//non zero digits beyond the 19 we keep
+    for( ; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+	anyDigits = 1;
+	if(numDigits < 19)
+	{
+	    mantissa = mantissa * 10 + (*p - '0');
+	    if(mantissa != 0) numDigits++;
+	}
+	else
+	{
+	    exp10++;
+	    if(*p != '0') truncated = 1;
+	}
+    }
+    if(p < end && *p == '.')
+    {
+	for(p++; p < end && *p >= '0' && *p <= '9'; p++)
+	{
+	    anyDigits = 1;
+	    if(numDigits < 19)
+	    {
+		mantissa = mantissa * 10 + (*p - '0');
+		if(mantissa != 0) numDigits++;
+		exp10--;
+	    }
+	    else if(*p != '0') truncated = 1;
+	}
+    }
+    if(anyDigits && p < end && (*p == 'e' || *p == 'E'))
+    {
+	const char *e = p + 1;
+	int expNegative = 0;
+	if(e < end && (*e == '-' || *e == '+')) expNegative = *e++ == '-';
+	if(e < end && *e >= '0' && *e <= '9')
+	{
+	    int value = 0;
+	    for( ; e < end && *e >= '0' && *e <= '9'; e++)
+	    {
+		if(value < 100000) value = value * 10 + (*e - '0');
+	    }
+	    exp10 += expNegative ? -value : value;
+	    p = e;
+	}
+    }
 
-//global state, the vertice group which lines from the file are contributing to
-GROUP *group;
+    if(anyDigits && !truncated)
+    {
+	if(mantissa == 0)
+	{
+	    *out = negative ? -0.0f : 0.0f;
+	    *pp = p;
+	    return 1;
+	}
+	if(mantissa < ((uint64_t)1 << 53) && exp10 >= -22 && exp10 <= 22)
+	{
+	    double d = (double)mantissa;
+	    d = exp10 < 0 ? d / pow10[-exp10] : d * pow10[exp10];
 
-int groupVertexCount;
-int totalVertexCount;
+	    //the 29 bits of the double that rounding to float drops, exactly half way is ambiguous
+	    uint64_t bits;
+	    memcpy(&bits, &d, 8);
+	    uint64_t dropped = bits & (((uint64_t)1 << 29) - 1);
+	    if(d >= FLT_MIN && d <= FLT_MAX && dropped != ((uint64_t)1 << 28))
+	    {
+		*out = negative ? -(float)d : (float)d;
+		*pp = p;
+		return 1;
+	    }
+	}
+    }
 
-int groupTexVertexCount;
-int totalTexVertexCount;
+    //slow path, hand a terminated copy of the token to strtof()
+    const char *tokenEnd = skipToken(start, end);
+    char buffer[MAX_NUMBER_CHARS];
+    size_t length = tokenEnd - start;
+    if(length >= sizeof(buffer)) length = sizeof(buffer) - 1;
+    memcpy(buffer, start, length);
+    buffer[length] = '\0';
 
-int groupNormalCount;
-int totalNormalCount;
+    char *parsedEnd;
+    float value = strtof(buffer, &parsedEnd);
+    if(parsedEnd == buffer) return 0;
 
-//the current material
-char matName[MAX_MAT_NAME];
+    *out = value;
+    *pp = start + (parsedEnd - buffer);
+    return 1;
+}
 
-void processGroupLine(OBJ *obj, char *line)
-{	
-    if(obj==NULL) fprintf(stderr, "NULL OBJ IN processGroupLine()\n");
-    //stop the old group being edited
-    //if(group != NULL) group = NULL;
-    
-    //update the global count variables
-    totalVertexCount += groupVertexCount;
-    groupVertexCount = 0;
-    totalTexVertexCount += groupTexVertexCount;
-    groupTexVertexCount = 0;
-    totalNormalCount += groupNormalCount;
-    groupNormalCount = 0;
+/* Parse a (possibly negative) integer at *pp, moving *pp past it.  Returns 0 if there is no number there. */
+static int parseInt(const char **pp, const char *end, int *out)
+{
+    const char *p = *pp;
+    int negative = 0;
+    if(p < end && *p == '-')
+    {
+	negative = 1;
+	p++;
+    }
+    if(p == end || *p < '0' || *p > '9') return 0;
+
+    long value = 0;
+    for( ; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+	if(value < 1000000000L) value = value * 10 + (*p - '0');
+    }
+
+    *out = (int)(negative ? -value : value);
+    *pp = p;
+    return 1;
+}
+
+/* Read up to <count> floats from the rest of the line into <v>, returning how many were read */
+static int parseFloats(const char *p, const char *end, float *v, int count)
+{
+    int read = 0;
+    while(read < count && parseFloat(&p, end, &v[read])) read++;
+    //leave anything missing as 0 rather than garbage
+    for(int i = read; i < count; i++) v[i] = 0.0f;
+
+    return read;
+}
+
+void processGroupLine(OBJPARSER *parser, const char *line, const char *end)
+{
+    OBJ *obj = parser->obj;
 
     //if out of space, reallocate
     if(++obj->numGroups > obj->groupSize) growGroups(obj);
-    
-    //make a new Group in the array, and update the global variable
-    group = obj->groups[obj->numGroups - 1] = createGROUP();
-    //read in data
-    group->groupName = checked_malloc(sizeof(char) * (MAX_GROUP_NAME + 1));
+
+    //make a new Group in the array (sized from the prescan) and make it the current group
+    int index = obj->numGroups - 1;
+    GROUP *group;
+    if(index + 1 < parser->numCounts)
+    {
+	GROUPCOUNTS *c = &parser->counts[index + 1];
+	group = createSizedGROUP(c->numVertices, c->numTexVertices, c->numNormals, c->numFaces);
+    }
+    else group = createGROUP();
+    parser->group = obj->groups[index] = group;
+
     //discard a single o or g and then read in the group name
     //so that we can use o or g groups in the .obj format
-    sscanf(line, "%*1[og] %32s", group->groupName);
-
+    const char *name = skipSpace(line + 1, end);
+    size_t length = skipToken(name, end) - name;
+    if(length > MAX_GROUP_NAME) length = MAX_GROUP_NAME;
+    group->groupName = checked_malloc(sizeof(char) * (MAX_GROUP_NAME + 1));
+    memcpy(group->groupName, name, length);
+    group->groupName[length] = '\0';
 }
 
-void processVertexLine(char *line)
+void processVertexLine(OBJPARSER *parser, const char *line, const char *end)
 {
+    GROUP *group = parser->group;
     if(group == NULL) return;
     if(++group->numVertices > group->vertSize) growVertices(group);
     float *v = group->vertices[group->numVertices - 1];
-    int read = sscanf(line, "v %f %f %f", v, v+1, v+2);
-    if(read != 3) fprintf(stderr, "sscanf() read %d values in processVertexLine()\n", read);
-    //update the global count of all vertices in this group
-    groupVertexCount++;
+    int read = parseFloats(line + 1, end, v, 3);
+    if(read != 3) fprintf(stderr, "Read %d values in processVertexLine()\n", read);
 }
 
-void processTexVertexLine(char *line)
+void processTexVertexLine(OBJPARSER *parser, const char *line, const char *end)
 {
+    GROUP *group = parser->group;
     if(group == NULL) return;
     if(++group->numTexVertices > group->texVertSize) growTexVertices(group);
     float *vt = group->texVertices[group->numTexVertices - 1];
 
     //NOTE: Reading in the texture vertices here is tied to how they are written out in writeObj.c  If the vertical texture coord is written inverted, it must again be inverted here, if they are scaled base on texture size when written they must be unscaled here etc
-    int read = sscanf(line, "vt %f %f", vt, vt+1);
+    int read = parseFloats(line + 2, end, vt, 2);
     //reinvert vertical coordinate
     *(vt+1) *= -1;
-	
 
-    if(read != 2) fprintf(stderr, "sscanf() read %d values in processTexVertexLine()\n", read);
-    //update the global count of all texture vertices in this group
-    groupTexVertexCount++;
+    if(read != 2) fprintf(stderr, "Read %d values in processTexVertexLine()\n", read);
 }
 
-void processNormalLine(char *line)
+void processNormalLine(OBJPARSER *parser, const char *line, const char *end)
 {
+    GROUP *group = parser->group;
     if(group == NULL) return;
     if(++group->numNormals > group->normSize) growNormals(group);
     float *vn = group->normals[group->numNormals - 1];
-    int read = sscanf(line, "vn %f %f %f", vn, vn+1, vn+2);
-    if(read != 3) fprintf(stderr, "sscanf() read %d values in processNormalLine()\n", read);
-    //update the global count of normals in this group
-    groupNormalCount++;
+    int read = parseFloats(line + 2, end, vn, 3);
+    if(read != 3) fprintf(stderr, "Read %d values in processNormalLine()\n", read);
 }
 
-void processFaceLine(char *line) 
+void processFaceLine(OBJPARSER *parser, const char *line, const char *end)
 {
+    GROUP *group = parser->group;
     if(group == NULL) return;
     if(++group->numFaces > group->faceSize) growFaces(group);
-    //allocate an OBJFACE structure
-    OBJFACE *f = group->faces[group->numFaces-1] = createOBJFACE();
+
     //line = "f a/b/c d/e/f g/h/i ... ..."
-    char *triplets[MAX_VERTS_PER_FACE + 1];
-    
-    char *current = line;
-    while(*current != '\n') //continue until reach end of the line (was originally until '\0' but led
-			    
+    //count the triplets first so the OBJFACE can be allocated to fit
+    int numVertices = 0;
+    for(const char *p = skipSpace(line + 1, end); p < end; p = skipSpace(skipToken(p, end), end))
     {
-	if(*current == ' ')
-	{
-	    *current = '\0';
-	    //increment count and store char * to triplet of indices which should follow the space
-	    //NOT in the case of end of line "10/12/9[ ][\n] (pretty big bug)
-	    if(*(current+1) != '\n')
-	    {
-		triplets[f->numVertices++] = current+1;
-	    }
-	    if(f->numVertices > MAX_VERTS_PER_FACE)
-	    {
-		fprintf(stderr, "More than %d vertices in this face.\n", MAX_VERTS_PER_FACE);
-		break;
-	    }
-	}
-	current++;
+	numVertices++;
     }
+    OBJFACE *f = group->faces[group->numFaces-1] = createOBJFACE(numVertices);
 
     //process them
-    for(int i=0; i < f->numVertices; i++)
+    const char *p = skipSpace(line + 1, end);
+    while(p < end)
     {
+	const char *tokenEnd = skipToken(p, end);
+
 	//read the index triplet
-	int *it = f->indices[i];
-	int read = sscanf(triplets[i], "%d%*c%d%*c%d", it, it+1, it+2);
-	if(read != 3) fprintf(stderr, "sscanf() read %d values in processFaceLine()\n", read);
-	if(read != 3) fprintf(stderr, "reading from '%s'\n", triplets[i]);
-	
-	//reduce the indices to be local to each group
-	it[0] -= totalVertexCount;
-	it[1] -= totalTexVertexCount;
-	it[2] -= totalNormalCount;
+	int *it = f->indices[f->numVertices++];
+	it[0] = it[1] = it[2] = 0;
+	const char *t = p;
+	int read = 0;
+	while(read < 3 && parseInt(&t, tokenEnd, &it[read]))
+	{
+	    read++;
+	    //step over the separating slash
+	    if(t < tokenEnd && *t == '/') t++;
+	    else break;
+	}
+	if(read != 3) fprintf(stderr, "Read %d values in processFaceLine()\n", read);
+	if(read != 3) fprintf(stderr, "reading from '%.*s'\n", (int)(tokenEnd - p), p);
+	//(the indices are still global to the file, rebaseIndices() makes them local to the group)
+
+	p = skipSpace(tokenEnd, end);
     }
 
-    //make room and store the name of the material for this face
-    f->materialName = checked_malloc(sizeof(matName));
-    strncpy(f->materialName, matName, MAX_MAT_NAME);
+    //store the material for this face, just the ID of the name
+    //otherwise (-1) the material comes from an earlier chunk, filled in by mapMaterials()
+    f->materialID = -1;
+    if(parser->matSet) f->materialID = parser->matID;
+    else if(parser->obj->numGroups == 0 && parser->contMatSet) f->materialID = parser->contMatID;
 }
 
 //update the current material
-void processMaterialLine(char *line)
+void processMaterialLine(OBJPARSER *parser, const char *line, const char *end)
 {
-    if(group == NULL) return;
-    //read into the global matName char arrray
-    int read = sscanf(line, "usemtl %s", matName);
-    if(read != 1)  fprintf(stderr, "sscanf() read %d values in processMaterialLine()\n", read);
+    if(parser->group == NULL) return;
+
+    //"usemtl name"
+    const char *name = line + 6;
+    if(end - line < 6 || strncmp(line, "usemtl", 6) != 0 || (name = skipSpace(name, end)) == end)
+    {
+	fprintf(stderr, "Read 0 values in processMaterialLine()\n");
+	return;
+    }
+
+    size_t length = skipToken(name, end) - name;
+    if(length > MAX_MAT_NAME - 1) length = MAX_MAT_NAME - 1;
 
     //blender appends stuff to the end of the original material name, strip this off
-    char *c = strstr(matName, ".mat");
+    for(size_t i=0; i + 4 <= length; i++)
+    {
+	//if .mat is in the name, end it there
+	if(memcmp(name + i, ".mat", 4) == 0)
+	{
+	    length = i + 4;
+	    break;
+	}
+    }
+
+    //store each distinct name once, the faces just keep its ID
+    int id = addMaterial(parser->obj, name, length);
 
-    //if .mat is in the name, drop a terminating null byte after it
-    if( c != NULL)
+    //before any group line of our own this is the material of a group from an earlier chunk
+    if(parser->obj->numGroups == 0)
     {
-	*(c+4) = '\0';	
+	parser->contMatID = id;
+	parser->contMatSet = 1;
+    }
+    else
+    {
+	parser->matID = id;
+	parser->matSet = 1;
     }
 
     return;
-    
+
 }
 
-/* Add any relevant data from this line into the OBJ structure. */
-void processLine(OBJ *obj, char *line)
+/* Add any relevant data from this line (not including the newline) into the OBJ structure. */
+void processLine(OBJPARSER *parser, const char *line, const char *end)
 {
     //determine what type of line it is
-    switch(line[0])
+    switch(lineType(line, end))
     {
-	case 'o':
-	    processGroupLine(obj, line);	
+	case LINE_GROUP:
+	    processGroupLine(parser, line, end);
 	    break;
-	case 'g':
-	    processGroupLine(obj, line);
+	case LINE_VERTEX:
+	    processVertexLine(parser, line, end);
 	    break;
-	case 'v':
-	    //nested switch to examine second char
-	    switch(line[1])
-	    {
-		case ' ':
-		    processVertexLine(line);
-		    break;
-		case 't':
-		    processTexVertexLine(line);
-		    break;
-		case 'n':
-		    processNormalLine(line);
-		    break;
-		default:
-		    fprintf(stderr, "Unhandled line: %s", line);
-		    break;
-	    }
+	case LINE_TEXVERTEX:
+	    processTexVertexLine(parser, line, end);
 	    break;
-	case 'f':
-	    processFaceLine(line);
+	case LINE_NORMAL:
+	    processNormalLine(parser, line, end);
 	    break;
-	case 'u':
-	    processMaterialLine(line);
+	case LINE_FACE:
+	    processFaceLine(parser, line, end);
 	    break;
-	case '\n':
+	case LINE_MATERIAL:
+	    processMaterialLine(parser, line, end);
+	    break;
+	case LINE_BLANK:
 	    //simply skip over blank lines, no printout
 	    break;
 	default:
-	    fprintf(stderr, "Unhandled line: %s", line);
+	    fprintf(stderr, "Unhandled line: %.*s\n", (int)(end - line), line);
 	    break;
     }
 }
 
-/*Open a .obj file and read the relevant information into the structures defined in "objStructs.h".  Return 1 for success, 0 for failure.*/
-OBJ *readObj(char *filename)
+/* Find the end of the line starting at <p> (the newline, or the end of the data) */
+static const char *lineEnd(const char *p, const char *end)
 {
-    if(filename == NULL)
+    const char *eol = memchr(p, '\n', end - p);
+    return eol != NULL ? eol : end;
+}
+
+/* Count the groups and the vertices, faces etc. each holds, so they can be allocated at the right size.  Returns an array of counts, the first entry for any lines before the first group line then one entry per group. */
+GROUPCOUNTS *prescanObj(const char *data, const char *end, int *numCounts)
+{
+    int size = 16;
+    GROUPCOUNTS *counts = checked_calloc(size, sizeof(GROUPCOUNTS));
+    GROUPCOUNTS *current = &counts[0];
+    *numCounts = 1;
+
+    for(const char *line = data; line < end; line = lineEnd(line, end) + 1)
     {
-	fprintf(stderr, "readObj() passed NULL filename.\n");
-	return NULL;
+	int type = lineType(line, end);
+	if(type == LINE_GROUP)
+	{
+	    if(*numCounts == size)
+	    {
+		size *= 2;
+		counts = checked_realloc(counts, sizeof(GROUPCOUNTS) * size);
+	    }
+	    current = &counts[(*numCounts)++];
+	    current->numVertices = current->numTexVertices = current->numNormals = current->numFaces = 0;
+	}
+	else
+	{
+	    if(type == LINE_VERTEX) current->numVertices++;
+	    else if(type == LINE_TEXVERTEX) current->numTexVertices++;
+	    else if(type == LINE_NORMAL) current->numNormals++;
+	    else if(type == LINE_FACE) current->numFaces++;
+	}
+    }
+
+    return counts;
+}
+
+/* Parse one chunk of the file (also a pthread start routine) */
+void *parseChunk(void *arg)
+{
+    OBJPARSER *parser = arg;
+
+    parser->counts = prescanObj(parser->start, parser->end, &parser->numCounts);
+    parser->obj = createSizedOBJ(parser->numCounts - 1);
+    if(parser->continuing)
+    {
+	GROUPCOUNTS *c = &parser->counts[0];
+	parser->group = parser->continuation = createSizedGROUP(c->numVertices, c->numTexVertices, c->numNormals, c->numFaces);
     }
 
-    //open the file and ensure success
-    FILE *ifp = fopen(filename, "r");
-    if(ifp == NULL)
+    for(const char *line = parser->start; line < parser->end; )
     {
-	fprintf(stderr, "Could not open %s in readObj().\n", filename);
-	return NULL;
+	const char *eol = lineEnd(line, parser->end);
+	processLine(parser, line, eol);
+	line = eol + 1;
     }
 
-    //create an OBJ structure to populate
-    OBJ *obj = createOBJ();
+    checked_free(parser->counts);
+    return NULL;
+}
 
-    //create a buffer to read into, and read the file
-    char line[MAX_LINE_LEN + 1];
-    while(fgets(line, sizeof(line), ifp) != NULL)
+/* Resolve a material carried over from earlier chunks, -1 meaning there hasn't been one (an empty name) */
+int carriedMaterial(OBJ *obj, int *matID)
+{
+    if(*matID == -1) *matID = addMaterial(obj, "", 0);
+    return *matID;
+}
+
+/* Change the material IDs of the faces in <group> from the chunk's own to those of the joined OBJ using <remap>, faces without one get the material <*matID> carried over from the earlier chunks */
+void mapMaterials(OBJ *obj, GROUP *group, const int *remap, int *matID)
+{
+    for(int i=0; i < group->numFaces; i++)
     {
-	//process the line
-	processLine(obj, line);
+	OBJFACE *f = group->faces[i];
+	f->materialID = f->materialID >= 0 ? remap[f->materialID] : carriedMaterial(obj, matID);
+    }
+}
+
+/* The faces index vertices etc. counting through the whole file, make them local to their group by subtracting the number in all the earlier groups */
+void rebaseIndices(OBJ *obj)
+{
+    int totalVertexCount = 0;
+    int totalTexVertexCount = 0;
+    int totalNormalCount = 0;
 
+    for(int i=0; i < obj->numGroups; i++)
+    {
+	GROUP *group = obj->groups[i];
+	for(int j=0; j < group->numFaces; j++)
+	{
+	    OBJFACE *f = group->faces[j];
+	    for(int k=0; k < f->numVertices; k++)
+	    {
+		f->indices[k][0] -= totalVertexCount;
+		f->indices[k][1] -= totalTexVertexCount;
+		f->indices[k][2] -= totalNormalCount;
+	    }
+	}
+	totalVertexCount += group->numVertices;
+	totalTexVertexCount += group->numTexVertices;
+	totalNormalCount += group->numNormals;
     }
+}
 
-    //check the state of the file stream
-    if(feof(ifp)) 
+/* Join the chunks, in order, into a single OBJ */
+OBJ *joinChunks(OBJPARSER *parsers, int numChunks)
+{
+    int numGroups = 0;
+    for(int i=0; i < numChunks; i++)
     {
-	//printf("Read to completion of the .obj file\n");
+	numGroups += parsers[i].obj->numGroups;
     }
-    else if(ferror(ifp) != 0)
+    OBJ *obj = createSizedOBJ(numGroups);
+
+    //the material at the end of the chunks so far
+    int matID = -1;
+
+    for(int i=0; i < numChunks; i++)
     {
-	fprintf(stderr, "Finished reading .obj file due to an error.\n");
-	//free memory
-	//NOT COMPLETED
-	return NULL;
+	OBJPARSER *parser = &parsers[i];
+
+	//the chunk's material names, as IDs in the joined OBJ
+	OBJ *chunk = parser->obj;
+	int *remap = checked_malloc(sizeof(int) * (chunk->numMaterials + 1));
+	for(int j=0; j < chunk->numMaterials; j++)
+	{
+	    remap[j] = addMaterial(obj, chunk->materialNames[j], strlen(chunk->materialNames[j]));
+	}
+
+	//a usemtl line in the continuation only counts if there really was a group to continue
+	int pending = parser->contMatSet && obj->numGroups > 0 ? remap[parser->contMatID] : matID;
+
+	if(parser->continuation != NULL)
+	{
+	    //lines before the first group in the file are ignored
+	    if(obj->numGroups > 0)
+	    {
+		//(faces left without a material came before any usemtl line in the continuation)
+		mapMaterials(obj, parser->continuation, remap, &matID);
+		if(pending == -1) pending = matID;
+		appendGROUP(obj->groups[obj->numGroups - 1], parser->continuation);
+	    }
+	    else freeGROUP(parser->continuation);
+	}
+
+	for(int j=0; j < chunk->numGroups; j++)
+	{
+	    mapMaterials(obj, chunk->groups[j], remap, &pending);
+	    obj->groups[obj->numGroups++] = chunk->groups[j];
+	}
+
+	matID = parser->matSet ? remap[parser->matID] : pending;
+
+	checked_free(remap);
+	//the groups now belong to the joined OBJ
+	chunk->numGroups = 0;
+	freeOBJ(chunk);
     }
 
-    //close the file and report success
-    fclose(ifp);
+    rebaseIndices(obj);
     return obj;
 }
 
+/* Parse the text of a whole .obj file held in memory into an OBJ structure, split into chunks on separate threads if it is big enough */
+OBJ *parseObj(const char *data, size_t size)
+{
+    const char *end = data + size;
+
+    int numChunks = objThreads;
+    if(numChunks <= 0) numChunks = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if((size_t)numChunks > size / MIN_CHUNK_SIZE) numChunks = (int)(size / MIN_CHUNK_SIZE);
+    if(numChunks > MAX_CHUNKS) numChunks = MAX_CHUNKS;
+    if(numChunks < 1) numChunks = 1;
+
+    //split the file into roughly equal chunks, ending each just after a newline
+    OBJPARSER parsers[MAX_CHUNKS];
+    memset(parsers, 0, sizeof(parsers));
+    const char *start = data;
+    int count = 0;
+    for(int i=0; i < numChunks && start < end; i++)
+    {
+	const char *chunkEnd = end;
+	if(i < numChunks - 1)
+	{
+	    chunkEnd = data + size / numChunks * (i + 1);
+	    if(chunkEnd < start) chunkEnd = start;
+	    chunkEnd = lineEnd(chunkEnd, end);
+	    if(chunkEnd < end) chunkEnd++;
+	}
+	parsers[count].start = start;
+	parsers[count].end = chunkEnd;
+	parsers[count].continuing = count > 0;
+	count++;
+	start = chunkEnd;
+    }
+
+    if(count <= 1)
+    {
+	//nothing to split (or an empty file), parse on this thread
+	parsers[0].start = data;
+	parsers[0].end = end;
+	parseChunk(&parsers[0]);
+	return joinChunks(parsers, 1);
+    }
+
+    //parse the first chunk on this thread while the others run
+    pthread_t threads[MAX_CHUNKS];
+    int started[MAX_CHUNKS];
+    for(int i=1; i < count; i++)
+    {
+	started[i] = pthread_create(&threads[i], NULL, parseChunk, &parsers[i]) == 0;
+	if(!started[i]) parseChunk(&parsers[i]);
+    }
+    parseChunk(&parsers[0]);
+    for(int i=1; i < count; i++)
+    {
+	if(started[i]) pthread_join(threads[i], NULL);
+    }
+
+    return joinChunks(parsers, count);
+}
+
+/* Set how many threads readObj() may use, 0 (the default) for one per processor and 1 to parse serially */
+void setObjThreads(int numThreads)
+{
+    objThreads = numThreads > 0 ? numThreads : 0;
+}
+
+/*Open a .obj file and read the relevant information into the structures defined in "objStructs.h".  Returns NULL on failure.*/
+OBJ *readObj(char *filename)
+{
+    if(filename == NULL)
+    {
+	fprintf(stderr, "readObj() passed NULL filename.\n");
+	return NULL;
+    }
+
+    //bring the whole file into memory and ensure success
+    MAPPEDFILE *mf = mapFile(filename);
+    if(mf == NULL)
+    {
+	fprintf(stderr, "Could not open %s in readObj().\n", filename);
+	return NULL;
+    }
+
+    beginPhase("readObj");
+    OBJ *obj = parseObj((const char *)mf->data, mf->size);
+    countBytes(mf->size, 0);
+    countStat(STAT_GROUPS, obj != NULL ? obj->numGroups : 0);
+    for(int i=0; obj != NULL && i < obj->numGroups; i++)
+    {
+	countStat(STAT_VERTICES, obj->groups[i]->numVertices);
+	countStat(STAT_FACES, obj->groups[i]->numFaces);
+    }
+    endPhase();
+
+    unmapFile(mf);
+    return obj;
+}
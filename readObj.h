@@ -1 +1,4 @@
 OBJ *readObj(char *filename);
+
+/* Set how many threads readObj() may use, 0 (the default) for one per processor and 1 to parse serially */
+void setObjThreads(int numThreads);
@@ -0,0 +1,163 @@
+/* Recording the phases of conversions for --stats (see stats.h).  Each thread has its own STATS, so conversions running side by side in a batch are recorded separately. */
+
+//threads and clock_gettime() are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+//names of the counts, in the report
+static const char *countNames[NUM_STAT_COUNTS] = { "meshes", "vertices", "faces", "groups", "material_lookups" };
+
+//the STATS each thread is recording into
+static pthread_key_t statsKey;
+static pthread_once_t statsKeyOnce = PTHREAD_ONCE_INIT;
+
+static void createStatsKey( void )
+{
+	pthread_key_create(&statsKey, NULL);
+}
+
+/* The STATS this thread is recording into, NULL if none */
+static STATS *currentStats( void )
+{
+	pthread_once(&statsKeyOnce, createStatsKey);
+	return pthread_getspecific(statsKey);
+}
+
+/* Seconds on a clock which only moves forward */
+static double now( void )
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void startStats( STATS *stats, const char *label )
+{
+	memset(stats, 0, sizeof(STATS));
+	stats->label = label;
+	stats->start = now();
+
+	pthread_once(&statsKeyOnce, createStatsKey);
+	pthread_setspecific(statsKey, stats);
+}
+
+void stopStats( void )
+{
+	STATS *stats = currentStats();
+	if( stats == NULL ) return;
+
+	stats->seconds = now() - stats->start;
+	pthread_setspecific(statsKey, NULL);
+}
+
+void beginPhase( const char *name )
+{
+	STATS *stats = currentStats();
+	if( stats == NULL || stats->numOpen == MAX_PHASES ) return;
+
+	int index = -1;
+	if( stats->numPhases < MAX_PHASES )
+	{
+		index = stats->numPhases++;
+		PHASE *phase = &stats->phases[index];
+		memset(phase, 0, sizeof(PHASE));
+		phase->name = name;
+		phase->depth = stats->numOpen;
+		//held here until the phase ends
+		phase->seconds = now();
+	}
+	stats->open[stats->numOpen++] = index;
+}
+
+void endPhase( void )
+{
+	STATS *stats = currentStats();
+	if( stats == NULL || stats->numOpen == 0 ) return;
+
+	int index = stats->open[--stats->numOpen];
+	if( index != -1 ) stats->phases[index].seconds = now() - stats->phases[index].seconds;
+}
+
+/* The innermost phase being recorded by this thread, NULL if none */
+static PHASE *currentPhase( void )
+{
+	STATS *stats = currentStats();
+	if( stats == NULL || stats->numOpen == 0 ) return NULL;
+
+	int index = stats->open[stats->numOpen - 1];
+	return index != -1 ? &stats->phases[index] : NULL;
+}
+
+void countStat( int counter, long long n )
+{
+	PHASE *phase = currentPhase();
+	if( phase != NULL ) phase->counts[counter] += n;
+}
+
+void countBytes( long long bytesRead, long long bytesWritten )
+{
+	PHASE *phase = currentPhase();
+	if( phase == NULL ) return;
+
+	phase->bytesRead += bytesRead;
+	phase->bytesWritten += bytesWritten;
+}
+
+/* Write <s> as a JSON string */
+static void printJsonString( FILE *ofp, const char *s )
+{
+	fputc('"', ofp);
+	for(; *s != '\0'; s++)
+	{
+		if( *s == '"' || *s == '\\' ) fputc('\\', ofp);
+		if( (unsigned char)*s < 0x20 ) fprintf(ofp, "\\u%04x", *s);
+		else fputc(*s, ofp);
+	}
+	fputc('"', ofp);
+}
+
+void printStats( STATS *stats, int json, FILE *ofp )
+{
+	//all in one piece, even with other threads printing
+	flockfile(ofp);
+
+	if( json )
+	{
+		fprintf(ofp, "{\"file\":");
+		printJsonString(ofp, stats->label);
+		fprintf(ofp, ",\"seconds\":%.6f,\"phases\":[", stats->seconds);
+		for(int i=0; i < stats->numPhases; i++)
+		{
+			PHASE *p = &stats->phases[i];
+			fprintf(ofp, "%s{\"name\":\"%s\",\"depth\":%d,\"seconds\":%.6f,\"bytes_read\":%lld,\"bytes_written\":%lld", i > 0 ? "," : "", p->name, p->depth, p->seconds, p->bytesRead, p->bytesWritten);
+			for(int j=0; j < NUM_STAT_COUNTS; j++)
+			{
+				fprintf(ofp, ",\"%s\":%lld", countNames[j], p->counts[j]);
+			}
+			fprintf(ofp, "}");
+		}
+		fprintf(ofp, "]}\n");
+	}
+	else
+	{
+		fprintf(ofp, "Stats for %s, %.6f s in total\n", stats->label, stats->seconds);
+		fprintf(ofp, "  %-20s %10s %12s %12s %8s %10s %10s %8s %8s\n", "phase", "seconds", "read", "written", "meshes", "vertices", "faces", "groups", "lookups");
+		for(int i=0; i < stats->numPhases; i++)
+		{
+			PHASE *p = &stats->phases[i];
+			//nested phases are indented under the one they are part of
+			fprintf(ofp, "  %*s%-*s %10.6f %12lld %12lld", 2 * p->depth, "", 20 - 2 * p->depth, p->name, p->seconds, p->bytesRead, p->bytesWritten);
+			fprintf(ofp, " %8lld %10lld %10lld %8lld %8lld\n", p->counts[STAT_MESHES], p->counts[STAT_VERTICES], p->counts[STAT_FACES], p->counts[STAT_GROUPS], p->counts[STAT_MATERIAL_LOOKUPS]);
+		}
+	}
+
+	fflush(ofp);
+	funlockfile(ofp);
+}
@@ -0,0 +1,62 @@
+/* Timing and counting the phases of a conversion, for --stats.
+
+Phases are started and ended by the code doing the work (read3do(), printObj() etc.) and are recorded into whichever STATS the calling thread has started, if any, so the instrumentation costs next to nothing when stats aren't wanted.  Phases can be nested (i.e scaleTexVerts() inside printObj()), each one's time includes those within it. */
+
+#include <stdio.h>
+
+//the things counted in each phase
+#define STAT_MESHES 0
+#define STAT_VERTICES 1
+#define STAT_FACES 2
+#define STAT_GROUPS 3
+#define STAT_MATERIAL_LOOKUPS 4
+#define NUM_STAT_COUNTS 5
+
+//any more phases than this in one STATS are not recorded
+#define MAX_PHASES 32
+
+/* One phase of a conversion */
+typedef struct
+{
+	const char *name;
+	//how many phases it is within
+	int depth;
+	double seconds;
+	long long bytesRead;
+	long long bytesWritten;
+	long long counts[NUM_STAT_COUNTS];
+} PHASE;
+
+/* Everything recorded for one conversion */
+typedef struct
+{
+	//what is being converted, for the report
+	const char *label;
+	double start;
+	double seconds;
+
+	PHASE phases[MAX_PHASES];
+	int numPhases;
+	//the phases currently started, innermost last (as indices into <phases>, -1 for one not recorded)
+	int open[MAX_PHASES];
+	int numOpen;
+} STATS;
+
+/* Start recording the phases run by this thread into <stats> */
+void startStats( STATS *stats, const char *label );
+
+/* Stop recording into the thread's STATS, finishing its total time */
+void stopStats( void );
+
+/* Start a phase called <name> (a string which lasts, i.e a literal).  Does nothing if the thread isn't recording. */
+void beginPhase( const char *name );
+
+/* End the innermost phase started */
+void endPhase( void );
+
+/* Add to the counts of the innermost phase */
+void countStat( int counter, long long n );
+void countBytes( long long bytesRead, long long bytesWritten );
+
+/* Print a report of <stats> to <ofp>, as JSON (on a single line) if <json> is set or otherwise as a table */
+void printStats( STATS *stats, int json, FILE *ofp );
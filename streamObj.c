@@ -0,0 +1,339 @@
+/* Converting a .3do into a .obj a mesh at a time, without ever holding the whole model (see printObj() for the usual way).
+
+The node hierarchy which decides the order and position of the meshes in the .obj comes after all the meshes in a .3do, so a first pass over the mapped file (see visit3do.h) notes where each mesh starts along with the materials and nodes, which are all small.  A reader thread then decodes the meshes one at a time in the order the nodes print them, scaling their texture vertices, and hands them through a short queue to the calling thread which formats them into the .obj.  Decoding the next mesh overlaps with writing out the one before, and only a few meshes are in memory at once. */
+
+//threads are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
+#include "modl.h"
+#include "textOut.h"
+#include "writeObj.h"
+#include "meshFilter.h"
+#include "read3do.h"
+#include "visit3do.h"
+#include "mapFile.h"
+#include "matScaler.h"
+#include "checkedMem.h"
+#include "streamObj.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+//meshes decoded ahead of the one being written
+#define STREAM_QUEUE_SIZE 4
+
+/* A mesh to write, in the order they appear in the .obj */
+typedef struct
+{
+	int meshID;
+	//added to every vertex, from the nodes above it
+	float offset[3];
+} STREAMITEM;
+
+/* Everything about a conversion in progress */
+typedef struct
+{
+	//the whole .3do, mapped
+	const unsigned char *data;
+	size_t size;
+
+	//found by the first pass
+	char **materialNames;
+	int numMaterials;
+	size_t *meshOffsets;
+	int numMeshes;
+	//which meshes are written
+	const MESHFILTER *filter;
+	char *wanted;
+	NODE *nodes;
+	int numNodes;
+	int nodeSize;
+
+	//the meshes to write in order
+	STREAMITEM *items;
+	int numItems;
+	int itemSize;
+	//nodes already put in order, so a corrupt hierarchy can't loop forever
+	char *visited;
+
+	//dimensions of each material, for scaling the texture vertices
+	float *matWidths;
+	float *matHeights;
+
+	//decoded meshes waiting to be written, NULL for one that failed to decode
+	pthread_mutex_t lock;
+	//signalled whenever a mesh is added or taken
+	pthread_cond_t changed;
+	MESH *queue[STREAM_QUEUE_SIZE];
+	int head;
+	int count;
+	//set if the writer gives up, the reader stops
+	int cancelled;
+} STREAM;
+
+//first pass callbacks, keeping what is needed to put the meshes in order
+static int scanHeader( void *data, const VISITHEADER *header )
+{
+	STREAM *s = data;
+	s->numMaterials = header->numMaterials;
+	s->materialNames = checked_calloc(header->numMaterials + 1, sizeof(char *));
+	s->numMeshes = header->numMeshes;
+	s->meshOffsets = checked_malloc(sizeof(size_t) * (header->numMeshes + 1));
+	s->wanted = checked_calloc(header->numMeshes + 1, 1);
+
+	return 0;
+}
+
+static int scanMaterial( void *data, int index, const char *name )
+{
+	STREAM *s = data;
+	s->materialNames[index] = checked_malloc(strlen(name) + 1);
+	strcpy(s->materialNames[index], name);
+
+	return 0;
+}
+
+static int scanMesh( void *data, const VISITMESH *mesh )
+{
+	STREAM *s = data;
+	s->meshOffsets[mesh->index] = mesh->offset;
+	s->wanted[mesh->index] = meshWanted(s->filter, mesh->name);
+
+	return 0;
+}
+
+static int scanNode( void *data, int index, const NODE *node )
+{
+	STREAM *s = data;
+	if( s->numNodes == s->nodeSize )
+	{
+		s->nodeSize *= 2;
+		s->nodes = checked_realloc(s->nodes, sizeof(NODE) * s->nodeSize);
+	}
+	s->nodes[s->numNodes] = *node;
+	//the name only lasts as long as the call, and isn't needed
+	s->nodes[s->numNodes].name = NULL;
+	s->numNodes++;
+
+	return 0;
+}
+
+/* Put the meshes in the order printNode() would write them, working out their offsets the same way */
+static void orderNodes( STREAM *s, int nodeID, float parentOffset[3] )
+{
+	if( nodeID < 0 || nodeID >= s->numNodes || s->visited[nodeID] ) return;
+	s->visited[nodeID] = 1;
+	NODE *node = &s->nodes[nodeID];
+
+	float nodeOffset[3];
+	for(int i=0; i < 3; i++) nodeOffset[i] = parentOffset[i] + node->position[i];
+	float meshOffset[3];
+	for(int i=0; i < 3; i++) meshOffset[i] = nodeOffset[i] + node->pivot[i];
+
+	if( node->meshID >= 0 && node->meshID < s->numMeshes && s->wanted[node->meshID] )
+	{
+		if( s->numItems == s->itemSize )
+		{
+			s->itemSize *= 2;
+			s->items = checked_realloc(s->items, sizeof(STREAMITEM) * s->itemSize);
+		}
+		STREAMITEM *item = &s->items[s->numItems++];
+		item->meshID = node->meshID;
+		memcpy(item->offset, meshOffset, sizeof(meshOffset));
+	}
+
+	if( node->hasChildren != 0 ) orderNodes(s, node->childID, nodeOffset);
+	if( node->hasSibling != 0 ) orderNodes(s, node->siblingID, parentOffset);
+}
+
+/* Decode item <i>'s mesh and scale it ready for the .obj, NULL if it is corrupt */
+static MESH *prepareMesh( STREAM *s, int i )
+{
+	MESH *mesh = read3doMesh(s->data, s->size, s->meshOffsets[s->items[i].meshID]);
+	if( mesh != NULL ) scaleMeshTexVerts(mesh, s->matWidths, s->matHeights, 0);
+
+	return mesh;
+}
+
+/* The reader thread, decoding each mesh in turn and queueing it for the writer */
+static void *readMeshes( void *arg )
+{
+	STREAM *s = arg;
+
+	for(int i=0; i < s->numItems; i++)
+	{
+		MESH *mesh = prepareMesh(s, i);
+
+		pthread_mutex_lock(&s->lock);
+		while( s->count == STREAM_QUEUE_SIZE && !s->cancelled )
+		{
+			pthread_cond_wait(&s->changed, &s->lock);
+		}
+		if( s->cancelled )
+		{
+			pthread_mutex_unlock(&s->lock);
+			checked_free(mesh);
+			break;
+		}
+		s->queue[(s->head + s->count) % STREAM_QUEUE_SIZE] = mesh;
+		s->count++;
+		pthread_cond_broadcast(&s->changed);
+		pthread_mutex_unlock(&s->lock);
+
+		//the writer stops at a failed mesh, so there's no point going on
+		if( mesh == NULL ) break;
+	}
+
+	return NULL;
+}
+
+/* Take the next mesh from the reader thread */
+static MESH *nextMesh( STREAM *s )
+{
+	pthread_mutex_lock(&s->lock);
+	while( s->count == 0 )
+	{
+		pthread_cond_wait(&s->changed, &s->lock);
+	}
+	MESH *mesh = s->queue[s->head];
+	s->head = (s->head + 1) % STREAM_QUEUE_SIZE;
+	s->count--;
+	pthread_cond_broadcast(&s->changed);
+	pthread_mutex_unlock(&s->lock);
+
+	return mesh;
+}
+
+/* Write the meshes into <ofp> as they are decoded, returns 0 on success or -1 on failure */
+static int writeMeshes( STREAM *s, FILE *ofp, char *filename )
+{
+	pthread_t reader;
+	int threaded = pthread_create(&reader, NULL, readMeshes, s) == 0;
+
+	TEXTBUF *tb = createTEXTBUF(ofp, TEXTBUF_SIZE, getObjPrecision());
+	//NOTE: .3do indexes from 0, .obj indexes from 1, intialise offsets with 1
+	INDEXOFFSETS io = { 1, 1 };
+	int status = 0;
+	for(int i=0; i < s->numItems && !tb->failed; i++)
+	{
+		//(without a thread, just decode each mesh here)
+		MESH *mesh = threaded ? nextMesh(s) : prepareMesh(s, i);
+		if( mesh == NULL )
+		{
+			fprintf(stderr, "%s is truncated or corrupt.\n", filename);
+			status = -1;
+			break;
+		}
+		printMesh(s->materialNames, mesh, s->items[i].offset, &io, tb);
+		countStat(STAT_MESHES, 1);
+		countStat(STAT_VERTICES, mesh->numVertices);
+		countStat(STAT_FACES, mesh->numFaces);
+		checked_free(mesh);
+	}
+
+	if( threaded )
+	{
+		//let the reader finish (if it is still going), then throw away anything it decoded since
+		pthread_mutex_lock(&s->lock);
+		s->cancelled = 1;
+		pthread_cond_broadcast(&s->changed);
+		pthread_mutex_unlock(&s->lock);
+		pthread_join(reader, NULL);
+		for(; s->count > 0; s->count--)
+		{
+			checked_free(s->queue[s->head]);
+			s->head = (s->head + 1) % STREAM_QUEUE_SIZE;
+		}
+	}
+
+	flushTEXTBUF(tb);
+	if( tb->failed ) status = -1;
+	freeTEXTBUF(tb);
+	countBytes(0, ftell(ofp));
+
+	return status;
+}
+
+static void freeSTREAM( STREAM *s )
+{
+	if( s->materialNames != NULL )
+	{
+		for(int i=0; i < s->numMaterials; i++)
+		{
+			checked_free(s->materialNames[i]);
+		}
+	}
+	checked_free(s->materialNames);
+	checked_free(s->meshOffsets);
+	checked_free(s->wanted);
+	checked_free(s->nodes);
+	checked_free(s->items);
+	checked_free(s->visited);
+	checked_free(s->matWidths);
+	checked_free(s->matHeights);
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->changed);
+}
+
+int streamObj( char *filename, char *objFilename, char *mtlFilename, char *imFormat, const MESHFILTER *filter )
+{
+	MAPPEDFILE *mf = mapFile(filename);
+	if( mf == NULL )
+	{
+		printf("File %s could not be opened.\n", filename);
+		return -1;
+	}
+
+	beginPhase("streamObj");
+	countBytes(mf->size, 0);
+
+	STREAM s;
+	memset(&s, 0, sizeof(STREAM));
+	s.data = mf->data;
+	s.size = mf->size;
+	s.filter = filter;
+	s.nodeSize = 64;
+	s.nodes = checked_malloc(sizeof(NODE) * s.nodeSize);
+	s.itemSize = 64;
+	s.items = checked_malloc(sizeof(STREAMITEM) * s.itemSize);
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.changed, NULL);
+
+	//FIRST PASS, which also checks the whole file is there
+	VISITOR scan = { &s, scanHeader, scanMaterial, scanMesh, NULL, NULL, NULL, scanNode, NULL };
+	if( visit3doData(mf->data, mf->size, &scan, filename) != 0 )
+	{
+		freeSTREAM(&s);
+		unmapFile(mf);
+		endPhase();
+		return -1;
+	}
+
+	if( s.numNodes != 0 )
+	{
+		s.visited = checked_calloc(s.numNodes, 1);
+		float startingOffset[3] = {0.0, 0.0, 0.0};
+		orderNodes(&s, 0, startingOffset);
+	}
+	materialDimensions(s.materialNames, s.numMaterials, &s.matWidths, &s.matHeights);
+
+	int status = -1;
+	FILE *ofp = fopen(objFilename, "w");
+	if( ofp == NULL ) fprintf(stderr, "Could not open %s for writing.\n", objFilename);
+	else
+	{
+		status = writeMeshes(&s, ofp, filename);
+		if( fclose(ofp) != 0 ) status = -1;
+	}
+	if( status != 0 ) fprintf(stderr, "Failed to write %s\n", objFilename);
+	endPhase();
+	if( status == 0 ) status = printMaterials(s.materialNames, s.numMaterials, mtlFilename, imFormat);
+
+	freeSTREAM(&s);
+	unmapFile(mf);
+
+	return status;
+}
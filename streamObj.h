@@ -0,0 +1,2 @@
+/* Convert the .3do <filename> into a .obj and .mtl the same as printObj() and printMtl() would, but decoding and writing out one mesh at a time on two threads so the whole model is never in memory (include modl.h and meshFilter.h first).  Only the meshes <filter> lets through are decoded and written, all of them for a NULL filter.  Returns 0 on success, -1 on failure. */
+int streamObj( char *filename, char *objFilename, char *mtlFilename, char *imFormat, const MESHFILTER *filter );
@@ -0,0 +1,447 @@
+/* Number formatting and buffered text output for the .obj writer.  Replaces fprintf(), which is slow (varargs and locale handling on every call) and, with "%f", lossy.
+
+Floats are formatted exactly, using a small fixed size big integer to compare decimal candidates against the float's true binary value, so the text always reads back as the identical float. */
+
+#include "textOut.h"
+#include "checkedMem.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+//enough 32 bit words for any float scaled by any power of ten we need (about 2^210)
+#define BIG_WORDS 10
+
+/* An unsigned big integer, least significant word first */
+typedef struct
+{
+	uint32_t w[BIG_WORDS];
+	//number of words in use
+	int n;
+} BIGNUM;
+
+void bigSet( BIGNUM *b, uint64_t v )
+{
+	b->n = 0;
+	while( v != 0 )
+	{
+		b->w[b->n++] = (uint32_t)v;
+		v >>= 32;
+	}
+}
+
+void bigMulSmall( BIGNUM *b, uint32_t m )
+{
+	uint64_t carry = 0;
+	for(int i=0; i < b->n; i++)
+	{
+		uint64_t t = (uint64_t)b->w[i] * m + carry;
+		b->w[i] = (uint32_t)t;
+		carry = t >> 32;
+	}
+	if( carry != 0 ) b->w[b->n++] = (uint32_t)carry;
+}
+
+void bigMulPow10( BIGNUM *b, int k )
+{
+	static const uint32_t pow10[10] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+	for( ; k >= 9; k -= 9 ) bigMulSmall(b, pow10[9]);
+	if( k > 0 ) bigMulSmall(b, pow10[k]);
+}
+
+void bigShiftLeft( BIGNUM *b, int bits )
+{
+	if( b->n == 0 ) return;
+
+	int words = bits / 32;
+	bits %= 32;
+	//one extra word for the bits shifted out of the top
+	b->w[b->n] = 0;
+	for(int i = b->n; i >= 0; i--)
+	{
+		uint32_t hi = b->w[i] << bits;
+		uint32_t lo = (bits != 0 && i > 0) ? b->w[i-1] >> (32 - bits) : 0;
+		b->w[i + words] = hi | lo;
+	}
+	for(int i=0; i < words; i++) b->w[i] = 0;
+	b->n += words + 1;
+	while( b->n > 0 && b->w[b->n - 1] == 0 ) b->n--;
+}
+
+/* Shift right by <bits> (at least 1), returning how the bits shifted out compare to one half: -1 less, 0 exactly half, 1 more */
+int bigShiftRight( BIGNUM *b, int bits )
+{
+	//the highest bit shifted out is the half bit, anything under it makes it more than half
+	int hb = bits - 1;
+	int half = 0, below = 0;
+	if( hb / 32 < b->n )
+	{
+		half = (b->w[hb / 32] >> (hb % 32)) & 1;
+		below = (b->w[hb / 32] & ((1u << (hb % 32)) - 1)) != 0;
+	}
+	for(int i=0; i < hb / 32 && i < b->n; i++)
+	{
+		if( b->w[i] != 0 ) below = 1;
+	}
+
+	int words = bits / 32;
+	int rem = bits % 32;
+	int n = b->n - words;
+	for(int i=0; i < n; i++)
+	{
+		uint32_t lo = b->w[i + words] >> rem;
+		uint32_t hi = (rem != 0 && i + words + 1 < b->n) ? b->w[i + words + 1] << (32 - rem) : 0;
+		b->w[i] = lo | hi;
+	}
+	b->n = n > 0 ? n : 0;
+	while( b->n > 0 && b->w[b->n - 1] == 0 ) b->n--;
+
+	if( half == 0 ) return -1;
+	return below ? 1 : 0;
+}
+
+void bigAddOne( BIGNUM *b )
+{
+	for(int i=0; i < b->n; i++)
+	{
+		if( ++b->w[i] != 0 ) return;
+	}
+	b->w[b->n++] = 1;
+}
+
+int bigCompare( BIGNUM *a, BIGNUM *b )
+{
+	if( a->n != b->n ) return a->n < b->n ? -1 : 1;
+	for(int i = a->n - 1; i >= 0; i--)
+	{
+		if( a->w[i] != b->w[i] ) return a->w[i] < b->w[i] ? -1 : 1;
+	}
+	return 0;
+}
+
+/* Divide by <d>, returning the remainder */
+uint32_t bigDivSmall( BIGNUM *b, uint32_t d )
+{
+	uint64_t rem = 0;
+	for(int i = b->n - 1; i >= 0; i--)
+	{
+		uint64_t t = (rem << 32) | b->w[i];
+		b->w[i] = (uint32_t)(t / d);
+		rem = t % d;
+	}
+	while( b->n > 0 && b->w[b->n - 1] == 0 ) b->n--;
+
+	return (uint32_t)rem;
+}
+
+/* Write the decimal digits of <b> into <out> (most significant first), returning how many */
+int bigDigits( BIGNUM *b, char *out )
+{
+	char rev[80];
+	int len = 0;
+	do
+	{
+		rev[len++] = '0' + bigDivSmall(b, 10);
+	} while( b->n != 0 );
+
+	for(int i=0; i < len; i++) out[i] = rev[len - 1 - i];
+	return len;
+}
+
+/* Compare D*10^q against C*2^f exactly */
+int compareScaled( uint64_t d, int q, uint64_t c, int f )
+{
+	BIGNUM left, right;
+	bigSet(&left, d);
+	bigSet(&right, c);
+	if( q >= 0 ) bigMulPow10(&left, q); else bigMulPow10(&right, -q);
+	if( f >= 0 ) bigShiftLeft(&right, f); else bigShiftLeft(&left, -f);
+
+	return bigCompare(&left, &right);
+}
+
+/* An approximate power of ten as a double (exact from 10^-0 up to 10^22) */
+double pow10d( int k )
+{
+	double r = 1.0;
+	int n = k < 0 ? -k : k;
+	for( ; n >= 22; n -= 22 ) r *= 1e22;
+	for( ; n > 0; n-- ) r *= 10.0;
+
+	return k < 0 ? 1.0 / r : r;
+}
+
+/* The shortest digits D and exponent q such that D*10^q reads back as the positive float m*2^e.  Returns D. */
+uint64_t shortestDigits( float ax, uint32_t m, int e, int lowerGapHalf, int *qOut )
+{
+	//the interval of values rounding to this float, in units of 2^(e-2)
+	uint64_t low = lowerGapHalf ? 4 * (uint64_t)m - 1 : 4 * (uint64_t)m - 2;
+	uint64_t high = 4 * (uint64_t)m + 2;
+	//round half to even, so the interval ends belong to this float if its mantissa is even
+	int inclusive = (m & 1) == 0;
+
+	//decimal exponent of the leading digit
+	int k = (int)((e + 23) * 0.30103);
+	while( ax >= pow10d(k + 1) ) k++;
+	while( ax < pow10d(k) ) k--;
+
+	for(int p = 1; ; p++)
+	{
+		int q = k - p + 1;
+		double scaled = q >= 0 ? ax / pow10d(q) : ax * pow10d(-q);
+		uint64_t nearest = (uint64_t)(scaled + 0.5);
+
+		//the estimate may be one out, so check its neighbours too and take the closest that works
+		uint64_t best = 0;
+		double bestDist = 0;
+		for(int i = -1; i <= 1; i++)
+		{
+			uint64_t d = nearest + i;
+			if( d == 0 || (i == -1 && nearest == 0) ) continue;
+			int cl = compareScaled(d, q, low, e - 2);
+			int ch = compareScaled(d, q, high, e - 2);
+			if( (cl > 0 || (cl == 0 && inclusive)) && (ch < 0 || (ch == 0 && inclusive)) )
+			{
+				double dist = d > scaled ? d - scaled : scaled - d;
+				if( best == 0 || dist < bestDist )
+				{
+					best = d;
+					bestDist = dist;
+				}
+			}
+		}
+
+		//9 significant digits always identify a float, so this ends by then
+		if( best != 0 || p >= 9 )
+		{
+			*qOut = q;
+			return best != 0 ? best : nearest;
+		}
+	}
+}
+
+/* Format a float as text, see textOut.h */
+int formatFloat( char *out, float value, int precision )
+{
+	uint32_t bits;
+	memcpy(&bits, &value, 4);
+	int negative = bits >> 31;
+	int biasedExp = (bits >> 23) & 0xff;
+	uint32_t frac = bits & 0x7fffff;
+	char *o = out;
+
+	//not a number or infinite, same text as printf
+	if( biasedExp == 0xff )
+	{
+		if( negative ) *o++ = '-';
+		strcpy(o, frac != 0 ? "nan" : "inf");
+		return (int)(o - out) + 3;
+	}
+
+	if( negative ) *o++ = '-';
+
+	//value = m * 2^e exactly
+	uint32_t m = biasedExp == 0 ? frac : frac | 0x800000;
+	int e = biasedExp == 0 ? -149 : biasedExp - 150;
+
+	if( precision != FLOAT_SHORTEST )
+	{
+		if( precision > MAX_FLOAT_PRECISION ) precision = MAX_FLOAT_PRECISION;
+		if( precision < 0 ) precision = 0;
+
+		//round m * 2^e * 10^precision to the nearest integer, ties to even as printf does
+		BIGNUM b;
+		bigSet(&b, m);
+		bigMulPow10(&b, precision);
+		if( e >= 0 ) bigShiftLeft(&b, e);
+		else
+		{
+			int cmp = bigShiftRight(&b, -e);
+			if( cmp > 0 || (cmp == 0 && b.n > 0 && (b.w[0] & 1)) ) bigAddOne(&b);
+		}
+
+		char digits[MAX_FLOAT_CHARS];
+		int nd = bigDigits(&b, digits);
+		//pad with leading zeros so there is a digit before the point
+		int intDigits = nd > precision ? nd - precision : 1;
+		int zeros = intDigits + precision - nd;
+		for(int i=0; i < intDigits; i++)
+		{
+			*o++ = i < zeros ? '0' : digits[i - zeros];
+		}
+		if( precision > 0 )
+		{
+			*o++ = '.';
+			for(int i = intDigits; i < intDigits + precision; i++)
+			{
+				*o++ = i < zeros ? '0' : digits[i - zeros];
+			}
+		}
+		*o = '\0';
+		return (int)(o - out);
+	}
+
+	if( m == 0 )
+	{
+		*o++ = '0';
+		*o = '\0';
+		return (int)(o - out);
+	}
+
+	float ax = negative ? -value : value;
+	int q;
+	uint64_t d = shortestDigits(ax, m, e, frac == 0 && biasedExp > 1, &q);
+	//drop trailing zeros
+	while( d % 10 == 0 )
+	{
+		d /= 10;
+		q++;
+	}
+
+	char digits[24];
+	BIGNUM b;
+	bigSet(&b, d);
+	int nd = bigDigits(&b, digits);
+	//exponent of the leading digit
+	int lead = nd - 1 + q;
+
+	if( lead < -6 || lead > 20 )
+	{
+		//scientific notation, d.ddde-XX
+		*o++ = digits[0];
+		if( nd > 1 )
+		{
+			*o++ = '.';
+			memcpy(o, digits + 1, nd - 1);
+			o += nd - 1;
+		}
+		*o++ = 'e';
+		o += formatInt(o, lead);
+	}
+	else if( q >= 0 )
+	{
+		//a whole number
+		memcpy(o, digits, nd);
+		o += nd;
+		for(int i=0; i < q; i++) *o++ = '0';
+	}
+	else if( nd > -q )
+	{
+		//point within the digits
+		memcpy(o, digits, nd + q);
+		o += nd + q;
+		*o++ = '.';
+		memcpy(o, digits + nd + q, -q);
+		o += -q;
+	}
+	else
+	{
+		//point before the digits, 0.000ddd
+		*o++ = '0';
+		*o++ = '.';
+		for(int i=0; i < -q - nd; i++) *o++ = '0';
+		memcpy(o, digits, nd);
+		o += nd;
+	}
+	*o = '\0';
+
+	return (int)(o - out);
+}
+
+/* Format an integer, see textOut.h */
+int formatInt( char *out, int value )
+{
+	char rev[12];
+	int len = 0;
+	//work with a negative number so INT_MIN does not overflow
+	int v = value < 0 ? value : -value;
+	do
+	{
+		rev[len++] = '0' - (v % 10);
+		v /= 10;
+	} while( v != 0 );
+
+	char *o = out;
+	if( value < 0 ) *o++ = '-';
+	while( len > 0 ) *o++ = rev[--len];
+	*o = '\0';
+
+	return (int)(o - out);
+}
+
+TEXTBUF *createTEXTBUF( FILE *ofp, size_t cap, int precision )
+{
+	TEXTBUF *tb = checked_malloc(sizeof(TEXTBUF));
+	tb->data = checked_malloc(cap);
+	tb->len = 0;
+	tb->cap = cap;
+	tb->ofp = ofp;
+	tb->precision = precision;
+	tb->failed = 0;
+
+	return tb;
+}
+
+void flushTEXTBUF( TEXTBUF *tb )
+{
+	if( tb->ofp == NULL ) return;
+	if( tb->len != 0 && !tb->failed && fwrite(tb->data, 1, tb->len, tb->ofp) != tb->len )
+	{
+		fprintf(stderr, "fwrite() failed to write all bytes.\n");
+		tb->failed = 1;
+	}
+	tb->len = 0;
+}
+
+void freeTEXTBUF( TEXTBUF *tb )
+{
+	if( tb == NULL ) return;
+
+	flushTEXTBUF(tb);
+	checked_free(tb->data);
+	checked_free(tb);
+}
+
+/* Make room for <n> more chars */
+static void reserve( TEXTBUF *tb, size_t n )
+{
+	if( tb->cap - tb->len < n && tb->ofp == NULL )
+	{
+		//all held in memory, so grow to fit
+		tb->cap = tb->cap * 2 > tb->len + n ? tb->cap * 2 : tb->len + n;
+		tb->data = checked_realloc(tb->data, tb->cap);
+	}
+	if( tb->cap - tb->len < n ) flushTEXTBUF(tb);
+	//a single piece bigger than the whole buffer
+	if( tb->cap < n )
+	{
+		tb->cap = n;
+		tb->data = checked_realloc(tb->data, tb->cap);
+	}
+}
+
+void tbPutString( TEXTBUF *tb, const char *s )
+{
+	size_t n = strlen(s);
+	reserve(tb, n);
+	memcpy(tb->data + tb->len, s, n);
+	tb->len += n;
+}
+
+void tbPutChar( TEXTBUF *tb, char c )
+{
+	reserve(tb, 1);
+	tb->data[tb->len++] = c;
+}
+
+void tbPutInt( TEXTBUF *tb, int value )
+{
+	reserve(tb, 12);
+	tb->len += formatInt(tb->data + tb->len, value);
+}
+
+void tbPutFloat( TEXTBUF *tb, float value )
+{
+	reserve(tb, MAX_FLOAT_CHARS);
+	tb->len += formatFloat(tb->data + tb->len, value, tb->precision);
+}
@@ -0,0 +1,48 @@
+#include <stdio.h>
+
+/* A large output buffer which text is formatted straight into, written out to the file with a single fwrite() whenever it fills up.  Without a file the text is kept in memory instead, the buffer growing to hold all of it. */
+typedef struct
+{
+	//the buffered text
+	char *data;
+	//number of chars in the buffer
+	size_t len;
+	//size of the buffer
+	size_t cap;
+	//where the text ends up, NULL to keep it in <data>
+	FILE *ofp;
+	//digits printed after the decimal point for floats, or FLOAT_SHORTEST
+	int precision;
+	//set if writing to the file failed, anything more is discarded
+	int failed;
+} TEXTBUF;
+
+//precision selecting the shortest text that reads back as exactly the same float
+#define FLOAT_SHORTEST -1
+//the most digits after the decimal point allowed in fixed precision mode
+#define MAX_FLOAT_PRECISION 12
+//formatFloat() never writes more chars than this (including the terminator)
+#define MAX_FLOAT_CHARS 64
+
+//default size of a TEXTBUF
+#define TEXTBUF_SIZE (1 << 20)
+
+/* Format <value> into <out> as text (without going through printf).  With a precision of FLOAT_SHORTEST it produces the fewest digits that read back as the identical float, otherwise exactly what printf("%.*f") would.  Returns the number of chars written, not counting the terminator. */
+int formatFloat( char *out, float value, int precision );
+
+/* Format an integer into <out> (at least 12 chars) returning the number of chars written */
+int formatInt( char *out, int value );
+
+/* Create a TEXTBUF of <cap> bytes writing to <ofp>, or just holding the text if <ofp> is NULL */
+TEXTBUF *createTEXTBUF( FILE *ofp, size_t cap, int precision );
+
+/* Write out anything buffered, setting <failed> if the file can't be written (nothing happens without a file) */
+void flushTEXTBUF( TEXTBUF *tb );
+
+/* Flush and free a TEXTBUF (the FILE is left open) */
+void freeTEXTBUF( TEXTBUF *tb );
+
+void tbPutString( TEXTBUF *tb, const char *s );
+void tbPutChar( TEXTBUF *tb, char c );
+void tbPutInt( TEXTBUF *tb, int value );
+void tbPutFloat( TEXTBUF *tb, float value );
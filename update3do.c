@@ -1,15 +1,51 @@
-/* Accept a MODL structure and an OBJ structure, and where the name of a group in the OBJ file resembles a MESH in the MODL structure, update the MODL structure with that information.   Allows an edited .obj model to "update"  a .3do file. */
+/* Accept a MODL structure and an OBJ structure, and where the name of a group in the OBJ file resembles a MESH in the MODL structure, update the MODL structure with that information.   Allows an edited .obj model to "update"  a .3do file.
 
-#include "objStructs.h"	
+A mesh is only rebuilt if its group differs from what the mesh itself would be written out as, so the meshes nobody edited keep everything the .obj can't hold (face types, extra light etc.) exactly as read. */
+
+#include "objStructs.h"	//(brings in nameIndex.h)
 #include "modl.h"
 #include "checkedMem.h"
 #include "matScaler.h"
+#include "stats.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 //for sqrt
 #include <math.h>
 
+//characters Blender (and others) decorate names with, i.e "head.001" or "head_head"
+#define NAME_SEPARATORS "._- :"
+//marks a decorated name shared by more than one group
+#define AMBIGUOUS_GROUP (1 << 30)
+
+//a material of the OBJ not looked up in the MODL yet
+#define UNRESOLVED_MATERIAL -2
+
+//for telling whether a group is the same as its mesh, FNV-1a taken a 4 byte word at a time (everything hashed but the names is ints and floats, so how the data is split between calls doesn't matter) with a shift to mix the high bits back down
+#define HASH_START 14695981039346656037ULL
+#define HASH_PRIME 1099511628211ULL
+
+/* The groups of an OBJ indexed by name, built once per merge */
+typedef struct
+{
+    //the exact group names
+    NAMEINDEX *exact;
+    //each part of a group name before or after a separator
+    NAMEINDEX *decorated;
+    //set once a group has been merged into a mesh
+    int *used;
+    //set if a mesh of the MODL has exactly the group's name, so no other mesh takes it by a decorated name
+    int *claimed;
+    //the MODL material for each of the OBJ's material IDs, looked up the first time a face uses it (-1 if there isn't one)
+    int *materials;
+    //dimensions of each MODL material, see materialDimensions()
+    float *matWidths;
+    float *matHeights;
+    //the last material named in the .obj so far, which the faces without one carry on with
+    const char *carriedMaterial;
+} GROUPINDEX;
+
 //need to adjust the normals data such that it can be index by the
 //vertex index, not by an individual index
 //do this in readOBJ, not here
@@ -49,14 +85,220 @@ void setFaceNormal(FACE *face, float x, float y, float z)
     return;
 }
 
+/* Determine which material to use based on the name specified in the .obj file, -1 if none corresponds */
+int matchMaterial(MODL *model, const char *name)
+{
+    countStat(STAT_MATERIAL_LOOKUPS, 1);
+
+    //check for an exact matching name
+    for(int i=0; i < model->numMaterials; i++)
+    {
+	//if the .obj material name matches one in the MODL use it
+	if(strcmp(model->materialNames[i], name) == 0) return i;
+    }
+
+    //if we dont find a material with that exact name,
+    //look for one which has the significant part of it as a substring
+    //i.e if there is a texture gl_chest.mat and gl_chest appears in the material name use it 
+    char buffer[33];
+    for(int i=0; i < model->numMaterials; i++)
+    {
+	//find the significant part of this material name
+	strncpy(buffer, model->materialNames[i], 33);
+	//locate the first fullstop in the name and terminate the string there
+	char *dot = strchr(buffer, '.');
+	if(dot != NULL)
+	{
+	    *dot = '\0';
+	}
+
+	//if the .obj material name has one of the materials as a substring
+	if(strstr(name, buffer) != NULL) return i;
+    }
+
+    //if still not found, report taht we are using the deafult
+    fprintf(stderr, "Could not find a corresponding material for %s\n", name);
+    return -1;
+}
+
+uint64_t hashBytes(uint64_t hash, const void *data, size_t n)
+{
+    const unsigned char *p = data;
+    size_t i = 0;
+    for(; i+4 <= n; i+=4)
+    {
+	uint32_t word;
+	memcpy(&word, p + i, 4);
+	hash = (hash ^ word) * HASH_PRIME;
+	hash ^= hash >> 32;
+    }
+    //(only strings have bytes left over, the same on both sides)
+    for(; i<n; i++) hash = (hash ^ p[i]) * HASH_PRIME;
+    return hash;
+}
+
+uint64_t hashInt(uint64_t hash, int value)
+{
+    return hashBytes(hash, &value, sizeof(int));
+}
+
+//a face's material, by name as that is all the .obj keeps (0 for none)
+uint64_t hashMaterial(uint64_t hash, const char *name)
+{
+    if(name == NULL) return hashInt(hash, 0);
+    hash = hashInt(hash, 1);
+    return hashBytes(hash, name, strlen(name) + 1);
+}
+
+/* Hash a group's geometry: the vertices, texture vertices, normals, then each face's index triplets and material */
+uint64_t groupHash(OBJ *obj, GROUP *group)
+{
+    uint64_t hash = HASH_START;
+    hash = hashInt(hash, group->numVertices);
+    hash = hashBytes(hash, group->vertices, sizeof(vector3)*group->numVertices);
+    hash = hashInt(hash, group->numTexVertices);
+    hash = hashBytes(hash, group->texVertices, sizeof(vector2)*group->numTexVertices);
+    hash = hashInt(hash, group->numNormals);
+    hash = hashBytes(hash, group->normals, sizeof(vector3)*group->numNormals);
+
+    hash = hashInt(hash, group->numFaces);
+    for(int i=0; i<group->numFaces; i++)
+    {
+	OBJFACE *of = group->faces[i];
+	hash = hashInt(hash, of->numVertices);
+	hash = hashBytes(hash, of->indices, sizeof(indexTriplet)*of->numVertices);
+	hash = hashMaterial(hash, of->materialID >= 0 ? obj->materialNames[of->materialID] : NULL);
+    }
+    return hash;
+}
+
+/* Whether a group has as many of everything as the mesh would be written out with, before going to the trouble of hashing them */
+int sameSize(MESH *mesh, GROUP *group)
+{
+    return group->numVertices == mesh->numVertices && group->numNormals == mesh->numVertices && group->numTexVertices == mesh->numTexVertices && group->numFaces == mesh->numFaces;
+}
+
+/* The material in effect after a mesh is written out, <carried> being the one in effect before it */
+const char *lastMaterial(MODL *model, MESH *mesh, const char *carried)
+{
+    for(int i=mesh->numFaces-1; i>=0; i--)
+    {
+	if(mesh->faces[i].hasMaterial != 0) return model->materialNames[mesh->faces[i].materialIndex];
+    }
+    return carried;
+}
+
+/* A copy of a mesh's texture vertices as printObj() writes them, scaled by the material of the first face to use each one like scaleMeshTexVerts().  The caller frees it. */
+vector2 *scaledTexVertices(GROUPINDEX *index, MESH *mesh)
+{
+    vector2 *texVertices = checked_malloc(sizeof(vector2)*(mesh->numTexVertices + 1));
+    if(mesh->numTexVertices > 0) memcpy(texVertices, mesh->texVertices, sizeof(vector2)*mesh->numTexVertices);
+    char *isScaled = checked_calloc(mesh->numTexVertices + 1, 1);
+    for(int i=0; i<mesh->numFaces; i++)
+    {
+	FACE *face = &mesh->faces[i];
+	if(face->hasMaterial == 0) continue;
+	int *texVertexIndices = mesh->faceTexVertexIndices + mesh->faceOffsets[i];
+	for(int j=0; j<face->numVertices; j++)
+	{
+	    int t = texVertexIndices[j];
+	    if(isScaled[t]) continue;
+	    texVertices[t][0] /= index->matWidths[face->materialIndex];
+	    texVertices[t][1] /= index->matHeights[face->materialIndex];
+	    isScaled[t] = 1;
+	}
+    }
+    checked_free(isScaled);
+    return texVertices;
+}
+
+/* Hash a mesh the same way as groupHash(), as it would be read back from the .obj printMesh() writes for it at <meshOffset>.  Faces without a material are read back with the last one named, starting from <carried>. */
+uint64_t meshHash(MODL *model, GROUPINDEX *index, MESH *mesh, float meshOffset[3], const char *carried)
+{
+    uint64_t hash = HASH_START;
+    hash = hashInt(hash, mesh->numVertices);
+    for(int i=0; i<mesh->numVertices; i++)
+    {
+	vector3 v;
+	for(int j=0; j<3; j++) v[j] = mesh->vertices[i][j] + meshOffset[j];
+	hash = hashBytes(hash, v, sizeof(vector3));
+    }
+
+    vector2 *texVertices = scaledTexVertices(index, mesh);
+    hash = hashInt(hash, mesh->numTexVertices);
+    hash = hashBytes(hash, texVertices, sizeof(vector2)*mesh->numTexVertices);
+    checked_free(texVertices);
+
+    //one normal per vertex
+    hash = hashInt(hash, mesh->numVertices);
+    hash = hashBytes(hash, mesh->normals, sizeof(vector3)*mesh->numVertices);
+
+    hash = hashInt(hash, mesh->numFaces);
+    for(int i=0; i<mesh->numFaces; i++)
+    {
+	FACE *face = &mesh->faces[i];
+	int *vertexIndices = mesh->faceVertexIndices + mesh->faceOffsets[i];
+	int *texVertexIndices = mesh->faceTexVertexIndices + mesh->faceOffsets[i];
+	hash = hashInt(hash, face->numVertices);
+	for(int j=0; j<face->numVertices; j++)
+	{
+	    //NOTE: .obj indices start from 1, and the normals are indexed like the vertices
+	    indexTriplet t = { vertexIndices[j] + 1, texVertexIndices[j] + 1, vertexIndices[j] + 1 };
+	    hash = hashBytes(hash, t, sizeof(indexTriplet));
+	}
+	if(face->hasMaterial != 0) carried = model->materialNames[face->materialIndex];
+	hash = hashMaterial(hash, carried);
+    }
+    return hash;
+}
+
+/* Whether a group (already the same size, see sameSize()) holds exactly what meshHash() hashes for the mesh, so matching hashes are never mistaken for an unchanged mesh */
+int sameGeometry(MODL *model, OBJ *obj, GROUPINDEX *index, MESH *mesh, GROUP *group, float meshOffset[3], const char *carried)
+{
+    for(int i=0; i<mesh->numVertices; i++)
+    {
+	vector3 v;
+	for(int j=0; j<3; j++) v[j] = mesh->vertices[i][j] + meshOffset[j];
+	if(memcmp(v, group->vertices[i], sizeof(vector3)) != 0) return 0;
+    }
+
+    vector2 *texVertices = scaledTexVertices(index, mesh);
+    int same = memcmp(texVertices, group->texVertices, sizeof(vector2)*mesh->numTexVertices) == 0;
+    checked_free(texVertices);
+    if(!same) return 0;
+
+    if(memcmp(mesh->normals, group->normals, sizeof(vector3)*mesh->numVertices) != 0) return 0;
+
+    for(int i=0; i<mesh->numFaces; i++)
+    {
+	FACE *face = &mesh->faces[i];
+	OBJFACE *of = group->faces[i];
+	if(of->numVertices != face->numVertices) return 0;
+	int *vertexIndices = mesh->faceVertexIndices + mesh->faceOffsets[i];
+	int *texVertexIndices = mesh->faceTexVertexIndices + mesh->faceOffsets[i];
+	for(int j=0; j<face->numVertices; j++)
+	{
+	    if(of->indices[j][0] != vertexIndices[j] + 1 || of->indices[j][1] != texVertexIndices[j] + 1 || of->indices[j][2] != vertexIndices[j] + 1) return 0;
+	}
+	if(face->hasMaterial != 0) carried = model->materialNames[face->materialIndex];
+	const char *name = of->materialID >= 0 ? obj->materialNames[of->materialID] : NULL;
+	if((name == NULL) != (carried == NULL) || (name != NULL && strcmp(name, carried) != 0)) return 0;
+    }
+    return 1;
+}
+
 //update a MESH structure with the info from a GROUP structure
-void updateMesh(MODL *model, MESH *mesh, GROUP *group, float meshOffset[3])
+void updateMesh(MODL *model, OBJ *obj, GROUPINDEX *index, MESH *mesh, GROUP *group, float meshOffset[3])
 {
+    //write3do() can no longer copy it from the original file
+    changedMESH(mesh);
+
 //update the vertice array
     
     //replace the mesh vertice array with the group vertice array
+    int oldNumVertices = mesh->numVertices;
     mesh->numVertices = group->numVertices;
-    free(mesh->vertices);   //we had allocated memory for this
+    freeModlBlock(model, mesh->vertices);   //we had allocated memory for this
     mesh->vertices = group->vertices;
     //sever the pointer from the GROUP structure (so the memory isnt interfered with)
     group->vertices = NULL;   
@@ -73,60 +315,64 @@ void updateMesh(MODL *model, MESH *mesh, GROUP *group, float meshOffset[3])
 
     //update the texture vertice array
     mesh->numTexVertices = group->numTexVertices;
-    free(mesh->texVertices);
+    freeModlBlock(model, mesh->texVertices);
     mesh->texVertices = group->texVertices;
     group->texVertices = NULL;
     
     //update the normals array
     //reallocate the array to the correct size
-    mesh->normals = checked_realloc(mesh->normals, sizeof(vector3)*mesh->numVertices);
+    mesh->normals = reallocModlBlock(model, mesh->normals, sizeof(vector3)*oldNumVertices, sizeof(vector3)*mesh->numVertices);
     //remember as we update each normal (while updating the FACE's)
     int *isUpdated = checked_calloc(mesh->numVertices, sizeof(int));
 
-    //update the face array
-    //free the old FACE structures
-    for(int i=0; i<mesh->numFaces; i++)
-    {
-	freeFACE(mesh->faces[i]);
-    }
-    //update the size of the face array
+    //update the face arrays
+    //free the old ones
+    freeModlBlock(model, mesh->faces);
+    freeModlBlock(model, mesh->faceOffsets);
+    freeModlBlock(model, mesh->faceVertexIndices);
+    freeModlBlock(model, mesh->faceTexVertexIndices);
+    //allocate new ones of the right size
     mesh->numFaces = group->numFaces;
-    mesh->faces = checked_realloc(mesh->faces, sizeof(FACE *)*mesh->numFaces);
-    //allocate new FACE structures
+    mesh->faces = checked_malloc(sizeof(FACE)*mesh->numFaces);
+    mesh->faceOffsets = checked_malloc(sizeof(int)*(mesh->numFaces + 1));
+    mesh->faceOffsets[0] = 0;
     for(int i=0; i<mesh->numFaces; i++)
     {
-	mesh->faces[i] = createFACE();
-	mesh->faces[i]->faceID = i; //guessing just face index
+	mesh->faceOffsets[i+1] = mesh->faceOffsets[i] + group->faces[i]->numVertices;
+	mesh->faces[i].faceID = i; //guessing just face index
 	//fill in some default values for most of it
-	setFaceDefaults(mesh, mesh->faces[i]);
+	setFaceDefaults(mesh, &mesh->faces[i]);
     }
+    int numIndices = mesh->faceOffsets[mesh->numFaces];
+    mesh->faceVertexIndices = checked_malloc(sizeof(int)*numIndices);
+    mesh->faceTexVertexIndices = checked_malloc(sizeof(int)*numIndices);
 
     //UPDATE EACH FACE
     for(int i=0; i<mesh->numFaces; i++)
     {
-	FACE *f = mesh->faces[i];
+	FACE *f = &mesh->faces[i];
 	OBJFACE *of = group->faces[i];
+	int *vertexIndices = mesh->faceVertexIndices + mesh->faceOffsets[i];
+	int *texVertexIndices = mesh->faceTexVertexIndices + mesh->faceOffsets[i];
 
 	f->numVertices = of->numVertices;
-	f->vertexIndices = checked_malloc(sizeof(int)*f->numVertices);
-	f->texVertexIndices = checked_malloc(sizeof(int)*f->numVertices);
 	for(int j=0; j<f->numVertices; j++)
 	{   
 	    //NOTE: .obj indices start from 1, so must subtract 1 from each type of index
-	    f->vertexIndices[j] = of->indices[j][0] - 1;
-	    f->texVertexIndices[j] = of->indices[j][1] - 1;
+	    vertexIndices[j] = of->indices[j][0] - 1;
+	    texVertexIndices[j] = of->indices[j][1] - 1;
 	    
 
 	    //normals not needed in each FACE but must update array in the outer MESH	   
 	    int normalIndex = of->indices[j][2] - 1;
 	    //if the normal for this vertex has not been updated yet
-	    if(isUpdated[f->vertexIndices[j]] != 1)
+	    if(isUpdated[vertexIndices[j]] != 1)
 	    {
 		//destination and source of the normal data
-		float *dn = mesh->normals[f->vertexIndices[j]];
+		float *dn = mesh->normals[vertexIndices[j]];
 		float *sn = group->normals[normalIndex]; 
 		
-		//float *sn = mesh->vertices[f->vertexIndices[j]];
+		//float *sn = mesh->vertices[vertexIndices[j]];
 		
 		//copy it over
 		for(int k=0; k<3; k++) dn[k] = sn[k];
@@ -146,59 +392,16 @@ void updateMesh(MODL *model, MESH *mesh, GROUP *group, float meshOffset[3])
 		dn[2] = z;
 		*/
 
-		isUpdated[f->vertexIndices[j]] = 1;
+		isUpdated[vertexIndices[j]] = 1;
 	    }
 	}
 
-	/* Determine which material to use based on the name specified in the .obj file */
+	//each distinct name is only matched against the MODL's materials once
 	if(f->hasMaterial != 0)
 	{
-	    //check for an exact matching name
-	    int found = 0;
-	    for(int i=0; i < model->numMaterials; i++)
-	    {
-		//if the .obj material name matches one in the MODL
-		if(strcmp(model->materialNames[i], of->materialName) == 0)
-		{
-		    //use this material and stop searching
-		    f->materialIndex = i;
-		    found = 1;
-		    break;
-
-		}
-	    }
-	    //if we dont find a material with that exact name,
-	    //look for one which has the significant part of it as a substring
-	    //i.e if there is a texture gl_chest.mat and gl_chest appears in the material name use it 
-	    if(found == 0)
-	    {
-		    char buffer[33];
-		    for(int i=0; i < model->numMaterials; i++)
-		    {
-			//find the significant part of this material name
-			strncpy(buffer, model->materialNames[i], 33);
-			//locate the first fullstop in the name and terminate the string there
-			char *dot = strchr(buffer, '.');
-			if(dot != NULL)
-			{
-			    *dot = '\0';
-			}
-			
-			//if the .obj material name has one of the materials as a substring
-		    	if(strstr(of->materialName, buffer) != NULL)
-			{
-				f->materialIndex = i;
-				found = 1;
-				break;
-			}
-		    }
-	    }
-
-	    //if still not found, report taht we are using the deafult
-	    if(found == 0)
-	    {
-	    	fprintf(stderr, "Could not find a corresponding material for %s\n", of->materialName);
-	    }
+	    int *m = &index->materials[of->materialID];
+	    if(*m == UNRESOLVED_MATERIAL) *m = matchMaterial(model, obj->materialNames[of->materialID]);
+	    if(*m != -1) f->materialIndex = *m;
 	}
     }
     //FINISHED updating faces
@@ -215,17 +418,104 @@ void updateMesh(MODL *model, MESH *mesh, GROUP *group, float meshOffset[3])
 	}
     }
     //no longer need this
-    free(isUpdated);
+    checked_free(isUpdated);
     
     //resize the extra light data and unknown2 arrays appropriately   
+    freeModlBlock(model, mesh->lightData);
+    freeModlBlock(model, mesh->unknown2);
     mesh->lightData = checked_calloc(mesh->numVertices, sizeof(float));	//all 0.0 is default
     mesh->unknown2 = checked_calloc(mesh->numVertices, sizeof(int)); //dont know what this does, or even what type it should be, set to 0 with calloc and see what happens
 
     return;
 }
 
+//add one of the decorated forms of a group's name
+void addDecorated(NAMEINDEX *decorated, const char *name, size_t length, int group)
+{
+    if(length == 0) return;
+    int *g = nameIndexInsert(decorated, name, length, group);
+    if((*g & ~AMBIGUOUS_GROUP) != group) *g |= AMBIGUOUS_GROUP;
+}
+
+//index the groups by their exact names, and by the pieces of them Blender may have added to (i.e "head" for "head.001")
+GROUPINDEX *createGROUPINDEX(MODL *model, OBJ *obj)
+{
+    GROUPINDEX *index = checked_malloc(sizeof(GROUPINDEX));
+    index->exact = createNAMEINDEX(obj->numGroups);
+    index->decorated = createNAMEINDEX(obj->numGroups * 2);
+    index->used = checked_calloc(obj->numGroups > 0 ? obj->numGroups : 1, sizeof(int));
+    index->claimed = checked_calloc(obj->numGroups > 0 ? obj->numGroups : 1, sizeof(int));
+    index->materials = checked_malloc(sizeof(int) * (obj->numMaterials + 1));
+    for(int i=0; i<obj->numMaterials; i++) index->materials[i] = UNRESOLVED_MATERIAL;
+    materialDimensions(model->materialNames, model->numMaterials, &index->matWidths, &index->matHeights);
+    //(the .obj reader gives faces before any usemtl an empty name)
+    index->carriedMaterial = "";
+
+    for(int i=0; i<obj->numGroups; i++)
+    {
+	char *name = obj->groups[i]->groupName;
+	int *g = nameIndexInsert(index->exact, name, strlen(name), i);
+	if(*g != i) fprintf(stderr, "More than one group is named %s, only the first is used\n", name);
+
+	for(char *c = name; *c != '\0'; c++)
+	{
+	    if(strchr(NAME_SEPARATORS, *c) == NULL) continue;
+	    addDecorated(index->decorated, name, c - name, i);
+	    addDecorated(index->decorated, c + 1, strlen(c + 1), i);
+	}
+    }
+
+    //the exact matches all come first, whatever order the meshes are merged in
+    for(int i=0; i<model->numMeshes; i++)
+    {
+	char *name = model->meshes[i]->meshName;
+	int g = nameIndexFind(index->exact, name);
+	if(g != -1) index->claimed[g] = 1;
+    }
+
+    return index;
+}
+
+void freeGROUPINDEX(GROUPINDEX *index)
+{
+    freeNAMEINDEX(index->exact);
+    freeNAMEINDEX(index->decorated);
+    checked_free(index->used);
+    checked_free(index->claimed);
+    checked_free(index->materials);
+    checked_free(index->matWidths);
+    checked_free(index->matHeights);
+    checked_free(index);
+}
+
+/* Find the group for a mesh: the one with exactly the same name, otherwise one named like it with a prefix or suffix added (unless another mesh has exactly its name).  Each group can only be merged into one mesh.  Returns NULL if there isn't one. */
+GROUP *findGroup(GROUPINDEX *index, OBJ *obj, char *meshName)
+{
+    int g = nameIndexFind(index->exact, meshName);
+    if(g == -1)
+    {
+	g = nameIndexFind(index->decorated, meshName);
+	//not the group of another mesh with a longer name, i.e "arm_l" for "arm"
+	if(g != -1 && index->claimed[g & ~AMBIGUOUS_GROUP]) g = -1;
+	if(g != -1 && (g & AMBIGUOUS_GROUP))
+	{
+	    g &= ~AMBIGUOUS_GROUP;
+	    fprintf(stderr, "More than one group is named like %s, using %s\n", meshName, obj->groups[g]->groupName);
+	}
+    }
+    if(g == -1) return NULL;
+
+    if(index->used[g])
+    {
+	fprintf(stderr, "Group %s is already merged into another mesh, not using it for %s\n", obj->groups[g]->groupName, meshName);
+	return NULL;
+    }
+    index->used[g] = 1;
+    return obj->groups[g];
+}
+
 //recursively step trhough node hierarchy, updating meshes
-void updateMeshes(MODL *model, OBJ *obj, NODE *node, float parentOffset[3])
+void updateMeshes(MODL *model, OBJ *obj, GROUPINDEX *index, NODE *node, float parentOffset[3])
 {
     //accumulate this node's offset to pass further on
     float nodeOffset[3];
@@ -234,40 +524,40 @@ void updateMeshes(MODL *model, OBJ *obj, NODE *node, float parentOffset[3])
     float meshOffset[3];
     for(int i=0; i<3; i++) meshOffset[i] = nodeOffset[i] + node->pivot[i];
 
-    //if this has a mesh
-    if(node->meshID != -1)
+    //if this has a mesh (which was asked for, meshes left pending or unwanted by read3doLazy() are kept as they are)
+    if(node->meshID != -1 && !model->meshes[node->meshID]->pending && !model->meshes[node->meshID]->unwanted)
     {
 	//if the OBJ structure has an equivalent, update the mesh
 	MESH *mesh = model->meshes[node->meshID];
-	int found = 0;
-	for(int i=0; i<obj->numGroups; i++)
+	GROUP *group = findGroup(index, obj, mesh->meshName);
+	//the materials carry on through the .obj as the original meshes were written out
+	const char *carried = index->carriedMaterial;
+	index->carriedMaterial = lastMaterial(model, mesh, carried);
+	if(group == NULL) fprintf(stderr, "Found no group corresponding to %s\n", mesh->meshName);
+	//a group that is just the mesh written out leaves the mesh as it is, the hashes rule out most changes cheaply and the data itself confirms a match
+	else if(!sameSize(mesh, group) || groupHash(obj, group) != meshHash(model, index, mesh, meshOffset, carried) || !sameGeometry(model, obj, index, mesh, group, meshOffset, carried))
 	{
-	    GROUP *group = obj->groups[i];
-	    //if the group name has the mesh name as a substring
-	    if(strstr(group->groupName, mesh->meshName) != NULL)
-	    {
-		//update
-		updateMesh(model, mesh, group, meshOffset);
-		found = 1;
-		//stop searching
-		break;
-	    }
+	    updateMesh(model, obj, index, mesh, group, meshOffset);
+	    //scale the texture vertices back from the .obj specification
+	    scaleMeshTexVerts(mesh, index->matWidths, index->matHeights, 1);
+	    countStat(STAT_MESHES, 1);
+	    countStat(STAT_VERTICES, mesh->numVertices);
+	    countStat(STAT_FACES, mesh->numFaces);
 	}
-	if(found == 0) fprintf(stderr, "Found no group corresponding to %s\n", mesh->meshName);
     }
 
     //recurse on any child nodes (if it has any)
     if(node->hasChildren != 0)
     {
 	//just recurse on the first child, which itself will recurse on any siblings (see below)
-	updateMeshes(model, obj, model->nodes[node->childID], nodeOffset);
+	updateMeshes(model, obj, index, model->nodes[node->childID], nodeOffset);
     }
 
     //recurse on any sibling nodes (if it has any)
     if(node->hasSibling != 0)
     {
 	//siblings share the same offset of their parents
-	updateMeshes(model, obj, model->nodes[node->siblingID], parentOffset);
+	updateMeshes(model, obj, index, model->nodes[node->siblingID], parentOffset);
     }
 
     return;
@@ -287,18 +577,22 @@ void update3do(MODL *model, OBJ *obj)
 	return;
     }
 
+    beginPhase("update3do");
+    countStat(STAT_GROUPS, obj->numGroups);
+
     //need to recursively step through the node hierarchy, maintaining an
     //offset to subtract from each vertices
     //(reverse of writeObj)
     if(model->numNodes != 0)
     {
 	float startingOffset[3] = {0.0, 0.0, 0.0};
+	//look up groups by name rather than searching them all for every mesh
+	GROUPINDEX *index = createGROUPINDEX(model, obj);
 	//start it off with the first node
-	updateMeshes(model, obj, model->nodes[0], startingOffset);
+	updateMeshes(model, obj, index, model->nodes[0], startingOffset);
+	freeGROUPINDEX(index);
     }
 
-    //scale all the textures back from the .obj specification
-    scaleTexVerts(model, 1); 
-
+    endPhase();
     return;
 }
@@ -0,0 +1,266 @@
+/* Walking a .3do file held in memory, calling a VISITOR for each part of it (see visit3do.h).  Follows the same layout as read3do.c but never allocates anything for the model. */
+
+#include "modl.h"
+#include "visit3do.h"
+#include "mapFile.h"
+#include "cursor.h"
+
+#include <stdio.h>
+#include <string.h>
+
+//what each part of the walk returns
+#define VISIT_OK 0
+#define VISIT_STOPPED 1
+#define VISIT_FAILED -1
+
+/* Copy a <numBytes> byte string out of the data into <dest>, which has room for a terminator */
+static void copyName( char *dest, const unsigned char *p, size_t numBytes )
+{
+	strncpy(dest, (const char *)p, numBytes);
+	dest[numBytes] = '\0';
+}
+
+/* Step over an array of <count> elements each <size> bytes, returning where it is in the data (NULL if empty or the data has run out) */
+static const void *takeArrayOf( CURSOR *c, int count, size_t size )
+{
+	if( count == 0 ) return NULL;
+
+	return takeBytes(c, size * count);
+}
+
+static int visitFace( CURSOR *c, VISITOR *v, const VISITMESH *mesh, int index )
+{
+	const unsigned char *h = takeBytes(c, FACE_HEADER_SIZE);
+	if( h == NULL ) return VISIT_FAILED;
+
+	//the fixed part is all there, so decode it with a cursor of its own
+	CURSOR fc = { h, FACE_HEADER_SIZE, 0, 0 };
+	FACE face;
+	face.faceID = takeInt(&fc);
+	face.faceType = takeInt(&fc);
+	face.geometryMode = takeInt(&fc);
+	face.lightingMode = takeInt(&fc);
+	face.textureMode = takeInt(&fc);
+	face.numVertices = checkCount(c, takeInt(&fc));
+	face.unknown1 = takeInt(&fc);
+	face.hasTexture = takeInt(&fc);
+	face.hasMaterial = takeInt(&fc);
+	takeBlock(&fc, face.unknown2, 12);
+	face.extraLight = takeFloat(&fc);
+	takeBlock(&fc, face.unknown3, 12);
+	takeBlock(&fc, face.faceNormal, 12);
+	face.materialIndex = 0;
+
+	const int *vertexIndices = takeArrayOf(c, face.numVertices, sizeof(int));
+	const int *texVertexIndices = NULL;
+	if( face.hasTexture != 0 ) texVertexIndices = takeArrayOf(c, face.numVertices, sizeof(int));
+	if( face.hasMaterial != 0 )
+	{
+		const unsigned char *m = takeBytes(c, 4);
+		if( m != NULL ) face.materialIndex = peekInt(m);
+	}
+	if( c->failed ) return VISIT_FAILED;
+
+	if( v->face != NULL && v->face(v->data, mesh, index, &face, vertexIndices, texVertexIndices) != 0 ) return VISIT_STOPPED;
+
+	return VISIT_OK;
+}
+
+static int visitMesh( CURSOR *c, VISITOR *v, int index )
+{
+	VISITMESH mesh;
+	memset(&mesh, 0, sizeof(VISITMESH));
+	mesh.index = index;
+	mesh.offset = c->pos;
+
+	const unsigned char *h = takeBytes(c, MESH_HEADER_SIZE);
+	if( h == NULL ) return VISIT_FAILED;
+	CURSOR hc = { h, MESH_HEADER_SIZE, 0, 0 };
+	copyName(mesh.name, takeBytes(&hc, 32), 32);
+	mesh.unknown1 = takeInt(&hc);
+	mesh.geometryMode = takeInt(&hc);
+	mesh.lightingMode = takeInt(&hc);
+	mesh.textureMode = takeInt(&hc);
+	mesh.numVertices = checkCount(c, takeInt(&hc));
+	mesh.numTexVertices = checkCount(c, takeInt(&hc));
+	mesh.numFaces = checkCount(c, takeInt(&hc));
+	if( c->failed ) return VISIT_FAILED;
+
+	if( v->meshHeader != NULL && v->meshHeader(v->data, &mesh) != 0 ) return VISIT_STOPPED;
+
+	/* VERTEX BLOCK */
+
+	mesh.vertices = (const vector3 *)takeArrayOf(c, mesh.numVertices, sizeof(vector3));
+	mesh.texVertices = (const vector2 *)takeArrayOf(c, mesh.numTexVertices, sizeof(vector2));
+	mesh.lightData = takeArrayOf(c, mesh.numVertices, sizeof(float));
+	mesh.unknown2 = takeArrayOf(c, mesh.numVertices, sizeof(int));
+	if( c->failed ) return VISIT_FAILED;
+
+	if( v->vertices != NULL && v->vertices(v->data, &mesh) != 0 ) return VISIT_STOPPED;
+
+	/* FACES */
+
+	for(int i=0; i < mesh.numFaces; i++)
+	{
+		int status = visitFace(c, v, &mesh, i);
+		if( status != VISIT_OK ) return status;
+	}
+
+	/* FOOTER */
+
+	mesh.normals = (const vector3 *)takeArrayOf(c, mesh.numVertices, sizeof(vector3));
+	const unsigned char *f = takeBytes(c, MESH_FOOTER_SIZE);
+	if( f == NULL ) return VISIT_FAILED;
+	CURSOR fc = { f, MESH_FOOTER_SIZE, 0, 0 };
+	mesh.hasShadow = takeInt(&fc);
+	mesh.unknown3 = takeInt(&fc);
+	mesh.meshRadius = takeFloat(&fc);
+	takeBlock(&fc, mesh.unknown4, 12);
+	takeBlock(&fc, mesh.unknown5, 12);
+
+	if( v->meshEnd != NULL && v->meshEnd(v->data, &mesh) != 0 ) return VISIT_STOPPED;
+
+	return VISIT_OK;
+}
+
+static int visitNode( CURSOR *c, VISITOR *v, int index )
+{
+	const unsigned char *n = takeBytes(c, NODE_FIXED_SIZE);
+	if( n == NULL ) return VISIT_FAILED;
+
+	CURSOR nc = { n, NODE_FIXED_SIZE, 0, 0 };
+	NODE node;
+	char name[64 + 1];
+	copyName(name, takeBytes(&nc, 64), 64);
+	node.name = name;
+	node.flags = takeInt(&nc);
+	node.unknown1 = takeInt(&nc);
+	node.type = takeInt(&nc);
+	node.meshID = takeInt(&nc);
+	node.depth = takeInt(&nc);
+	node.hasParent = takeInt(&nc);
+	node.numChildren = takeInt(&nc);
+	node.hasChildren = takeInt(&nc);
+	node.hasSibling = takeInt(&nc);
+	takeBlock(&nc, node.pivot, 12);
+	takeBlock(&nc, node.position, 12);
+	node.pitch = takeFloat(&nc);
+	node.yaw = takeFloat(&nc);
+	node.roll = takeFloat(&nc);
+	takeBlock(&nc, node.unknown2, 48);
+
+	//the ids are only present if flagged, -1 otherwise
+	const unsigned char *id;
+	node.parentID = node.childID = node.siblingID = -1;
+	if( node.hasParent != 0 && (id = takeBytes(c, 4)) != NULL )
+		node.parentID = peekInt(id);
+	if( node.hasChildren != 0 && (id = takeBytes(c, 4)) != NULL )
+		node.childID = peekInt(id);
+	if( node.hasSibling != 0 && (id = takeBytes(c, 4)) != NULL )
+		node.siblingID = peekInt(id);
+	if( c->failed ) return VISIT_FAILED;
+
+	if( v->node != NULL && v->node(v->data, index, &node) != 0 ) return VISIT_STOPPED;
+
+	return VISIT_OK;
+}
+
+/* The whole walk, in file order */
+static int visitAll( CURSOR *c, VISITOR *v )
+{
+	/* HEADER */
+
+	VISITHEADER header;
+	takeBytes(c, 4);
+	header.numMaterials = takeCount(c);
+	//the material names are a fixed size, so the header can be finished before visiting them
+	const unsigned char *materials = takeBytes(c, 32 * (size_t)header.numMaterials);
+	const unsigned char *h = takeBytes(c, 32 + 12);
+	if( c->failed ) return VISIT_FAILED;
+	CURSOR hc = { h, 32 + 12, 0, 0 };
+	copyName(header.modelName, takeBytes(&hc, 32), 32);
+	header.unknown1 = takeInt(&hc);
+	header.numGeosets = takeInt(&hc);
+	header.numMeshes = checkCount(c, takeInt(&hc));
+	if( c->failed ) return VISIT_FAILED;
+
+	if( v->header != NULL && v->header(v->data, &header) != 0 ) return VISIT_STOPPED;
+
+	if( v->material != NULL )
+	{
+		char name[32 + 1];
+		for(int i=0; i < header.numMaterials; i++)
+		{
+			copyName(name, materials + 32 * (size_t)i, 32);
+			if( v->material(v->data, i, name) != 0 ) return VISIT_STOPPED;
+		}
+	}
+
+	/* GEOSET */
+
+	for(int i=0; i < header.numMeshes; i++)
+	{
+		int status = visitMesh(c, v, i);
+		if( status != VISIT_OK ) return status;
+	}
+
+	/* NODES */
+
+	VISITFOOTER footer;
+	const unsigned char *n = takeBytes(c, 8);
+	if( n == NULL ) return VISIT_FAILED;
+	footer.unknown2 = peekInt(n);
+	footer.numNodes = checkCount(c, peekInt(n + 4));
+	if( c->failed ) return VISIT_FAILED;
+
+	for(int i=0; i < footer.numNodes; i++)
+	{
+		int status = visitNode(c, v, i);
+		if( status != VISIT_OK ) return status;
+	}
+
+	/* FOOTER */
+
+	const unsigned char *f = takeBytes(c, MODL_FOOTER_SIZE);
+	if( f == NULL ) return VISIT_FAILED;
+	CURSOR fc = { f, MODL_FOOTER_SIZE, 0, 0 };
+	footer.modelRadius = takeFloat(&fc);
+	takeBlock(&fc, footer.insertionOffset, 12);
+	takeBlock(&fc, footer.unknown3, 12);
+	takeBlock(&fc, footer.unknown4, 24);
+
+	if( v->footer != NULL && v->footer(v->data, &footer) != 0 ) return VISIT_STOPPED;
+
+	return VISIT_OK;
+}
+
+int visit3doData( const unsigned char *data, size_t size, VISITOR *visitor, char *filename )
+{
+	//check the fourcc code before anything else, it is the right type of file
+	if( size < 4 || strncmp((const char *)data, "LDOM", 4) != 0 )
+	{
+		fprintf(stderr, "%s is not a binary .3do file.\n", filename);
+		return VISIT_FAILED;
+	}
+
+	CURSOR cursor = { data, size, 0, 0 };
+	int status = visitAll(&cursor, visitor);
+	if( status == VISIT_FAILED ) fprintf(stderr, "%s is truncated or corrupt.\n", filename);
+
+	return status;
+}
+
+int visit3do( char *filename, VISITOR *visitor )
+{
+	MAPPEDFILE *mf = mapFile(filename);
+	if( mf == NULL )
+	{
+		printf("File %s could not be opened.\n", filename);
+		return VISIT_FAILED;
+	}
+
+	int status = visit3doData(mf->data, mf->size, visitor, filename);
+	unmapFile(mf);
+
+	return status;
+}
@@ -0,0 +1,81 @@
+/* Walking a .3do file section by section, handing each part to a callback as it is reached instead of building a MODL (include modl.h first).
+
+Nothing is allocated for the model, the arrays given to the callbacks point straight into the file data, so memory use stays the same however big the file is.  Useful when only part of a model is wanted, i.e counting or listing names over a whole directory of models. */
+
+/* The header of a .3do, up to the start of the first mesh */
+typedef struct
+{
+	int numMaterials;
+	char modelName[33];
+	int unknown1;
+	int numGeosets;
+	int numMeshes;
+} VISITHEADER;
+
+/* A mesh, filled in as the walk goes through it.  The arrays are NULL until their part of the mesh has been reached (and when empty). */
+typedef struct
+{
+	//position of the mesh in the file, and where its data starts (i.e for read3doMesh())
+	int index;
+	size_t offset;
+
+	char name[33];
+	int unknown1;
+	int geometryMode;
+	int lightingMode;
+	int textureMode;
+	int numVertices;
+	int numTexVertices;
+	int numFaces;
+
+	//the vertex block, set by the time of the vertices callback
+	const vector3 *vertices;
+	const vector2 *texVertices;
+	const float *lightData;
+	const int *unknown2;
+
+	//the rest, set by the time of the meshEnd callback
+	const vector3 *normals;
+	int hasShadow;
+	int unknown3;
+	float meshRadius;
+	vector3 unknown4;
+	vector3 unknown5;
+} VISITMESH;
+
+/* The footer of a .3do, after the last node */
+typedef struct
+{
+	int unknown2;
+	int numNodes;
+	float modelRadius;
+	vector3 insertionOffset;
+	vector3 unknown3;
+	int unknown4[6];
+} VISITFOOTER;
+
+/* The callbacks for each part of the file, in the order they happen.  Any can be NULL to skip that part.  Each returns 0 to carry on, anything else stops the walk there. */
+typedef struct
+{
+	//passed as the first argument of every callback
+	void *data;
+
+	int (*header)( void *data, const VISITHEADER *header );
+	int (*material)( void *data, int index, const char *name );
+
+	int (*meshHeader)( void *data, const VISITMESH *mesh );
+	int (*vertices)( void *data, const VISITMESH *mesh );
+	//the face's index lists, <texVertexIndices> is NULL without <hasTexture>
+	int (*face)( void *data, const VISITMESH *mesh, int index, const FACE *face, const int *vertexIndices, const int *texVertexIndices );
+	int (*meshEnd)( void *data, const VISITMESH *mesh );
+
+	//the node's name points to a buffer only valid during the call
+	int (*node)( void *data, int index, const NODE *node );
+	int (*footer)( void *data, const VISITFOOTER *footer );
+} VISITOR;
+
+/* Walk the .3do held in <data> (4 byte aligned, i.e from mapFile()) calling the visitor for each part.  Returns 0 once the whole file has been visited, 1 if a callback stopped it, or -1 if it is not a .3do or is truncated or corrupt (the callbacks may already have seen the parts before the problem).  <filename> is only used in messages. */
+int visit3doData( const unsigned char *data, size_t size, VISITOR *visitor, char *filename );
+
+/* Same as visit3doData() for a file, which is mapped into memory for the walk */
+int visit3do( char *filename, VISITOR *visitor );
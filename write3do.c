@@ -1,259 +1,819 @@
-/* Given a MODL structure (defined in modl.h) write it's contents to a binary .3do file as required for the game Grim Fandango. */
+/* Given a MODL structure (defined in modl.h) write it's contents to a binary .3do file as required for the game Grim Fandango.
+
+The exact size of the file is worked out first, then the whole thing is serialized into one buffer and written with a single fwrite().  Knowing the size of every section also gives where each mesh goes in the buffer, so the meshes of a large model are serialized on several threads at once.
+
+When the model was read from a .3do which hasn't changed since, the meshes and nodes that haven't been touched are instead copied straight from that file (with copy_file_range() where there is one), and only the rest is serialized.  If the file is being written over itself and every section is still where it was, just the changed sections are written into it in place. */
+
+//pread(), pwrite(), threads and sysconf() are POSIX, not C99, and copy_file_range() is only in Linux
+#ifdef __linux__
+#define _GNU_SOURCE
+#else
+#define _POSIX_C_SOURCE 200809L
+#endif
 
 #include "modl.h"
+#include "write3do.h"
+#include "checkedMem.h"
+#include "mapFile.h"
+#include "cursor.h" //sizes of the sections of the file
+#include "stats.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
 
-/* Delegates to fwrite, checks for failure, reports and terminates*/
-size_t checked_fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream)
+#define MIN_THREAD_BYTES (1 << 18)	//meshes are not serialized on more threads than they have this many bytes
+#define MAX_WRITE_THREADS 64
+
+//threads serializing meshes, 0 for one per processor
+static int writeThreads = 0;
+
+/* A write position within a buffer being filled with a .3do file */
+typedef struct
 {
-	size_t numWritten = fwrite(ptr, size, nmemb, stream);
-	if( numWritten != nmemb )
-	{
-		fprintf(stderr, "fwrite() failed to write all bytes.\n");
-		exit(EXIT_FAILURE);
-	}
+	unsigned char *data;
+	size_t pos;
+} OUTCURSOR;
 
-	//pass on the return value
-	return numWritten;
+/* Copy <n> bytes into the buffer */
+void putBlock( OUTCURSOR *o, const void *src, size_t n )
+{
+	memcpy(o->data + o->pos, src, n);
+	o->pos += n;
 }
 
-/* Write an integer to a filestream. */
-void writeInt( int value, FILE *stream )
+/* Write an integer to the buffer. */
+void putInt( OUTCURSOR *o, int value )
 {
-	checked_fwrite(&value, 4, 1, stream);
+	putBlock(o, &value, 4);
 }
 
-/* Write a float to a filestream. */
-void writeFloat( float value, FILE *stream )
+/* Write a float to the buffer. */
+void putFloat( OUTCURSOR *o, float value )
 {
-	checked_fwrite(&value, 4, 1, stream);
+	putBlock(o, &value, 4);
 }
 
-/* Write a string to a file stream, as a block of 32 characters, remainder padded with 0's */
-void writeString32( char *string, FILE *stream )
+/* Write a string to the buffer, as a block of 32 characters, remainder padded with 0's */
+void putString32( OUTCURSOR *o, char *string )
 {
-	int length = strlen(string);
+	size_t length = strlen(string);
 	if( length > 32 )
 	{
-		fprintf(stderr, "writeString32() passed %d chars\n", length);
+		fprintf(stderr, "putString32() passed %lu chars\n", (unsigned long)length);
 		exit(EXIT_FAILURE);
 	}
-	//write the string
-	checked_fwrite(string, 1, length, stream);
-	//write 0's for remainder of the block
-	int padSize = 32 - length;
-	char zero = '\0';	
-	for(int i=0; i< padSize; i++)
-	{
-		checked_fwrite(&zero, 1, 1, stream);
-	}
+	//write the string then 0's for remainder of the block
+	putBlock(o, string, length);
+	memset(o->data + o->pos, 0, 32 - length);
+	o->pos += 32 - length;
 
 	return;
 }
 
-/* Write a string toa file stream as a block of 64 characters, string + null terminator + remainder padded with 0xCC */
-void writeString64( char *string, FILE *stream )
+/* Write a string to the buffer as a block of 64 characters, string + null terminator + remainder padded with 0xCC.  A full 64 character name has no room for the terminator. */
+void putString64( OUTCURSOR *o, char *string )
 {
-	int length = strlen(string);
+	size_t length = strlen(string);
 	if( length > 64 )
 	{
-		fprintf(stderr, "writeString64() passed %d chars\n", length);
+		fprintf(stderr, "putString64() passed %lu chars\n", (unsigned long)length);
 		exit(EXIT_FAILURE);
 	}
-	//write the string WITH the 0 terminator
-	checked_fwrite(string, 1, length+1, stream);
+	//write the string WITH the 0 terminator (if there is room)
+	size_t used = length < 64 ? length + 1 : 64;
+	putBlock(o, string, used);
 	//write 0xCC for remainder of block
-	int padSize = 64 - (length + 1);
-	unsigned char pad = 0xCC;	//without unsigned was overflowing
-	for(int i=0; i < padSize; i++)
+	memset(o->data + o->pos, 0xCC, 64 - used);
+	o->pos += 64 - used;
+
+	return;
+}
+
+
+/* SIZING: the exact number of bytes each section will take up */
+
+/* Size of face <f> of a mesh */
+size_t sizeFaceSection( MESH *mesh, int f )
+{
+	FACE *face = &mesh->faces[f];
+	size_t size = FACE_HEADER_SIZE + 4 * (size_t)face->numVertices;
+	if( face->hasTexture != 0 ) size += 4 * (size_t)face->numVertices;
+	if( face->hasMaterial != 0 ) size += 4;
+
+	return size;
+}
+
+size_t sizeMeshSection( MESH *mesh )
+{
+	//not decoded, it is written out just as it was read
+	if( mesh->pending ) return mesh->sourceLength;
+
+	size_t size = MESH_HEADER_SIZE + MESH_FOOTER_SIZE;
+	//vertices, light data, unknown2 and normals
+	size += (sizeof(vector3) + sizeof(float) + sizeof(int) + sizeof(vector3)) * mesh->numVertices;
+	size += sizeof(vector2) * mesh->numTexVertices;
+	for(int i=0; i < mesh->numFaces; i++)
 	{
-		checked_fwrite(&pad, 1, 1, stream);
+		size += sizeFaceSection(mesh, i);
 	}
 
-	return;
+	return size;
+}
+
+size_t sizeNodeSection( NODE *node )
+{
+	size_t size = NODE_FIXED_SIZE;
+	if( node->hasParent != 0 ) size += 4;
+	if( node->hasChildren != 0 ) size += 4;
+	if( node->hasSibling != 0 ) size += 4;
+
+	return size;
 }
 
-/* Write a FACE structure to a file stream (.3do file) */
-void writeFace( FACE *face, FILE *ofp )
+/* Size of everything before the first mesh: fourcc, material count, material names, model name and the geoset header */
+size_t sizeHeaderSection( MODL *model )
 {
-	writeInt(face->faceID, ofp);
-	writeInt(face->faceType, ofp);
-	writeInt(face->geometryMode, ofp);
-	writeInt(face->lightingMode, ofp);
-	writeInt(face->textureMode, ofp);
-	writeInt(face->numVertices, ofp);
-	writeInt(face->unknown1, ofp);
-	writeInt(face->hasTexture, ofp);
-	writeInt(face->hasMaterial, ofp);
-	checked_fwrite(face->unknown2, 4, 3, ofp);
-	writeFloat(face->extraLight, ofp);
-	checked_fwrite(face->unknown3, 4, 3, ofp);
-	checked_fwrite(face->faceNormal, 4, 3, ofp);
-	
-	//write the mesh vertex indices
-	for(int i=0; i < face->numVertices; i++)
+	return 4 + 4 + 32 * (size_t)model->numMaterials + 32 + 12;
+}
+
+/* The exact size in bytes of the .3do file that write3do() would produce for this MODL */
+size_t size3doFile( MODL *model )
+{
+	//header then the meshes
+	size_t size = sizeHeaderSection(model);
+	for(int i=0; i < model->numMeshes; i++)
 	{
-		writeInt(face->vertexIndices[i], ofp);
+		size += sizeMeshSection(model->meshes[i]);
 	}
 
-	//write the texture vertexIndices (only if <hasTexture>)
-	if( face->hasTexture != 0 )
+	//node header then the nodes
+	size += 8;
+	for(int i=0; i < model->numNodes; i++)
 	{
-		for(int i=0; i < face->numVertices; i++)
-		{
-			writeInt(face->texVertexIndices[i], ofp);
-		}
+		size += sizeNodeSection(model->nodes[i]);
+	}
+
+	return size + MODL_FOOTER_SIZE;
+}
+
+
+/* SERIALIZING */
+
+/* Write face <f> of a MESH structure to the buffer */
+void putFace( OUTCURSOR *o, MESH *mesh, int f )
+{
+	FACE *face = &mesh->faces[f];
+	int *vertexIndices = mesh->faceVertexIndices + mesh->faceOffsets[f];
+	int *texVertexIndices = mesh->faceTexVertexIndices + mesh->faceOffsets[f];
+
+	putInt(o, face->faceID);
+	putInt(o, face->faceType);
+	putInt(o, face->geometryMode);
+	putInt(o, face->lightingMode);
+	putInt(o, face->textureMode);
+	putInt(o, face->numVertices);
+	putInt(o, face->unknown1);
+	putInt(o, face->hasTexture);
+	putInt(o, face->hasMaterial);
+	putBlock(o, face->unknown2, 12);
+	putFloat(o, face->extraLight);
+	putBlock(o, face->unknown3, 12);
+	putBlock(o, face->faceNormal, 12);
+
+	//write the mesh vertex indices, then the texture vertex indices (only if <hasTexture>)
+	size_t indexBytes = sizeof(int) * face->numVertices;
+	if( indexBytes != 0 )
+	{
+		putBlock(o, vertexIndices, indexBytes);
+		if( face->hasTexture != 0 ) putBlock(o, texVertexIndices, indexBytes);
 	}
 
 	//write the materialIndex only if <hasMaterial>
 	if( face->hasMaterial != 0 )
 	{
-		writeInt(face->materialIndex, ofp);
+		putInt(o, face->materialIndex);
 	}
 
 	return;
 }
 
-/* Write a MESH structure to a file stream (.3do file) */
-void writeMesh( MESH *mesh, FILE *ofp )
+/* Write a MESH structure to the buffer, each per vertex array in a single memcpy() */
+void putMesh( OUTCURSOR *o, MODL *model, MESH *mesh )
 {
-	writeString32(mesh->meshName, ofp);
-	writeInt(mesh->unknown1, ofp);
-	writeInt(mesh->geometryMode, ofp);
-	writeInt(mesh->lightingMode, ofp);
-	writeInt(mesh->textureMode, ofp);
-	writeInt(mesh->numVertices, ofp);
-	writeInt(mesh->numTexVertices, ofp);
-	writeInt(mesh->numFaces, ofp);
-
-	//write the mesh vertex data, (an array of vector3's)
-	for(int i=0; i < mesh->numVertices; i++)
+	if( mesh->pending )
 	{
-		checked_fwrite(mesh->vertices[i], 4, 3, ofp);	
+		//still in the file the model keeps, see read3doLazy()
+		MAPPEDFILE *mf = model->mapping;
+		putBlock(o, mf->data + mesh->sourceOffset, mesh->sourceLength);
+		return;
 	}
-	//write the texture vertex data (an array of vector2's)
-	for(int i=0; i < mesh->numTexVertices; i++)
+
+	putString32(o, mesh->meshName);
+	putInt(o, mesh->unknown1);
+	putInt(o, mesh->geometryMode);
+	putInt(o, mesh->lightingMode);
+	putInt(o, mesh->textureMode);
+	putInt(o, mesh->numVertices);
+	putInt(o, mesh->numTexVertices);
+	putInt(o, mesh->numFaces);
+
+	if( mesh->numVertices != 0 )
 	{
-		checked_fwrite(mesh->texVertices[i], 4, 2, ofp);
+		putBlock(o, mesh->vertices, sizeof(vector3) * mesh->numVertices);
 	}
-	//write the extra light data (an array of floats)
-	for(int i=0; i < mesh->numVertices; i++)
+	if( mesh->numTexVertices != 0 )
 	{
-		writeFloat(mesh->lightData[i], ofp);
-	}	
-	//write unknown2 data, 4 bytes per vertice
-	for(int i=0; i < mesh->numVertices; i++)
+		putBlock(o, mesh->texVertices, sizeof(vector2) * mesh->numTexVertices);
+	}
+	if( mesh->numVertices != 0 )
 	{
-		writeInt(mesh->unknown2[i], ofp);
+		putBlock(o, mesh->lightData, sizeof(float) * mesh->numVertices);
+		putBlock(o, mesh->unknown2, sizeof(int) * mesh->numVertices);
 	}
-	//write the face data
 	for(int i=0; i < mesh->numFaces; i++)
 	{
-		writeFace(mesh->faces[i], ofp);
+		putFace(o, mesh, i);
 	}
-	//write the vertex normals
-	for(int i=0; i < mesh->numVertices; i++)
+	if( mesh->numVertices != 0 )
 	{
-		checked_fwrite(mesh->normals[i], 4, 3, ofp);
+		putBlock(o, mesh->normals, sizeof(vector3) * mesh->numVertices);
 	}
 
-	writeInt(mesh->hasShadow, ofp);
-	writeInt(mesh->unknown3, ofp);
-	writeFloat(mesh->meshRadius, ofp);
-	checked_fwrite(mesh->unknown4, 4, 3, ofp);
-	checked_fwrite(mesh->unknown5, 4, 3, ofp);
+	putInt(o, mesh->hasShadow);
+	putInt(o, mesh->unknown3);
+	putFloat(o, mesh->meshRadius);
+	putBlock(o, mesh->unknown4, 12);
+	putBlock(o, mesh->unknown5, 12);
 
 	return;
 }
 
-/* Write a NODE structure to a file stream (.3do file ) */
-void writeNode( NODE *node, FILE *ofp )
+/* Write a NODE structure to the buffer */
+void putNode( OUTCURSOR *o, NODE *node )
 {
 	//write the name as a block of 64 chars
-	writeString64(node->name, ofp);
-	writeInt(node->flags, ofp);
-	writeInt(node->unknown1, ofp);
-	writeInt(node->type, ofp);
-	writeInt(node->meshID, ofp);
-	writeInt(node->depth, ofp);
-	writeInt(node->hasParent, ofp);
-	writeInt(node->numChildren, ofp);
-	writeInt(node->hasChildren, ofp);
-	writeInt(node->hasSibling, ofp);
-	checked_fwrite(node->pivot, 4, 3, ofp);
-	checked_fwrite(node->position, 4, 3, ofp);
-	writeFloat(node->pitch, ofp);
-	writeFloat(node->yaw, ofp);
-	writeFloat(node->roll, ofp);
-	checked_fwrite(node->unknown2, 4, 12, ofp);
+	putString64(o, node->name);
+	putInt(o, node->flags);
+	putInt(o, node->unknown1);
+	putInt(o, node->type);
+	putInt(o, node->meshID);
+	putInt(o, node->depth);
+	putInt(o, node->hasParent);
+	putInt(o, node->numChildren);
+	putInt(o, node->hasChildren);
+	putInt(o, node->hasSibling);
+	putBlock(o, node->pivot, 12);
+	putBlock(o, node->position, 12);
+	putFloat(o, node->pitch);
+	putFloat(o, node->yaw);
+	putFloat(o, node->roll);
+	putBlock(o, node->unknown2, 48);
 	if(node->hasParent != 0)
-		writeInt(node->parentID, ofp);
+		putInt(o, node->parentID);
 	if(node->hasChildren != 0)
-		writeInt(node->childID, ofp);
+		putInt(o, node->childID);
 	if(node->hasSibling != 0)
-		writeInt(node->siblingID, ofp);
+		putInt(o, node->siblingID);
 
 	return;
 }
 
-/* Write a MODL structure as a binary .3do file with name <filename> */
-void write3do( MODL *model, char *filename )
+/* Write everything before the first mesh to the buffer */
+void putHeader( OUTCURSOR *o, MODL *model )
 {
-	//open the file for writing, check success
-	FILE *ofp = fopen(filename, "wb");
-	if( ofp == NULL )
+	/* HEADER SECTION*/
+
+	putBlock(o, model->fourcc, 4);
+	putInt(o, model->numMaterials);
+	//write each material name as a block of 32 chars
+	for(int i=0; i < model->numMaterials; i++)
 	{
-		fprintf(stderr, "Could not open %s for writing.\n", filename);
+		putString32(o, model->materialNames[i]);
+	}
+	putString32(o, model->modelName);
+
+	/* GEOSET SECTION */
+
+	putInt(o, model->unknown1);
+	putInt(o, model->numGeosets);
+	putInt(o, model->numMeshes);
+
+	return;
+}
+
+/* Write the start of the nodes section to the buffer */
+void putNodesHeader( OUTCURSOR *o, MODL *model )
+{
+	putInt(o, model->unknown2);
+	putInt(o, model->numNodes);
+
+	return;
+}
+
+/* Write the footer to the buffer */
+void putFooter( OUTCURSOR *o, MODL *model )
+{
+	putFloat(o, model->modelRadius);
+	putBlock(o, model->insertionOffset, 12);
+	putBlock(o, model->unknown3, 12);
+	putBlock(o, model->unknown4, 24);
+
+	return;
+}
+
+/* Meshes to serialize, each at its own place in a buffer, shared by the threads doing it */
+typedef struct
+{
+	MODL *model;
+	unsigned char *buffer;
+	MESH **meshes;
+	//where each mesh starts in the buffer
+	size_t *offsets;
+	int numMeshes;
+
+	pthread_mutex_t lock;
+	//the next mesh to serialize
+	int next;
+} MESHWRITER;
+
+/* Take meshes one at a time until there are none left (also a pthread start routine) */
+void *meshWriter( void *arg )
+{
+	MESHWRITER *w = arg;
+
+	pthread_mutex_lock(&w->lock);
+	while( w->next < w->numMeshes )
+	{
+		int i = w->next++;
+		pthread_mutex_unlock(&w->lock);
+		OUTCURSOR out = { w->buffer, w->offsets[i] };
+		putMesh(&out, w->model, w->meshes[i]);
+		pthread_mutex_lock(&w->lock);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+/* Serialize the meshes into their places in the buffer, which don't overlap, so each can be written independently.  Spread over threads if there are <bytes> enough of them, the buffer ends up the same either way. */
+void putMeshes( MESHWRITER *w, size_t bytes )
+{
+	int numThreads = writeThreads;
+	if( numThreads <= 0 ) numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if( (size_t)numThreads > bytes / MIN_THREAD_BYTES ) numThreads = (int)(bytes / MIN_THREAD_BYTES);
+	if( numThreads > w->numMeshes ) numThreads = w->numMeshes;
+	if( numThreads > MAX_WRITE_THREADS ) numThreads = MAX_WRITE_THREADS;
+
+	w->next = 0;
+	if( numThreads <= 1 )
+	{
+		//in order on this thread
+		for(int i=0; i < w->numMeshes; i++)
+		{
+			OUTCURSOR out = { w->buffer, w->offsets[i] };
+			putMesh(&out, w->model, w->meshes[i]);
+		}
+		return;
+	}
+
+	//this thread serializes along with the rest
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_t threads[MAX_WRITE_THREADS];
+	int numStarted = 0;
+	for(int i=1; i < numThreads; i++)
+	{
+		if( pthread_create(&threads[numStarted], NULL, meshWriter, w) == 0 ) numStarted++;
+	}
+	meshWriter(w);
+	for(int i=0; i < numStarted; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	pthread_mutex_destroy(&w->lock);
+}
+
+/* Set how many threads write3do() may serialize meshes with, 0 (the default) for one per processor and 1 to serialize serially */
+void setWriteThreads( int numThreads )
+{
+	writeThreads = numThreads > 0 ? numThreads : 0;
+}
+
+/* Serialize a MODL structure into a newly allocated buffer holding exactly the bytes of the .3do file.  The size is stored in <*size>, the caller frees the buffer. */
+unsigned char *serialize3do( MODL *model, size_t *size )
+{
+	*size = size3doFile(model);
+	OUTCURSOR out = { checked_malloc(*size), 0 };
+	OUTCURSOR *o = &out;
+
+	putHeader(o, model);
+	//the meshes go one after another, leave room for each
+	MESHWRITER w = { model, out.data, model->meshes, checked_malloc(sizeof(size_t) * (model->numMeshes + 1)), model->numMeshes };
+	size_t meshesStart = o->pos;
+	for(int i=0; i < model->numMeshes; i++)
+	{
+		w.offsets[i] = o->pos;
+		o->pos += sizeMeshSection(model->meshes[i]);
+	}
+	putMeshes(&w, o->pos - meshesStart);
+	checked_free(w.offsets);
+
+	putNodesHeader(o, model);
+	for(int i=0; i < model->numNodes; i++)
+	{
+		putNode(o, model->nodes[i]);
+	}
+
+	putFooter(o, model);
+
+	//the sizing and the serializing must agree exactly
+	if( out.pos != *size )
+	{
+		fprintf(stderr, "serialize3do() wrote %lu bytes, expected %lu\n", (unsigned long)out.pos, (unsigned long)*size);
 		exit(EXIT_FAILURE);
 	}
 
-	/* BEGIN WRITING THE FILE */	
+	return out.data;
+}
 
-	/* HEADER SECTION*/
 
-	checked_fwrite(model->fourcc, 1, 4, ofp);
-	writeInt(model->numMaterials, ofp);
-	//write each material name as a block of 32 chars
-	for(int i=0; i < model->numMaterials; i++)
+/* PASSTHROUGH: copying the unchanged sections from the source file */
+
+/* One run of bytes in the file being written, either serialized into the plan's buffer or copied from the source file */
+typedef struct
+{
+	int fromSource;
+	//where the bytes are, in the buffer or the source file
+	size_t offset;
+	size_t length;
+} PIECE;
+
+/* The whole file being written as a list of pieces, in order */
+typedef struct
+{
+	PIECE *pieces;
+	int numPieces;
+	//every serialized piece, one after another
+	unsigned char *buffer;
+	size_t bufferSize;
+	//of the file written, and how much of that comes from the source
+	size_t size;
+	size_t copied;
+} WRITEPLAN;
+
+/* A mesh can be copied if it came from the source and still serializes to the same number of bytes (a check against changes not marked with changedMESH()) */
+int cleanMesh( MESH *mesh )
+{
+	if( mesh->pending ) return 1;
+	return mesh->sourceLength != 0 && sizeMeshSection(mesh) == mesh->sourceLength;
+}
+
+int cleanNode( NODE *node )
+{
+	return node->sourceLength != 0 && sizeNodeSection(node) == node->sourceLength;
+}
+
+/* 1 if any mesh or node of the model can be copied from its source, stopping at the first */
+int anyClean( MODL *model )
+{
+	for(int i=0; i < model->numMeshes; i++) if( cleanMesh(model->meshes[i]) ) return 1;
+	for(int i=0; i < model->numNodes; i++) if( cleanNode(model->nodes[i]) ) return 1;
+	return 0;
+}
+
+/* Add <length> bytes from <offset> in the source or the buffer to the plan, running on from the previous piece where they are contiguous */
+void addPiece( WRITEPLAN *plan, int fromSource, size_t offset, size_t length )
+{
+	plan->size += length;
+	if( fromSource ) plan->copied += length;
+
+	PIECE *last = plan->numPieces != 0 ? &plan->pieces[plan->numPieces - 1] : NULL;
+	if( last != NULL && last->fromSource == fromSource && last->offset + last->length == offset )
 	{
-		writeString32(model->materialNames[i], ofp);
+		last->length += length;
+		return;
 	}
-	writeString32(model->modelName, ofp);
 
-	/* GEOSET SECTION */
+	PIECE *piece = &plan->pieces[plan->numPieces++];
+	piece->fromSource = fromSource;
+	piece->offset = offset;
+	piece->length = length;
+}
 
-	writeInt(model->unknown1, ofp);
-	writeInt(model->numGeosets, ofp);
-	writeInt(model->numMeshes, ofp);
-	//write the meshes
+/* Add whatever has been serialized since <start> to the plan */
+void addSerialized( WRITEPLAN *plan, OUTCURSOR *o, size_t start )
+{
+	if( o->pos != start ) addPiece(plan, 0, start, o->pos - start);
+}
+
+/* Plan writing the model with the clean meshes and nodes copied from its source file.  Only the header, footer and changed sections are serialized. */
+void planWrite( MODL *model, WRITEPLAN *plan )
+{
+	//size the serialized parts first
+	size_t bufferSize = sizeHeaderSection(model) + 8 + MODL_FOOTER_SIZE;
 	for(int i=0; i < model->numMeshes; i++)
 	{
-		writeMesh(model->meshes[i], ofp);	
+		if( !cleanMesh(model->meshes[i]) ) bufferSize += sizeMeshSection(model->meshes[i]);
+	}
+	for(int i=0; i < model->numNodes; i++)
+	{
+		if( !cleanNode(model->nodes[i]) ) bufferSize += sizeNodeSection(model->nodes[i]);
 	}
 
-	/* NODES SECTION */
-	
-	writeInt(model->unknown2, ofp);
-	writeInt(model->numNodes, ofp);
-	//write the nodes
+	//at worst every section alternates between copied and serialized
+	plan->pieces = checked_malloc(sizeof(PIECE) * (2 * ((size_t)model->numMeshes + model->numNodes) + 3));
+	plan->numPieces = 0;
+	plan->buffer = checked_malloc(bufferSize);
+	plan->bufferSize = bufferSize;
+	plan->size = 0;
+	plan->copied = 0;
+
+	OUTCURSOR out = { plan->buffer, 0 };
+	OUTCURSOR *o = &out;
+	size_t start = 0;
+
+	putHeader(o, model);
+	//leave room for each changed mesh, they are all serialized together below
+	MESHWRITER w = { model, plan->buffer, checked_malloc(sizeof(MESH *) * (model->numMeshes + 1)), checked_malloc(sizeof(size_t) * (model->numMeshes + 1)), 0 };
+	size_t meshBytes = 0;
+	for(int i=0; i < model->numMeshes; i++)
+	{
+		MESH *mesh = model->meshes[i];
+		if( !cleanMesh(mesh) )
+		{
+			w.meshes[w.numMeshes] = mesh;
+			w.offsets[w.numMeshes++] = o->pos;
+			size_t length = sizeMeshSection(mesh);
+			o->pos += length;
+			meshBytes += length;
+			continue;
+		}
+		addSerialized(plan, o, start);
+		start = o->pos;
+		addPiece(plan, 1, mesh->sourceOffset, mesh->sourceLength);
+	}
+	putMeshes(&w, meshBytes);
+	checked_free(w.meshes);
+	checked_free(w.offsets);
+
+	putNodesHeader(o, model);
 	for(int i=0; i < model->numNodes; i++)
 	{
-		writeNode(model->nodes[i], ofp);
+		NODE *node = model->nodes[i];
+		if( !cleanNode(node) )
+		{
+			putNode(o, node);
+			continue;
+		}
+		addSerialized(plan, o, start);
+		start = o->pos;
+		addPiece(plan, 1, node->sourceOffset, node->sourceLength);
+	}
+
+	putFooter(o, model);
+	addSerialized(plan, o, start);
+
+	if( out.pos != bufferSize || plan->size != size3doFile(model) )
+	{
+		fprintf(stderr, "planWrite() planned %lu bytes, expected %lu\n", (unsigned long)plan->size, (unsigned long)size3doFile(model));
+		exit(EXIT_FAILURE);
 	}
+}
+
+void freePlan( WRITEPLAN *plan )
+{
+	checked_free(plan->pieces);
+	checked_free(plan->buffer);
+}
+
+/* 1 if every copied piece would land exactly where it already is in a source of <sourceSize> bytes, so writing the serialized pieces over the source produces the new file */
+int planInPlace( WRITEPLAN *plan, size_t sourceSize )
+{
+	if( plan->size != sourceSize ) return 0;
 
-	/* FOOTER SECTION */
+	size_t pos = 0;
+	for(int i=0; i < plan->numPieces; i++)
+	{
+		PIECE *piece = &plan->pieces[i];
+		if( piece->fromSource && piece->offset != pos ) return 0;
+		pos += piece->length;
+	}
 
-	writeFloat(model->modelRadius, ofp);
-	checked_fwrite(model->insertionOffset, 4, 3, ofp);
-	checked_fwrite(model->unknown3, 4, 3, ofp);
-	checked_fwrite(model->unknown4, 4, 6, ofp);
+	return 1;
+}
 
-	//close the file pointer (forgot this :/)
-	//ideally also check that it closed correctly
-	fclose(ofp);
+#ifndef _WIN32
 
-	return;
+/* write() all <n> bytes, returns 0 on success or -1 on failure */
+int writeAll( int fd, const unsigned char *data, size_t n )
+{
+	while( n > 0 )
+	{
+		ssize_t written = write(fd, data, n);
+		if( written <= 0 ) return -1;
+		data += written;
+		n -= written;
+	}
+
+	return 0;
+}
+
+/* pwrite() all <n> bytes at <offset>, returns 0 on success or -1 on failure */
+int pwriteAll( int fd, const unsigned char *data, size_t n, size_t offset )
+{
+	while( n > 0 )
+	{
+		ssize_t written = pwrite(fd, data, n, (off_t)offset);
+		if( written <= 0 ) return -1;
+		data += written;
+		n -= written;
+		offset += written;
+	}
+
+	return 0;
+}
+
+//size of the buffer for copying where copy_file_range() can't be used
+#define COPY_CHUNK (1 << 20)
+
+/* Copy <length> bytes from <offset> in the file <src> to the current position in <dest>.  Returns 0 on success or -1 on failure. */
+int copyRange( int src, size_t offset, int dest, size_t length )
+{
+#ifdef __linux__
+	//within the kernel, or even shared between the files on filesystems that can
+	while( length > 0 )
+	{
+		loff_t from = offset;
+		ssize_t copied = copy_file_range(src, &from, dest, NULL, length, 0);
+		if( copied <= 0 ) break;	//not supported here, carry on below
+		offset += copied;
+		length -= copied;
+	}
+	if( length == 0 ) return 0;
+#endif
+
+	unsigned char *buffer = checked_malloc(COPY_CHUNK);
+	int status = 0;
+	while( length > 0 && status == 0 )
+	{
+		size_t n = length < COPY_CHUNK ? length : COPY_CHUNK;
+		ssize_t got = pread(src, buffer, n, (off_t)offset);
+		if( got <= 0 || writeAll(dest, buffer, got) != 0 ) status = -1;
+		else
+		{
+			offset += got;
+			length -= got;
+		}
+	}
+	checked_free(buffer);
+
+	return status;
+}
+
+/* Write the planned file to <filename>, copying from the model's source.  Returns 0 on success or -1 on failure. */
+int writePlan( MODL *model, WRITEPLAN *plan, char *filename )
+{
+	int src = open(model->sourceFile, O_RDONLY);
+	if( src == -1 )
+	{
+		fprintf(stderr, "Could not open %s to copy from.\n", model->sourceFile);
+		return -1;
+	}
+	int dest = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if( dest == -1 )
+	{
+		fprintf(stderr, "Could not open %s for writing.\n", filename);
+		close(src);
+		return -1;
+	}
+
+	int status = 0;
+	for(int i=0; i < plan->numPieces && status == 0; i++)
+	{
+		PIECE *piece = &plan->pieces[i];
+		if( piece->fromSource ) status = copyRange(src, piece->offset, dest, piece->length);
+		else status = writeAll(dest, plan->buffer + piece->offset, piece->length);
+	}
+	if( close(dest) != 0 ) status = -1;
+	close(src);
+
+	if( status != 0 ) fprintf(stderr, "Failed to write all of %s.\n", filename);
+	countBytes(plan->copied, plan->size);
+	return status;
+}
+
+/* Write just the serialized pieces of the plan over the source file, which must be <filename>.  Returns 0 on success or -1 on failure. */
+int patchPlan( WRITEPLAN *plan, char *filename )
+{
+	int dest = open(filename, O_WRONLY);
+	if( dest == -1 )
+	{
+		fprintf(stderr, "Could not open %s for writing.\n", filename);
+		return -1;
+	}
+
+	int status = 0;
+	size_t pos = 0;
+	for(int i=0; i < plan->numPieces && status == 0; i++)
+	{
+		PIECE *piece = &plan->pieces[i];
+		if( !piece->fromSource ) status = pwriteAll(dest, plan->buffer + piece->offset, piece->length, pos);
+		pos += piece->length;
+	}
+	if( close(dest) != 0 ) status = -1;
+
+	if( status != 0 ) fprintf(stderr, "Failed to write all of %s.\n", filename);
+	countBytes(0, plan->bufferSize);
+	return status;
+}
+
+/* Write the model without serializing what can be copied or left where it is.  Returns 0 or -1 as write3do(), or 1 if it has to be serialized in full after all (nothing written). */
+int passthrough3do( MODL *model, char *filename )
+{
+	//the source must be exactly as it was read, or the offsets mean nothing
+	FILESTAMP now, out;
+	if( model->sourceFile == NULL ) return 1;
+	if( stampFile(model->sourceFile, &now) != 0 || !sameContents(&now, &model->source) ) return 1;
+
+	//with nothing to copy the plan would be the whole model, only to be serialized again by write3do()
+	if( !anyClean(model) ) return 1;
+
+	WRITEPLAN plan;
+	planWrite(model, &plan);
+	int status;
+	//writing over the source only works if the copied pieces needn't move
+	if( stampFile(filename, &out) == 0 && sameFile(&out, &model->source) )
+	{
+		status = planInPlace(&plan, model->source.size) ? patchPlan(&plan, filename) : 1;
+	}
+	else status = writePlan(model, &plan, filename);
+	freePlan(&plan);
+
+	return status;
+}
+
+#endif
+
+/* Write a MODL structure as a binary .3do file with name <filename>.  Returns 0 on success, -1 on failure. */
+int write3do( MODL *model, char *filename )
+{
+	beginPhase("write3do");
+	countStat(STAT_MESHES, model->numMeshes);
+
+#ifndef _WIN32
+	int passed = passthrough3do(model, filename);
+	if( passed != 1 )
+	{
+		endPhase();
+		return passed;
+	}
+#endif
+
+	//pending meshes are copied from the mapping of the source, which is only what was read if the file hasn't changed since
+	FILESTAMP now;
+	for(int i=0; i < model->numMeshes; i++)
+	{
+		if( !model->meshes[i]->pending ) continue;
+		if( model->sourceFile == NULL || stampFile(model->sourceFile, &now) != 0 || !sameContents(&now, &model->source) )
+		{
+			fprintf(stderr, "Meshes of the .3do were never decoded and it has changed since it was read, not writing %s.\n", filename);
+			endPhase();
+			return -1;
+		}
+		break;
+	}
+
+	size_t size;
+	unsigned char *buffer = serialize3do(model, &size);
+
+	//open the file for writing, check success
+	FILE *ofp = fopen(filename, "wb");
+	if( ofp == NULL )
+	{
+		fprintf(stderr, "Could not open %s for writing.\n", filename);
+		checked_free(buffer);
+		endPhase();
+		return -1;
+	}
+
+	//the whole file in one go
+	int status = 0;
+	size_t written = fwrite(buffer, 1, size, ofp);
+	if( fclose(ofp) != 0 || written != size )
+	{
+		fprintf(stderr, "fwrite() failed to write all bytes.\n");
+		status = -1;
+	}
+	countBytes(0, written);
+
+	checked_free(buffer);
+	endPhase();
+	return status;
 }
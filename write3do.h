@@ -1,2 +1,11 @@
-/*Write the MODL structure to a binary .3do file with name <filename> */
-void write3do( MODL *model, char *filename);
+/*Write the MODL structure to a binary .3do file with name <filename>, returning 0 on success or -1 on failure.  Meshes and nodes unchanged since read3do() are copied from the original file rather than serialized. */
+int write3do( MODL *model, char *filename);
+
+/*The exact size in bytes of the .3do file write3do() would produce */
+size_t size3doFile( MODL *model );
+
+/*Set how many threads write3do() may serialize the meshes of a large model with, 0 (the default) for one per processor and 1 to serialize serially */
+void setWriteThreads( int numThreads );
+
+/*Serialize the MODL structure into a single malloc'd buffer holding the .3do file, its size is stored in <*size> */
+unsigned char *serialize3do( MODL *model, size_t *size );
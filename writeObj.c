@@ -1,28 +1,102 @@
 /* Functions that given a MODL structure (defined in modl.h) write the appropriate data to a Wavefront .obj file */
 
+//threads and sysconf() are POSIX, not C99
+#define _POSIX_C_SOURCE 200809L
+
 #include "modl.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "checkedMem.h"
 #include "matScaler.h"
+#include "textOut.h"
+#include "writeObj.h"
+#include "stats.h"
+
+//models are not written on more threads than they have this many vertices and faces each
+#define MIN_THREAD_ELEMENTS (1 << 15)
+#define MAX_PRINT_THREADS 64
+//meshes each thread may format ahead of the one being written out
+#define PRINT_AHEAD 2
+//starting size of the buffer each mesh is formatted into on its own
+#define MESH_TEXT_SIZE (1 << 16)
+
+//digits after the decimal point for every float written, FLOAT_SHORTEST for exact round trips
+static int objPrecision = FLOAT_SHORTEST;
+//threads formatting the meshes, 0 for one per processor
+static int printThreads = 0;
+
+/* A mesh in the order printNode() puts them, with everything needed to format it independently of the others */
+typedef struct
+{
+    MESH *mesh;
+    float offset[3];
+    //the index offsets after all the meshes before it
+    INDEXOFFSETS io;
+    //its text once formatted, NULL until then
+    TEXTBUF *text;
+} PRINTITEM;
+
+/* The meshes of a .obj being written, shared by the threads formatting them */
+typedef struct
+{
+    char **materialNames;
+    PRINTITEM *items;
+    int numItems;
+    int itemSize;
+
+    pthread_mutex_t lock;
+    //signalled whenever a mesh is formatted or written
+    pthread_cond_t changed;
+    //the next mesh to format, and how many have been written out
+    int next;
+    int written;
+    //how far formatting may run ahead of writing
+    int ahead;
+    //set if writing fails, the threads stop
+    int cancelled;
+} OBJPRINTER;
+
+/* Choose how floats are written to the .obj file: FLOAT_SHORTEST (the default) gives the shortest text that reads back as the identical float, anything else is a fixed number of decimal places like printf("%.*f") */
+void setObjPrecision( int precision )
+{
+    objPrecision = precision;
+}
 
+/* Set how many threads printObj() may format meshes with, 0 (the default) for one per processor and 1 to write serially */
+void setPrintThreads( int numThreads )
+{
+    printThreads = numThreads > 0 ? numThreads : 0;
+}
+
+int getObjPrecision( void )
+{
+    return objPrecision;
+}
 
-/* Writes a MESH structure to a file stream as part of a .obj file.*/
-void printMesh( MODL *model, MESH *mesh, float offset[3], FILE *ofp )
+/* Writes a MESH structure to a text buffer as part of a .obj file.*/
+void printMesh( char **materialNames, MESH *mesh, float offset[3], INDEXOFFSETS *io, TEXTBUF *tb )
 {
     //make each mesh a separate group
     //NOTE: writing with "g groups", not o groups
-    fprintf(ofp, "g %s\n\n", mesh->meshName);
+    tbPutString(tb, "g ");
+    tbPutString(tb, mesh->meshName);
+    tbPutString(tb, "\n\n");
     
     //write out the vertices, adding the correct offset
     for(int i=0; i < mesh->numVertices; i++)
     {
 	//add the correct offset to each coordinate of the vertex
-	float v[3];
-	for(int j=0; j<3; j++) v[j] = mesh->vertices[i][j] + offset[j];
-
-	fprintf(ofp, "v %f %f %f\n", v[0], v[1], v[2]);
+	tbPutChar(tb, 'v');
+	for(int j=0; j<3; j++)
+	{
+	    tbPutChar(tb, ' ');
+	    tbPutFloat(tb, mesh->vertices[i][j] + offset[j]);
+	}
+	tbPutChar(tb, '\n');
     } 
-    fprintf(ofp, "\n");
+    tbPutChar(tb, '\n');
     
     //write out the texture vertices
     for(int i=0; i < mesh->numTexVertices; i++)
@@ -30,77 +104,93 @@ void printMesh( MODL *model, MESH *mesh, float offset[3], FILE *ofp )
 	float *vt = mesh->texVertices[i];
 	
 	//NOTE: Writing out the texture vertices here is tied to how they must be read back in within readObj.c  Whatever happens here must be "undone" when reading back in after editing
-	fprintf(ofp, "vt %f %f\n", vt[0], -vt[1]); 
+	tbPutString(tb, "vt ");
+	tbPutFloat(tb, vt[0]);
+	tbPutChar(tb, ' ');
+	tbPutFloat(tb, -vt[1]);
+	tbPutChar(tb, '\n');
     }
-    fprintf(ofp, "\n");
+    tbPutChar(tb, '\n');
 
 
     //write out the vertex normals
     for(int i=0; i < mesh->numVertices; i++)
     {
 	float *vn = mesh->normals[i];
-	fprintf(ofp, "vn %f %f %f\n", vn[0], vn[1], vn[2]);
+	tbPutString(tb, "vn");
+	for(int j=0; j<3; j++)
+	{
+	    tbPutChar(tb, ' ');
+	    tbPutFloat(tb, vn[j]);
+	}
+	tbPutChar(tb, '\n');
     }
-    fprintf(ofp, "\n");
+    tbPutChar(tb, '\n');
 
-    //these will be used to store the offset to add to all vertex indices
-    //NOTE: .3do indexes from 0, .obj indexes from 1, intialise offsets with 1
+    //the offset to add to all vertex indices
     //NOTE: vertices and vertex normals are BOTH indexed with the same value
-    static int vertexIndexOffset = 1;
-    static int texVertexIndexOffset = 1;
+    int vertexIndexOffset = io->vertex;
+    int texVertexIndexOffset = io->texVertex;
 
     //remember the previous material index
     int prevMatIndex = -1;
     //PRINT THE FACES
     for(int i=0; i < mesh->numFaces; i++)
     {
-	FACE *face = mesh->faces[i];
+	FACE *face = &mesh->faces[i];
+	int *vertexIndices = mesh->faceVertexIndices + mesh->faceOffsets[i];
+	int *texVertexIndices = mesh->faceTexVertexIndices + mesh->faceOffsets[i];
 	//determine the material to use
 	if(face->hasMaterial != 0 && face->materialIndex != prevMatIndex)
 	{
 	    //update index and declare new material in .obj file
-	    fprintf(ofp, "usemtl ");
-	    char *m = model->materialNames[face->materialIndex];
-	    
-	/*
-	    //replace the .mat with some other format for whatever texture 
-	    //may not use this, see replacement directly below
-	    int c = 0;
-	    do {fprintf(ofp, "%c", m[c]);} while(m[c++] != '.');
-	    fprintf(ofp, "gif\n");
-	*/
 	    //print "whatever.mat" as the material name, if eventually do a .mtl as will this can remain the name and the texture specified within the .mtl  Then when reading back in can just use the material name directly to determine which .mat to use
-	    fprintf(ofp, "%s\n", m);
+	    tbPutString(tb, "usemtl ");
+	    tbPutString(tb, materialNames[face->materialIndex]);
+	    tbPutChar(tb, '\n');
 	    prevMatIndex = face->materialIndex;
 	}
 
 
 	//format "f v/vt/vn v/vt/vn ..." a triplet of indices for each vertex
-	fprintf(ofp, "f ");
+	tbPutString(tb, "f ");
 	//print the indices for each vertex
 	for(int j=0; j < face->numVertices; j++)
 	{
 	    //calculate the indice triplets  
-	    int vi = face->vertexIndices[j] + vertexIndexOffset;
-	    int tvi = face->texVertexIndices[j] + texVertexIndexOffset;
-	    fprintf(ofp, "%d/%d/%d ", vi, tvi, vi);
+	    int vi = vertexIndices[j] + vertexIndexOffset;
+	    int tvi = texVertexIndices[j] + texVertexIndexOffset;
+	    tbPutInt(tb, vi);
+	    tbPutChar(tb, '/');
+	    tbPutInt(tb, tvi);
+	    tbPutChar(tb, '/');
+	    tbPutInt(tb, vi);
+	    tbPutChar(tb, ' ');
 	}
-	fprintf(ofp, "\n");
+	tbPutChar(tb, '\n');
     }
 
-    fprintf(ofp, "\n");
+    tbPutChar(tb, '\n');
 
     //update the index offsets
-    vertexIndexOffset += mesh->numVertices;
-    texVertexIndexOffset += mesh->numTexVertices;
+    io->vertex += mesh->numVertices;
+    io->texVertex += mesh->numTexVertices;
 
     //all for now
     return;
 
 }
 
-/* Recursively print a node hierarchy to a file stream in the .obj format */
-void printNode(MODL *model, NODE *node, float parentOffset[3], FILE *ofp)
+/* Count a mesh as written */
+void countMesh(MESH *mesh)
+{
+    countStat(STAT_MESHES, 1);
+    countStat(STAT_VERTICES, mesh->numVertices);
+    countStat(STAT_FACES, mesh->numFaces);
+}
+
+/* Recursively list the meshes of a node hierarchy in the order they go in the .obj file.  Each mesh's index offsets are those after all the meshes before it, so they can be formatted in any order. */
+void printNode(MODL *model, NODE *node, float parentOffset[3], INDEXOFFSETS *io, OBJPRINTER *p)
 {
     //add this nodes offset to it's parent (accumulating as we recurse)
     float nodeOffset[3];
@@ -111,9 +201,22 @@ void printNode(MODL *model, NODE *node, float parentOffset[3], FILE *ofp)
     for(int i=0; i<3; i++) meshOffset[i] = nodeOffset[i] + node->pivot[i];
 
     //draw the mesh for this node if it has one
-    if(node->meshID != -1)
+    //(meshes left pending or unwanted by read3doLazy() weren't asked for, so are left out)
+    if(node->meshID != -1 && !model->meshes[node->meshID]->pending && !model->meshes[node->meshID]->unwanted)
     {
-	printMesh(model, model->meshes[node->meshID], meshOffset, ofp);	
+	if(p->numItems == p->itemSize)
+	{
+	    p->itemSize = p->itemSize * 2 + 16;
+	    p->items = checked_realloc(p->items, sizeof(PRINTITEM) * p->itemSize);
+	}
+	PRINTITEM *item = &p->items[p->numItems++];
+	item->mesh = model->meshes[node->meshID];
+	for(int i=0; i<3; i++) item->offset[i] = meshOffset[i];
+	item->io = *io;
+	item->text = NULL;
+
+	io->vertex += item->mesh->numVertices;
+	io->texVertex += item->mesh->numTexVertices;
     }
 
     //recurse and print the child nodes if it has any
@@ -121,32 +224,156 @@ void printNode(MODL *model, NODE *node, float parentOffset[3], FILE *ofp)
     {
 	//just recurses to the first child which will then itself recurse to 
 	//any remaining siblings, see next block down
-	printNode(model, model->nodes[node->childID], nodeOffset, ofp); 
+	printNode(model, model->nodes[node->childID], nodeOffset, io, p); 
     }
 
     //recurse and print the current node's siblings if it has any
     if(node->hasSibling != 0)
     {
 	//NOTE: siblings all share the same original parent offset
-	printNode(model, model->nodes[node->siblingID], parentOffset, ofp);
+	printNode(model, model->nodes[node->siblingID], parentOffset, io, p);
+    }
+}
+
+/* Format mesh <i> into a buffer of its own */
+TEXTBUF *formatMesh(OBJPRINTER *p, int i)
+{
+    PRINTITEM *item = &p->items[i];
+    TEXTBUF *tb = createTEXTBUF(NULL, MESH_TEXT_SIZE, objPrecision);
+    INDEXOFFSETS io = item->io;
+    printMesh(p->materialNames, item->mesh, item->offset, &io, tb);
+
+    return tb;
+}
+
+/* Format meshes in turn, staying no more than <ahead> in front of the writing (a pthread start routine) */
+void *printWorker(void *arg)
+{
+    OBJPRINTER *p = arg;
+
+    pthread_mutex_lock(&p->lock);
+    while(!p->cancelled && p->next < p->numItems)
+    {
+	if(p->next >= p->written + p->ahead)
+	{
+	    pthread_cond_wait(&p->changed, &p->lock);
+	    continue;
+	}
+	int i = p->next++;
+	pthread_mutex_unlock(&p->lock);
+	TEXTBUF *tb = formatMesh(p, i);
+	pthread_mutex_lock(&p->lock);
+	p->items[i].text = tb;
+	pthread_cond_broadcast(&p->changed);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+/* Write the listed meshes to <ofp> in order.  Large models are formatted on several threads, each mesh into its own buffer, while this thread writes the buffers out in turn.  The text is the same either way.  Returns 1 if writing failed. */
+int writeMeshes(OBJPRINTER *p, FILE *ofp)
+{
+    long long elements = 0;
+    for(int i=0; i < p->numItems; i++) elements += p->items[i].mesh->numVertices + p->items[i].mesh->numFaces;
+
+    int numThreads = printThreads;
+    if(numThreads <= 0) numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(numThreads > elements / MIN_THREAD_ELEMENTS) numThreads = (int)(elements / MIN_THREAD_ELEMENTS);
+    if(numThreads > p->numItems) numThreads = p->numItems;
+    if(numThreads > MAX_PRINT_THREADS) numThreads = MAX_PRINT_THREADS;
+
+    pthread_t threads[MAX_PRINT_THREADS];
+    int numStarted = 0;
+    if(numThreads > 1)
+    {
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->changed, NULL);
+	p->next = 0;
+	p->written = 0;
+	p->ahead = numThreads * PRINT_AHEAD;
+	p->cancelled = 0;
+	for(int i=0; i < numThreads; i++)
+	{
+	    if(pthread_create(&threads[numStarted], NULL, printWorker, p) == 0) numStarted++;
+	}
+	if(numStarted == 0)
+	{
+	    pthread_mutex_destroy(&p->lock);
+	    pthread_cond_destroy(&p->changed);
+	}
+    }
+
+    if(numStarted == 0)
+    {
+	//one after another straight into the file
+	TEXTBUF *tb = createTEXTBUF(ofp, TEXTBUF_SIZE, objPrecision);
+	for(int i=0; i < p->numItems; i++)
+	{
+	    INDEXOFFSETS io = p->items[i].io;
+	    printMesh(p->materialNames, p->items[i].mesh, p->items[i].offset, &io, tb);
+	    countMesh(p->items[i].mesh);
+	}
+	flushTEXTBUF(tb);
+	int failed = tb->failed;
+	freeTEXTBUF(tb);
+	return failed;
     }
+
+    int failed = 0;
+    for(int i=0; i < p->numItems && !failed; i++)
+    {
+	pthread_mutex_lock(&p->lock);
+	while(p->items[i].text == NULL) pthread_cond_wait(&p->changed, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+
+	TEXTBUF *tb = p->items[i].text;
+	if(fwrite(tb->data, 1, tb->len, ofp) != tb->len)
+	{
+	    fprintf(stderr, "fwrite() failed to write all bytes.\n");
+	    failed = 1;
+	}
+	countMesh(p->items[i].mesh);
+
+	pthread_mutex_lock(&p->lock);
+	p->written = i + 1;
+	p->cancelled = failed;
+	pthread_cond_broadcast(&p->changed);
+	pthread_mutex_unlock(&p->lock);
+    }
+
+    for(int i=0; i < numStarted; i++)
+    {
+	pthread_join(threads[i], NULL);
+    }
+    //the text of every mesh, including any formatted after a failure
+    for(int i=0; i < p->numItems; i++)
+    {
+	freeTEXTBUF(p->items[i].text);
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->changed);
+
+    return failed;
 }
 
 
-/* Accepts a MODL structure previously filled by read3d0() and the name of the file to write to. */ 
-void printObj( MODL *model, char *filename )
+/* Accepts a MODL structure previously filled by read3d0() and the name of the file to write to.  Returns 0 on success, -1 on failure. */ 
+int printObj( MODL *model, char *filename )
 {
     if(model == NULL)
     {
 	fprintf(stderr, "printObj() called with null MODL*\n");
-	return;
+	return -1;
     }
     if(filename == NULL)
     {
 	fprintf(stderr, "printObj() called with null filename.\n");
-	return;
+	return -1;
     }
 
+    beginPhase("printObj");
+
     //SCALE THE TEXTURE VERTICES TO THE .OBJ format (0 - 1)
     scaleTexVerts(model, 0);   //MUST UNDO WHEN READING BACK In
 
@@ -156,37 +383,58 @@ void printObj( MODL *model, char *filename )
     if(ofp == NULL)
     {
 	fprintf(stderr, "Could not open %s for writing.\n", filename);
-	return;
+	endPhase();
+	return -1;
     }
 
-    
-    //print the nodes recursively by starting with the first
+
+    //list the meshes by going through the nodes recursively, starting with the first
+    OBJPRINTER printer = { model->materialNames, NULL, 0, 0 };
     if(model->numNodes != 0)
     {
 	float startingOffset[3] = {0.0, 0.0, 0.0};
-	printNode(model, model->nodes[0], startingOffset, ofp);
+	//NOTE: .3do indexes from 0, .obj indexes from 1, intialise offsets with 1
+	INDEXOFFSETS io = { 1, 1 };
+	printNode(model, model->nodes[0], startingOffset, &io, &printer);
 
     }
-    
-    //close the file (ideally check to ensure it closed properly)
-    fclose(ofp);
-    return; 
+
+    //then write them all out in that order
+    int failed = writeMeshes(&printer, ofp);
+    checked_free(printer.items);
+    countBytes(0, ftell(ofp));
+
+    //close the file, checking it all made it out
+    failed = fclose(ofp) != 0 || failed;
+    endPhase();
+    if(failed)
+    {
+	fprintf(stderr, "Failed to write %s\n", filename);
+	return -1;
+    }
+    return 0; 
 	
 		
 }
 
-/* Accepts a MODL structure previously filled by read3do() and the name of the file to write to.  It then produces a .mtl file to accompany the .obj file.  Each material name will be for example "m_eye.mat" and it will then specify a texture for that material (perhaps "m_eye.gif" pr whatever format is passed in via the imFormat paramter */
-void printMtl( MODL *model, char *filename, char *imFormat )
+/* Accepts a MODL structure previously filled by read3do() and the name of the file to write to.  It then produces a .mtl file to accompany the .obj file.  Each material name will be for example "m_eye.mat" and it will then specify a texture for that material (perhaps "m_eye.gif" pr whatever format is passed in via the imFormat paramter.  Returns 0 on success, -1 on failure. */
+int printMtl( MODL *model, char *filename, char *imFormat )
 {
     if(model == NULL)
     {
 	fprintf(stderr, "printMtl() called with null MODL*\n");
-	return;
+	return -1;
     }
+    return printMaterials(model->materialNames, model->numMaterials, filename, imFormat);
+}
+
+/* The .mtl for a list of material names, see printMtl() */
+int printMaterials( char **materialNames, int numMaterials, char *filename, char *imFormat )
+{
     if(filename == NULL)
     {
 	fprintf(stderr, "printMtl() called with null filename.\n");
-	return;
+	return -1;
     }
 
     
@@ -195,18 +443,19 @@ void printMtl( MODL *model, char *filename, char *imFormat )
     if(ofp == NULL)
     {
 	fprintf(stderr, "Could not open %s for writing.\n", filename);
-	return;
+	return -1;
     }
 
-    fprintf(ofp, "# Material Count: %d\n", model->numMaterials);
+    beginPhase("printMtl");
+    fprintf(ofp, "# Material Count: %d\n", numMaterials);
 
     //for each material in the MODL create a new material in the .mtl file
-    for(int i=0; i < model->numMaterials; i++)
+    for(int i=0; i < numMaterials; i++)
     {
-	fprintf(ofp, "newmtl %s\n", model->materialNames[i]);
+	fprintf(ofp, "newmtl %s\n", materialNames[i]);
 	fprintf(ofp, "map_Kd ");
 	//swap the .mat for .gif (or whatever is needed)
-	char *t = model->materialNames[i];
+	char *t = materialNames[i];
 	while(*t != '.')
 	{
 	    fprintf(ofp, "%c", *t);
@@ -219,6 +468,14 @@ void printMtl( MODL *model, char *filename, char *imFormat )
     }
 
     //close the file and return
-    fclose(ofp);
-    return;
+    countBytes(0, ftell(ofp));
+    int failed = ferror(ofp);
+    failed = fclose(ofp) != 0 || failed;
+    endPhase();
+    if(failed)
+    {
+	fprintf(stderr, "Failed to write %s\n", filename);
+	return -1;
+    }
+    return 0;
 }
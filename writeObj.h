@@ -1,3 +1,26 @@
-void printObj( MODL *model, char *filename );
+/* Writing .obj and .mtl files (include modl.h and textOut.h first) */
 
-void printMtl( MODL *model, char *filename, char *imFormat );
+/* Both return 0 on success, -1 on failure */
+int printObj( MODL *model, char *filename );
+
+/* How floats are written by printObj(), FLOAT_SHORTEST (see textOut.h, the default) for exact round trips or a fixed number of decimal places */
+void setObjPrecision( int precision );
+int getObjPrecision( void );
+
+/* Set how many threads printObj() may format the meshes of a large model with, 0 (the default) for one per processor and 1 to write serially */
+void setPrintThreads( int numThreads );
+
+int printMtl( MODL *model, char *filename, char *imFormat );
+
+/* The .mtl for a list of material names, for when there is no whole MODL (see streamObj.c) */
+int printMaterials( char **materialNames, int numMaterials, char *filename, char *imFormat );
+
+/* The offsets added to each mesh's vertex indices as it is written, since the indices of a .obj count through the whole file.  Start both at 1. */
+typedef struct
+{
+    int vertex;
+    int texVertex;
+} INDEXOFFSETS;
+
+/* Write one mesh (with its texture vertices already scaled) as the next group of a .obj, moved by <offset> */
+void printMesh( char **materialNames, MESH *mesh, float offset[3], INDEXOFFSETS *io, TEXTBUF *tb );